@@ -0,0 +1,159 @@
+/*
+ * bench_city_lookup.c
+ *
+ * Microbenchmark: perfect-hash city lookup vs. the original linear
+ * CaseInsensitiveCompare scan, on catalogs of 10 to 100,000 cities, with
+ * the time to build each table (what a -C load or SIGHUP reload costs).
+ * Queries are half hits (with random casing) and half misses.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "city_hash.h"
+
+#define QUERY_COUNT 1024
+#define MIN_BENCH_NS 200000000.0    // misura ogni caso per almeno 0.2 s
+
+static const char *g_builtinCities[] = {
+	"Bari", "Roma", "Milano", "Napoli", "Torino",
+	"Palermo", "Genova", "Bologna", "Firenze", "Venezia"
+};
+
+static volatile long g_sink;
+
+static double NowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// The lookup used before the perfect hash (see IsCitySupported history)
+static int CaseInsensitiveCompare(const char *s1, const char *s2) {
+	while (*s1 && *s2) {
+		if (tolower((unsigned char)*s1) != tolower((unsigned char)*s2)) {
+			return 1;
+		}
+		s1++;
+		s2++;
+	}
+	return (*s1 != *s2);
+}
+
+static int LinearLookup(const char *const *names, int count, const char *city) {
+	for (int i = 0; i < count; i++) {
+		if (CaseInsensitiveCompare(city, names[i]) == 0) {
+			return i;
+		}
+	}
+	return CITY_NOT_FOUND;
+}
+
+// Deterministic synthetic name such as "San Bacedo-Lumi 42"
+static void SyntheticName(unsigned int n, char *out, size_t size) {
+	static const char *prefixes[] = { "San ", "Monte ", "Borgo ", "Castel ", "", "Villa " };
+	static const char *syllables[] = { "ba", "ce", "do", "lu", "mi", "ra", "to", "ve", "si", "no" };
+	size_t len = (size_t)snprintf(out, size, "%s", prefixes[n % 6]);
+	unsigned int x = n;
+	do {
+		len += (size_t)snprintf(out + len, size - len, "%s", syllables[x % 10]);
+		x /= 10;
+	} while (x > 0 && len < size - 8);
+	snprintf(out + len, size - len, "-%u", n % 97);
+	out[0] = (char)toupper((unsigned char)out[0]);
+}
+
+static char **MakeCatalog(int count) {
+	char **names = malloc(sizeof(char *) * (size_t)count);
+	for (int i = 0; i < count; i++) {
+		names[i] = malloc(CITY_NAME_MAX + 1);
+		if (i < 10) {
+			strcpy(names[i], g_builtinCities[i]);
+		} else {
+			SyntheticName((unsigned int)i, names[i], CITY_NAME_MAX + 1);
+		}
+	}
+	return names;
+}
+
+static void MakeQueries(char **names, int count, char queries[][CITY_NAME_MAX + 1]) {
+	unsigned int state = 12345;
+	for (int q = 0; q < QUERY_COUNT; q++) {
+		state = state * 1103515245u + 12345u;
+		if (q % 2 == 0) {
+			// Hit with random casing
+			strcpy(queries[q], names[(state >> 8) % (unsigned int)count]);
+			for (char *c = queries[q]; *c; c++) {
+				state = state * 1103515245u + 12345u;
+				if ((state >> 16) & 1) {
+					*c = (char)toupper((unsigned char)*c);
+				}
+			}
+		} else {
+			// Miss: a synthetic name beyond the catalog
+			SyntheticName((unsigned int)count + (state >> 8) % 100000u, queries[q], CITY_NAME_MAX + 1);
+		}
+	}
+}
+
+static void RunCase(int count) {
+	static char queries[QUERY_COUNT][CITY_NAME_MAX + 1];
+	char **names = MakeCatalog(count);
+	struct city_table table;
+
+	double buildStart = NowNs();
+	if (CityTableBuild((const char *const *)names, count, &table) != 0) {
+		fprintf(stderr, "Cannot build table for %d cities\n", count);
+		exit(1);
+	}
+	printf("%-8d %-14s %10.3f ms\n", count, "build", (NowNs() - buildStart) / 1e6);
+	MakeQueries(names, count, queries);
+
+	// Both lookups must agree before timing means anything
+	for (int q = 0; q < QUERY_COUNT; q++) {
+		int expected = LinearLookup((const char *const *)names, count, queries[q]);
+		if (CityTableLookup(&table, queries[q]) != expected) {
+			fprintf(stderr, "Mismatch for '%s'\n", queries[q]);
+			exit(1);
+		}
+	}
+
+	const char *methods[] = { "linear", "perfect-hash" };
+	for (int m = 0; m < 2; m++) {
+		long ops = 0;
+		long found = 0;
+		double start = NowNs();
+		double elapsed;
+		do {
+			for (int q = 0; q < QUERY_COUNT; q++) {
+				int id = (m == 0) ? LinearLookup((const char *const *)names, count, queries[q])
+				                  : CityTableLookup(&table, queries[q]);
+				found += (id != CITY_NOT_FOUND);
+			}
+			ops += QUERY_COUNT;
+			elapsed = NowNs() - start;
+		} while (elapsed < MIN_BENCH_NS);
+		g_sink = found;
+
+		printf("%-8d %-14s %10.1f ns/op %14.0f ops/s\n",
+		       count, methods[m], elapsed / (double)ops, (double)ops * 1e9 / elapsed);
+	}
+
+	CityTableFree(&table);
+	for (int i = 0; i < count; i++) {
+		free(names[i]);
+	}
+	free(names);
+}
+
+int main(void) {
+	printf("%-8s %-14s %16s %20s\n", "cities", "method", "time", "throughput");
+	RunCase(10);
+	RunCase(100);
+	RunCase(1000);
+	RunCase(10000);
+	RunCase(100000);
+	return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * bench_codec.c
+ *
+ * Microbenchmarks for the wire codec (common/src/protocol.c) and the
+ * server validators (server-project/src/validate.c) on realistic and
+ * adversarial inputs.
+ *
+ *   bench_codec [--json FILE] [--baseline FILE] [--threshold PERCENT]
+ *
+ * --json writes the results as JSON; --baseline compares ns/op with a
+ * file written by an earlier --json run and exits with status 1 if any
+ * benchmark got slower by more than the threshold (default 20%).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "protocol.h"
+
+#define MIN_ROUND_NS 20000000.0
+#define BENCH_ROUNDS 5
+#define INNER_LOOP 1024
+#define CORPUS_MASK 15
+#define MAX_RESULTS 32
+#define DEFAULT_THRESHOLD 20.0
+
+struct bench_result {
+	const char *name;
+	double nsPerOp;
+	double opsPerSec;
+};
+
+static struct bench_result g_results[MAX_RESULTS];
+static int g_resultCount;
+static volatile long g_sink;
+
+static const char *g_realisticCities[CORPUS_MASK + 1] = {
+	"Bari", "Roma", "Milano", "Napoli", "Torino", "Palermo", "Genova", "Bologna",
+	"Firenze", "Venezia", "bari", "ROMA", "Parigi", "Londra", "Reggio Calabria", "Trento"
+};
+
+// 63 characters: the longest city a request can carry
+static const char g_maxCity[] = "Llanfairpwllgwyngyllgogerychwyrndrobwllllantysiliogogogochabcde";
+static const char g_maxCityBadTail[] = "Llanfairpwllgwyngyllgogerychwyrndrobwllllantysiliogogogochabcd$";
+
+static double NowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void Record(const char *name, double nsPerOp, long total) {
+	g_sink = total;
+	if (g_resultCount < MAX_RESULTS) {
+		g_results[g_resultCount].name = name;
+		g_results[g_resultCount].nsPerOp = nsPerOp;
+		g_results[g_resultCount].opsPerSec = 1e9 / nsPerOp;
+		g_resultCount++;
+	}
+	printf("%-36s %10.2f ns/op %14.0f ops/s\n", name, nsPerOp, 1e9 / nsPerOp);
+}
+
+// Time EXPR (which may use the loop index i) for BENCH_ROUNDS rounds of at least
+// MIN_ROUND_NS each and keep the fastest round, which filters scheduler noise
+#define BENCH(name, expr)                                          \
+	do {                                                           \
+		double best_ = 0;                                          \
+		long total_ = 0;                                           \
+		for (int round_ = 0; round_ < BENCH_ROUNDS; round_++) {    \
+			long ops_ = 0;                                         \
+			double start_ = NowNs();                               \
+			double elapsed_;                                       \
+			do {                                                   \
+				for (int i = 0; i < INNER_LOOP; i++) {             \
+					total_ += (long)(expr);                        \
+				}                                                  \
+				ops_ += INNER_LOOP;                                \
+				elapsed_ = NowNs() - start_;                       \
+			} while (elapsed_ < MIN_ROUND_NS);                     \
+			double ns_ = elapsed_ / (double)ops_;                  \
+			if (round_ == 0 || ns_ < best_) {                      \
+				best_ = ns_;                                       \
+			}                                                      \
+		}                                                          \
+		Record(name, best_, total_);                               \
+	} while (0)
+
+static void RunBenchmarks(void) {
+	static struct request requests[CORPUS_MASK + 1];
+	static struct request maxRequest;
+	static char datagrams[CORPUS_MASK + 1][BUFFER_SIZE];
+	static int datagramSizes[CORPUS_MASK + 1];
+	static char unterminated[BUFFER_SIZE];
+	static struct response responses[CORPUS_MASK + 1];
+	static char encodedResponses[CORPUS_MASK + 1][BUFFER_SIZE];
+	static char formatCities[CORPUS_MASK + 1][MAX_CITY_LENGTH];
+	static char formatMax[MAX_CITY_LENGTH];
+	char out[BUFFER_SIZE];
+	struct request req;
+	struct request_view view;
+	struct response resp;
+
+	for (int k = 0; k <= CORPUS_MASK; k++) {
+		requests[k].type = "thwp"[k % 4];
+		strcpy(requests[k].city, g_realisticCities[k]);
+		datagramSizes[k] = SerializeRequest(&requests[k], datagrams[k], BUFFER_SIZE);
+
+		responses[k].status = (unsigned int)(k % 3);
+		responses[k].type = requests[k].type;
+		responses[k].value = (float)k * 3.7f - 10.0f;
+		SerializeResponse(&responses[k], encodedResponses[k], BUFFER_SIZE);
+
+		strcpy(formatCities[k], g_realisticCities[k]);
+	}
+	maxRequest.type = 't';
+	strcpy(maxRequest.city, g_maxCity);
+	memset(unterminated, 'a', sizeof(unterminated));
+	strcpy(formatMax, g_maxCity);
+
+	// FormatCityName is idempotent, so the same buffers can be formatted repeatedly
+	BENCH("serialize_request/realistic", SerializeRequest(&requests[i & CORPUS_MASK], out, BUFFER_SIZE));
+	BENCH("serialize_request/max_city", SerializeRequest(&maxRequest, out, BUFFER_SIZE));
+	BENCH("deserialize_request/realistic",
+	      DeserializeRequest(datagrams[i & CORPUS_MASK], datagramSizes[i & CORPUS_MASK], &req) + req.city[0]);
+	BENCH("deserialize_request/unterminated", DeserializeRequest(unterminated, BUFFER_SIZE, &req) + req.city[0]);
+	BENCH("deserialize_request/too_short", DeserializeRequest(unterminated, 1, &req));
+	BENCH("parse_request_view/realistic",
+	      ParseRequestView(datagrams[i & CORPUS_MASK], datagramSizes[i & CORPUS_MASK], &view) + view.cityLen);
+	BENCH("parse_request_view/unterminated", ParseRequestView(unterminated, BUFFER_SIZE, &view) + view.cityLen);
+	BENCH("serialize_response/realistic", SerializeResponse(&responses[i & CORPUS_MASK], out, BUFFER_SIZE));
+	BENCH("serialize_response/small_buffer", SerializeResponse(&responses[i & CORPUS_MASK], out, 8));
+	BENCH("deserialize_response/realistic",
+	      DeserializeResponse(encodedResponses[i & CORPUS_MASK], 9, &resp) + (long)resp.status);
+	BENCH("deserialize_response/truncated", DeserializeResponse(encodedResponses[i & CORPUS_MASK], 8, &resp));
+	BENCH("validate_city/realistic", ValidateCity(g_realisticCities[i & CORPUS_MASK]));
+	BENCH("validate_city/max_length", ValidateCity(g_maxCity));
+	BENCH("validate_city/invalid_last_char", ValidateCity(g_maxCityBadTail));
+	BENCH("validate_city/empty", ValidateCity(""));
+	BENCH("format_city_name/realistic", (FormatCityName(formatCities[i & CORPUS_MASK]), formatCities[i & CORPUS_MASK][0]));
+	BENCH("format_city_name/max_length", (FormatCityName(formatMax), formatMax[0]));
+}
+
+static int WriteJson(const char *path) {
+	FILE *f = fopen(path, "w");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	fprintf(f, "{\n  \"benchmarks\": [\n");
+	for (int i = 0; i < g_resultCount; i++) {
+		fprintf(f, "    {\"name\": \"%s\", \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f}%s\n", g_results[i].name,
+		        g_results[i].nsPerOp, g_results[i].opsPerSec, (i + 1 < g_resultCount) ? "," : "");
+	}
+	fprintf(f, "  ]\n}\n");
+	return fclose(f) == 0 ? 0 : -1;
+}
+
+// Look up the ns/op of a benchmark in a file written by WriteJson; -1 if absent
+static double BaselineNs(const char *json, const char *name) {
+	char key[128];
+	snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+	const char *entry = strstr(json, key);
+	if (entry == NULL) {
+		return -1.0;
+	}
+	const char *field = strstr(entry, "\"ns_per_op\":");
+	const char *end = strchr(entry, '}');
+	if (field == NULL || (end != NULL && field > end)) {
+		return -1.0;
+	}
+	return strtod(field + strlen("\"ns_per_op\":"), NULL);
+}
+
+// Compare with the baseline; returns the number of regressions or -1 on error
+static int CompareBaseline(const char *path, double threshold) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	static char json[65536];
+	size_t len = fread(json, 1, sizeof(json) - 1, f);
+	json[len] = '\0';
+	fclose(f);
+
+	int regressions = 0;
+	printf("\nBaseline %s (threshold %.0f%%)\n", path, threshold);
+	for (int i = 0; i < g_resultCount; i++) {
+		double base = BaselineNs(json, g_results[i].name);
+		if (base <= 0) {
+			printf("%-36s %10s\n", g_results[i].name, "new");
+			continue;
+		}
+		double delta = (g_results[i].nsPerOp - base) / base * 100.0;
+		int regressed = delta > threshold;
+		regressions += regressed;
+		printf("%-36s %10.2f -> %8.2f ns/op %+7.1f%%%s\n", g_results[i].name, base, g_results[i].nsPerOp, delta,
+		       regressed ? "  REGRESSION" : "");
+	}
+	return regressions;
+}
+
+int main(int argc, char *argv[]) {
+	const char *jsonPath = NULL;
+	const char *baselinePath = NULL;
+	double threshold = DEFAULT_THRESHOLD;
+
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+			jsonPath = argv[++i];
+		} else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) {
+			baselinePath = argv[++i];
+		} else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = atof(argv[++i]);
+		} else {
+			fprintf(stderr, "Usage: %s [--json FILE] [--baseline FILE] [--threshold PERCENT]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	RunBenchmarks();
+
+	if (jsonPath != NULL && WriteJson(jsonPath) != 0) {
+		return 2;
+	}
+	if (baselinePath != NULL) {
+		int regressions = CompareBaseline(baselinePath, threshold);
+		if (regressions < 0) {
+			return 2;
+		}
+		if (regressions > 0) {
+			printf("%d benchmark(s) regressed\n", regressions);
+			return 1;
+		}
+	}
+	return 0;
+}
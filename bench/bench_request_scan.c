@@ -0,0 +1,268 @@
+/*
+ * bench_request_scan.c
+ *
+ * Verification and microbenchmark for the fused request scanner.
+ * First every available kernel is checked against the original
+ * multi-pass logic (DeserializeRequest, ValidateRequestType,
+ * HasInvalidCharacters, IsCitySupported) on a fuzzed corpus; any
+ * difference aborts. Then each kernel is timed on realistic requests.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "request_scan.h"
+
+#define BUFFER_SIZE 512
+#define MAX_CITY_LENGTH 64
+#define FUZZ_ITERATIONS 2000000
+#define CORPUS_SIZE 1024
+#define MIN_BENCH_NS 200000000.0
+
+static const char *g_supportedCities[] = {
+	"Bari", "Roma", "Milano", "Napoli", "Torino",
+	"Palermo", "Genova", "Bologna", "Firenze", "Venezia"
+};
+
+static volatile long g_sink;
+static uint64_t g_rng = 0x9E3779B97F4A7C15ull;
+
+static uint32_t NextRandom(void) {
+	g_rng ^= g_rng << 13;
+	g_rng ^= g_rng >> 7;
+	g_rng ^= g_rng << 17;
+	return (uint32_t)(g_rng >> 16);
+}
+
+static double NowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/*
+ * Reference: the server's original request path, verbatim
+ */
+
+struct reference_result {
+	unsigned int status;
+	char respType;
+	char type;
+	char city[MAX_CITY_LENGTH];
+};
+
+static int RefCaseInsensitiveCompare(const char *s1, const char *s2) {
+	while (*s1 && *s2) {
+		if (tolower((unsigned char)*s1) != tolower((unsigned char)*s2)) {
+			return 1;
+		}
+		s1++;
+		s2++;
+	}
+	return (*s1 != *s2);
+}
+
+static int RefHasInvalidCharacters(const char *city) {
+	for (int i = 0; city[i] != '\0'; i++) {
+		if (city[i] == '\t') {
+			return 1;
+		}
+		if (!isalnum((unsigned char)city[i]) && city[i] != ' ' && city[i] != '\'' && city[i] != '-') {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int RefIsCitySupported(const char *city) {
+	for (int i = 0; i < 10; i++) {
+		if (RefCaseInsensitiveCompare(city, g_supportedCities[i]) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static void RefHandle(const char *buffer, int bufferSize, struct reference_result *out) {
+	memset(out, 0, sizeof(*out));
+	if (bufferSize < 2) {
+		out->status = 2;
+		out->respType = '?';
+		return;
+	}
+	out->type = buffer[0];
+	int offset = 1;
+	int cityLen = 0;
+	while (offset < bufferSize && cityLen < MAX_CITY_LENGTH - 1 && buffer[offset] != '\0') {
+		out->city[cityLen++] = buffer[offset++];
+	}
+	out->city[cityLen] = '\0';
+	out->respType = out->type;
+
+	if (out->type != 't' && out->type != 'h' && out->type != 'w' && out->type != 'p') {
+		out->status = 2;
+	} else if (RefHasInvalidCharacters(out->city)) {
+		out->status = 2;
+	} else if (!RefIsCitySupported(out->city)) {
+		out->status = 1;
+	} else {
+		out->status = 0;
+	}
+}
+
+/*
+ * Fuzzed datagrams
+ */
+
+static const char g_alphabet[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789 '-\t$.";
+
+// Fill buffer (all BUFFER_SIZE bytes, so junk follows the datagram) and return the datagram length
+static int FuzzDatagram(char *buffer) {
+	for (int i = 0; i < BUFFER_SIZE; i++) {
+		buffer[i] = (char)NextRandom();
+	}
+
+	uint32_t r = NextRandom();
+	static const char types[] = "thwpx?T\0";
+	buffer[0] = types[r % 8];
+	int len;
+
+	switch ((r >> 3) % 6) {
+		case 0: {
+			// Supported city with random casing, optionally terminated
+			const char *city = g_supportedCities[NextRandom() % 10];
+			int n = (int)strlen(city);
+			for (int i = 0; i < n; i++) {
+				buffer[1 + i] = (NextRandom() & 1) ? (char)toupper((unsigned char)city[i]) : city[i];
+			}
+			len = 1 + n;
+			if (NextRandom() & 1) {
+				buffer[len++] = '\0';
+			}
+			break;
+		}
+		case 1: {
+			// Supported city with one byte mutated to anything
+			const char *city = g_supportedCities[NextRandom() % 10];
+			int n = (int)strlen(city);
+			memcpy(buffer + 1, city, (size_t)n);
+			buffer[1 + NextRandom() % (uint32_t)n] = (char)NextRandom();
+			len = 1 + n + (int)(NextRandom() % 2);
+			break;
+		}
+		case 2: {
+			// Plausible characters around the truncation limit (60..70 bytes)
+			int n = 60 + (int)(NextRandom() % 11);
+			for (int i = 0; i < n; i++) {
+				buffer[1 + i] = g_alphabet[NextRandom() % (sizeof(g_alphabet) - 1)];
+			}
+			len = 1 + n;
+			break;
+		}
+		case 3:
+			// Very short datagrams, including empty and type-only
+			len = (int)(NextRandom() % 3);
+			break;
+		case 4: {
+			// Short plausible names with an embedded NUL
+			int n = 1 + (int)(NextRandom() % 20);
+			for (int i = 0; i < n; i++) {
+				buffer[1 + i] = g_alphabet[NextRandom() % (sizeof(g_alphabet) - 1)];
+			}
+			buffer[1 + NextRandom() % (uint32_t)n] = '\0';
+			len = 1 + n;
+			break;
+		}
+		default:
+			// Random bytes of random length
+			len = (int)(NextRandom() % (BUFFER_SIZE - 1));
+			break;
+	}
+	return len;
+}
+
+static int Verify(int impl) {
+	static char buffer[BUFFER_SIZE];
+	struct reference_result ref;
+	struct request_scan scan;
+
+	for (long i = 0; i < FUZZ_ITERATIONS; i++) {
+		int len = FuzzDatagram(buffer);
+		RefHandle(buffer, len, &ref);
+		unsigned int status = ScanRequestWith(impl, &g_cityTable, buffer, len, &scan);
+
+		int idOk = (status == 0) ? (scan.cityId >= 0 &&
+		                            RefCaseInsensitiveCompare(scan.city, g_cityTable.names[scan.cityId]) == 0)
+		                         : (scan.cityId == CITY_NOT_FOUND);
+		if (status != ref.status || scan.respType != ref.respType || scan.type != ref.type ||
+		    strcmp(scan.city, ref.city) != 0 || !idOk) {
+			fprintf(stderr, "%s: mismatch on datagram %ld (len %d): status %u/%u, city '%s'/'%s'\n",
+			        ScanRequestImplName(impl), i, len, status, ref.status, scan.city, ref.city);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void Benchmark(const char *name, int impl, char corpus[][BUFFER_SIZE], const int *lengths) {
+	struct request_scan scan;
+	struct reference_result ref;
+	long ops = 0;
+	long total = 0;
+	double start = NowNs();
+	double elapsed;
+
+	do {
+		for (int i = 0; i < CORPUS_SIZE; i++) {
+			if (impl < 0) {
+				RefHandle(corpus[i], lengths[i], &ref);
+				total += ref.status;
+			} else {
+				total += ScanRequestWith(impl, &g_cityTable, corpus[i], lengths[i], &scan);
+			}
+		}
+		ops += CORPUS_SIZE;
+		elapsed = NowNs() - start;
+	} while (elapsed < MIN_BENCH_NS);
+	g_sink = total;
+
+	printf("%-12s %10.1f ns/op %14.0f ops/s\n", name, elapsed / (double)ops, (double)ops * 1e9 / elapsed);
+}
+
+int main(void) {
+	static char corpus[CORPUS_SIZE][BUFFER_SIZE];
+	static int lengths[CORPUS_SIZE];
+	int impls[] = { SCAN_IMPL_SCALAR, SCAN_IMPL_SSE2, SCAN_IMPL_AVX2 };
+	int best = ScanRequestBestImpl();
+
+	// Skip kernels this CPU cannot run: they would silently fall back to scalar
+	for (int k = 0; k < 3; k++) {
+		if (impls[k] > best) {
+			continue;
+		}
+		if (Verify(impls[k]) != 0) {
+			return 1;
+		}
+		printf("%-12s matches reference on %d fuzzed datagrams\n", ScanRequestImplName(impls[k]), FUZZ_ITERATIONS);
+	}
+
+	// Realistic mix: mostly supported cities, some unknown and invalid ones
+	for (int i = 0; i < CORPUS_SIZE; i++) {
+		static const char *extra[] = { "Parigi", "Reggio Calabria", "ba$ri", "San Giovanni in Fiore" };
+		const char *city = (i % 8 < 6) ? g_supportedCities[i % 10] : extra[i % 4];
+		memset(corpus[i], 0, BUFFER_SIZE);
+		corpus[i][0] = "thwp"[i % 4];
+		strcpy(corpus[i] + 1, city);
+		lengths[i] = 2 + (int)strlen(city);
+	}
+
+	Benchmark("reference", -1, corpus, lengths);
+	for (int k = 0; k < 3; k++) {
+		if (impls[k] <= best) {
+			Benchmark(ScanRequestImplName(impls[k]), impls[k], corpus, lengths);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Compare the server reception loops under the same load generator run.
+# usage: bench_server_loops.sh [build dir] [port] [seconds]
+BUILD_DIR=${1:-build}
+PORT=${2:-56790}
+DURATION=${3:-3}
+
+for mode in "-b 1" "-b 32" "-u" "-j 4 -b 32" "-P 3"; do
+	# A fresh port per mode: an io_uring socket is released asynchronously after exit
+	PORT=$((PORT + 1))
+	"$BUILD_DIR/server" -p "$PORT" -n $mode > /dev/null 2> "$BUILD_DIR/bench_server.err" &
+	server=$!
+	sleep 0.3
+	echo "== server $mode"
+	# Closed loop for peak throughput, then open loop at a fixed rate for latency
+	"$BUILD_DIR/client" -l -p "$PORT" -c 64 -S 8 -d "$DURATION" | grep -E "^(Received|Lost|Latency)"
+	"$BUILD_DIR/client" -l -p "$PORT" -R 50000 -S 8 -d "$DURATION" | grep -E "^(Received|Lost|Latency)"
+	kill "$server"
+	wait "$server" 2> /dev/null
+	# The io_uring loop and the pipeline report here when they fell back
+	cat "$BUILD_DIR/bench_server.err"
+done
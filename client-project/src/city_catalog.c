@@ -0,0 +1,103 @@
+/*
+ * city_catalog.c
+ *
+ * Catalog fetch and compact request encoding for the client.
+ * Pages are requested in ID order; if a page reports another catalog
+ * version the server reloaded meanwhile, so the fetch starts over.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "city_catalog.h"
+
+// Case-insensitive string comparison (the server folds city names the same way)
+static int SameCity(const char *a, const char *b) {
+	while (*a && tolower((unsigned char)*a) == tolower((unsigned char)*b)) {
+		a++;
+		b++;
+	}
+	return *a == '\0' && *b == '\0';
+}
+
+// Fetch every page of one catalog version; returns 0, 1 if the version changed, -1 on error
+static int FetchPages(int sock, const struct sockaddr_in *serverAddr, const struct client_config *config,
+                      struct rto_estimator *est, struct city_catalog *catalog) {
+	static struct catalog_page page;
+	char request[CATALOG_FETCH_SIZE];
+	char reply[BUFFER_SIZE];
+	uint32_t next = 0;
+
+	do {
+		int reqSize = SerializeCatalogFetch(next, request, sizeof(request));
+		int replySize = ExchangeRequest(sock, serverAddr, request, reqSize, reply, sizeof(reply), config, est);
+		if (replySize < 0) {
+			return -1;
+		}
+		if (DeserializeCatalogPage(reply, replySize, &page) != 0 || page.firstId != next) {
+			// A server without catalog support answers "invalid request"
+			fprintf(stderr, "Server did not send its city catalog\n");
+			return -1;
+		}
+
+		if (next == 0) {
+			char (*names)[MAX_CITY_LENGTH] = realloc(catalog->names,
+			                                         (size_t)(page.cityCount ? page.cityCount : 1) * MAX_CITY_LENGTH);
+			if (names == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				return -1;
+			}
+			catalog->names = names;
+			catalog->version = page.version;
+			catalog->count = (int)page.cityCount;
+		} else if (page.version != catalog->version) {
+			return 1;
+		}
+		if (page.count == 0 && next < page.cityCount) {
+			fprintf(stderr, "Empty city catalog page\n");
+			return -1;
+		}
+
+		for (int i = 0; i < page.count && next < page.cityCount; i++) {
+			memcpy(catalog->names[next++], page.names[i], MAX_CITY_LENGTH);
+		}
+	} while (next < (uint32_t)catalog->count);
+	return 0;
+}
+
+int FetchCityCatalog(int sock, const struct sockaddr_in *serverAddr, const struct client_config *config,
+                     struct rto_estimator *est, struct city_catalog *catalog) {
+	for (int attempt = 0; attempt <= CITY_CATALOG_RESTARTS; attempt++) {
+		int ret = FetchPages(sock, serverAddr, config, est, catalog);
+		if (ret <= 0) {
+			return ret;
+		}
+	}
+	fprintf(stderr, "City catalog keeps changing, giving up\n");
+	return -1;
+}
+
+int SerializeCatalogRequest(const struct city_catalog *catalog, char type, const char *city, char *buffer,
+                            int bufferSize) {
+	int last = (catalog->count - 1 < COMPACT_MAX_CITY_ID) ? catalog->count - 1 : COMPACT_MAX_CITY_ID;
+
+	for (int id = 0; id <= last; id++) {
+		if (SameCity(catalog->names[id], city)) {
+			struct compact_request req = { type, CATALOG_TAG(catalog->version), (uint16_t)id };
+			return SerializeCompactRequest(&req, buffer, bufferSize);
+		}
+	}
+	return -1;
+}
+
+void FreeCityCatalog(struct city_catalog *catalog) {
+	free(catalog->names);
+	memset(catalog, 0, sizeof(*catalog));
+}
@@ -0,0 +1,56 @@
+/*
+ * city_catalog.h
+ *
+ * Copy of the server's city catalog for compact requests (-K)
+ * The catalog is fetched page by page; a city found in it can then be
+ * sent as a 4-byte (type, catalog tag, city ID) request. A reply with
+ * STATUS_STALE_CATALOG means the server swapped its catalog: fetch again
+ */
+
+#ifndef CITY_CATALOG_H_
+#define CITY_CATALOG_H_
+
+#include <stdint.h>
+#include "protocol.h"
+
+/*
+ * ============================================================================
+ * CITY CATALOG CONSTANTS
+ * ============================================================================
+ */
+
+#define CITY_CATALOG_RESTARTS 3    // nuovi inizi se il catalogo cambia durante la lettura
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+struct city_catalog {
+    uint32_t version;                // versione del server (CATALOG_TAG nelle richieste)
+    int count;
+    char (*names)[MAX_CITY_LENGTH];  // per ID
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Fetch the whole catalog over sock, with ExchangeRequest retransmissions for
+// every page. Replaces the contents of catalog; returns 0 on success.
+struct rto_estimator;
+int FetchCityCatalog(int sock, const struct sockaddr_in *serverAddr, const struct client_config *config,
+                     struct rto_estimator *est, struct city_catalog *catalog);
+
+// Serialize (type, city) as a compact request if the city is in the catalog (any case)
+// and has an ID that fits; returns the size, or -1 if it must be sent as text
+int SerializeCatalogRequest(const struct city_catalog *catalog, char type, const char *city, char *buffer,
+                            int bufferSize);
+
+void FreeCityCatalog(struct city_catalog *catalog);
+
+
+#endif /* CITY_CATALOG_H_ */
@@ -0,0 +1,746 @@
+/*
+ * loadgen.c
+ *
+ * Load generator mode for the client.
+ *
+ * Every request carries a request ID (protocol.h), consecutive on each
+ * socket, so a response is matched to its request whatever order the
+ * server answers in: the pending ring is kept in send order and the ID
+ * gives the position in it. Answered requests leave the ring once the
+ * ones before them are answered or expired. Responses without an ID
+ * (servers that do not echo it) fall back to the oldest pending request
+ * of the same type, counting the unanswered ones before it as lost.
+ *
+ * In open loop latency is measured from the scheduled send time, so a
+ * stalled sender does not hide queueing delay (coordinated omission).
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <string.h>
+#else
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#define closesocket close
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "protocol.h"
+#include "loadgen.h"
+#include "rto.h"
+#include "city_catalog.h"
+
+// Log-linear latency histogram: 64 sub-buckets per power of two (~1.5% error)
+#define HIST_SUB_BITS 6
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS (HIST_SUB_COUNT * 40)
+
+struct histogram {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+};
+
+// Request sent, kept until it and every earlier one are answered or expired
+struct load_pending {
+	uint64_t sentNs;      // invio (programmato in ciclo aperto)
+	uint32_t id;          // ID della richiesta
+	int slot;             // richiesta del pool
+	int fetch;            // lettura del catalogo con cui era codificata
+	int answered;
+};
+
+struct load_socket {
+	int fd;
+	int window;           // richieste in volo in ciclo chiuso
+	int head;
+	int count;            // voci dell'anello, risposte comprese
+	int outstanding;      // voci ancora senza risposta
+	uint32_t nextId;
+	struct load_pending pending[LOAD_MAX_PENDING];
+};
+
+// Pre-serialized request and the response type it expects
+struct load_request {
+	char data[BUFFER_SIZE];
+	int size;
+	char respType;
+	struct request req;   // per ricodificarla con un nuovo catalogo
+	int fetch;            // lettura del catalogo usata (0 = nessuna)
+};
+
+struct load_stats {
+	uint64_t sent;
+	uint64_t sendErrors;
+	uint64_t received;
+	uint64_t lost;
+	uint64_t late;        // risposte arrivate dopo il timeout o non associabili
+	uint64_t malformed;
+	uint64_t status[STATUS_STALE_CATALOG + 1];
+	uint64_t statusOther;
+	int staleFetch;       // lettura del catalogo più recente rifiutata dal server
+};
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Request mix and latency histogram, used by the load loop (POSIX only, below)
+static const char *g_validCities[] = {
+	"Bari", "roma", "MILANO", "Napoli", "torino",
+	"Palermo", "genova", "Bologna", "FIRENZE", "venezia"
+};
+
+static const char *g_unknownCities[] = {
+	"Parigi", "Londra", "Reggio Calabria", "Trento", "San Giovanni in Fiore"
+};
+
+static const char *g_invalidCities[] = {
+	"ba$ri", "Ro\tma", "mil@no", "Na_poli"
+};
+
+static uint64_t g_mixState = 0x9E3779B97F4A7C15ull;
+
+static uint32_t NextMixRandom(void) {
+	g_mixState ^= g_mixState << 13;
+	g_mixState ^= g_mixState >> 7;
+	g_mixState ^= g_mixState << 17;
+	return (uint32_t)(g_mixState >> 16);
+}
+
+static uint64_t NowNs(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int HistogramIndex(uint64_t value) {
+	if (value < 2 * HIST_SUB_COUNT) {
+		return (int)value;
+	}
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HIST_SUB_BITS;
+	int index = shift * HIST_SUB_COUNT + (int)(value >> shift);
+	return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// Midpoint of the values counted in a bucket
+static uint64_t HistogramValue(int index) {
+	if (index < 2 * HIST_SUB_COUNT) {
+		return (uint64_t)index;
+	}
+	int shift = index / HIST_SUB_COUNT - 1;
+	uint64_t low = (uint64_t)(index % HIST_SUB_COUNT + HIST_SUB_COUNT) << shift;
+	return low + ((1ull << shift) >> 1);
+}
+
+static void HistogramRecord(struct histogram *hist, uint64_t value) {
+	hist->counts[HistogramIndex(value)]++;
+	hist->total++;
+	if (value > hist->max) {
+		hist->max = value;
+	}
+}
+
+static uint64_t HistogramPercentile(const struct histogram *hist, double percentile) {
+	if (hist->total == 0) {
+		return 0;
+	}
+	uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->total + 0.5);
+	if (rank < 1) {
+		rank = 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist->counts[i];
+		if (seen >= rank) {
+			uint64_t value = HistogramValue(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+	return hist->max;
+}
+#endif
+
+// 1 if the command line asks for load mode (-l)
+int IsLoadMode(int argc, char *argv[]) {
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-l") == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Parse "valid,notfound,invalid" percentages
+static int ParseMix(const char *str, struct load_config *config) {
+	int valid, notFound, invalid;
+	if (sscanf(str, "%d,%d,%d", &valid, &notFound, &invalid) != 3 ||
+	    valid < 0 || notFound < 0 || invalid < 0 || valid + notFound + invalid != 100) {
+		return -1;
+	}
+	config->mixValid = valid;
+	config->mixNotFound = notFound;
+	config->mixInvalid = invalid;
+	return 0;
+}
+
+// Parse load mode arguments (-s and -p as in normal mode)
+int ParseLoadArguments(int argc, char *argv[], struct load_config *config) {
+	config->server = "localhost"; // default
+	config->port = SERVER_PORT; // default
+	config->rate = 0;
+	config->concurrency = 0;
+	config->duration = LOAD_DEFAULT_DURATION;
+	config->sockets = 1;
+	config->timeoutMs = LOAD_DEFAULT_TIMEOUT_MS;
+	config->mixValid = 80;
+	config->mixNotFound = 10;
+	config->mixInvalid = 10;
+	config->compact = 0;
+
+	for (int i = 1; i < argc; i++) {
+		const char *opt = argv[i];
+		if (strcmp(opt, "-l") == 0) {
+			continue;
+		}
+		if (strcmp(opt, "-K") == 0) {
+			config->compact = 1;
+			continue;
+		}
+		if (i + 1 >= argc) {
+			fprintf(stderr, "Missing value after %s\n", opt);
+			return -1;
+		}
+		const char *value = argv[++i];
+
+		if (strcmp(opt, "-s") == 0) {
+			config->server = value;
+		} else if (strcmp(opt, "-p") == 0) {
+			config->port = atoi(value);
+			if (config->port <= 0 || config->port > 65535) {
+				fprintf(stderr, "Invalid port number\n");
+				return -1;
+			}
+		} else if (strcmp(opt, "-R") == 0) {
+			config->rate = atof(value);
+			if (config->rate <= 0) {
+				fprintf(stderr, "Invalid rate\n");
+				return -1;
+			}
+		} else if (strcmp(opt, "-c") == 0) {
+			config->concurrency = atoi(value);
+			if (config->concurrency <= 0) {
+				fprintf(stderr, "Invalid concurrency\n");
+				return -1;
+			}
+		} else if (strcmp(opt, "-d") == 0) {
+			config->duration = atof(value);
+			if (config->duration <= 0) {
+				fprintf(stderr, "Invalid duration\n");
+				return -1;
+			}
+		} else if (strcmp(opt, "-S") == 0) {
+			config->sockets = atoi(value);
+			if (config->sockets < 1 || config->sockets > LOAD_MAX_SOCKETS) {
+				fprintf(stderr, "Invalid socket count (1-%d)\n", LOAD_MAX_SOCKETS);
+				return -1;
+			}
+		} else if (strcmp(opt, "-t") == 0) {
+			config->timeoutMs = atoi(value);
+			if (config->timeoutMs <= 0) {
+				fprintf(stderr, "Invalid timeout\n");
+				return -1;
+			}
+		} else if (strcmp(opt, "-m") == 0) {
+			if (ParseMix(value, config) != 0) {
+				fprintf(stderr, "Invalid mix (expected valid,notfound,invalid summing to 100)\n");
+				return -1;
+			}
+		} else {
+			fprintf(stderr, "Unknown option %s\n", opt);
+			return -1;
+		}
+	}
+
+	if (config->rate > 0 && config->concurrency > 0) {
+		fprintf(stderr, "Use either -R (open loop) or -c (closed loop)\n");
+		return -1;
+	}
+	if (config->rate == 0 && config->concurrency == 0) {
+		config->concurrency = 1; // default: one request at a time
+	}
+	if (config->concurrency > config->sockets * LOAD_MAX_PENDING) {
+		fprintf(stderr, "Concurrency too high for %d sockets\n", config->sockets);
+		return -1;
+	}
+
+	return 0;
+}
+
+#if defined(_WIN32) || defined(WIN32)
+
+// Run the load test and print the report; returns 0 on success
+int RunLoadGenerator(const struct load_config *config) {
+	(void)config;
+	fprintf(stderr, "Load mode is not supported on Windows\n");
+	return -1;
+}
+
+#else
+
+// Serialize a pool request: compact when a catalog is given and has the city
+static int EncodeLoadRequest(struct load_request *lr, const struct city_catalog *catalog, int fetch) {
+	lr->size = -1;
+	lr->fetch = fetch;
+	if (catalog != NULL) {
+		lr->size = SerializeCatalogRequest(catalog, lr->req.type, lr->req.city, lr->data, BUFFER_SIZE);
+	}
+	if (lr->size < 0) {
+		lr->size = SerializeRequest(&lr->req, lr->data, BUFFER_SIZE);
+	}
+	lr->respType = lr->req.type;
+	return lr->size < 0 ? -1 : 0;
+}
+
+// Fetch the server's catalog on a socket of its own (the load sockets are non-blocking)
+static int FetchLoadCatalog(const struct sockaddr_in *serverAddr, const struct load_config *config,
+                            struct city_catalog *catalog) {
+	struct client_config fetchConfig;
+	struct rto_estimator est;
+
+	memset(&fetchConfig, 0, sizeof(fetchConfig));
+	fetchConfig.attempts = RTO_DEFAULT_ATTEMPTS;
+	fetchConfig.initialRtoMs = config->timeoutMs;
+	RtoInit(&est, fetchConfig.initialRtoMs);
+
+	int sock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror("Error creating socket");
+		return -1;
+	}
+	int ret = FetchCityCatalog(sock, serverAddr, &fetchConfig, &est, catalog);
+	closesocket(sock);
+	return ret;
+}
+
+// Build the request pool with the real codec, following the configured mix
+static int BuildRequestPool(const struct load_config *config, struct load_request *pool,
+                            const struct city_catalog *catalog, int fetch) {
+	static const char types[] = "thwp";
+
+	for (int i = 0; i < LOAD_REQUEST_POOL; i++) {
+		struct request req;
+		int pick = (int)(NextMixRandom() % 100);
+
+		memset(&req, 0, sizeof(req));
+		req.type = types[NextMixRandom() % 4];
+		if (pick < config->mixValid) {
+			strcpy(req.city, g_validCities[NextMixRandom() % 10]);
+		} else if (pick < config->mixValid + config->mixNotFound) {
+			strcpy(req.city, g_unknownCities[NextMixRandom() % 5]);
+		} else if (NextMixRandom() & 1) {
+			// Invalid type with a supported city
+			req.type = 'x';
+			strcpy(req.city, g_validCities[NextMixRandom() % 10]);
+		} else {
+			strcpy(req.city, g_invalidCities[NextMixRandom() % 4]);
+		}
+
+		pool[i].req = req;
+		if (EncodeLoadRequest(&pool[i], catalog, fetch) != 0) {
+			return -1;
+		}
+	}
+
+	// Shuffle so consecutive requests are not correlated with the mix order
+	for (int i = LOAD_REQUEST_POOL - 1; i > 0; i--) {
+		int j = (int)(NextMixRandom() % (uint32_t)(i + 1));
+		struct load_request tmp = pool[i];
+		pool[i] = pool[j];
+		pool[j] = tmp;
+	}
+	return 0;
+}
+
+static int OpenLoadSockets(const struct sockaddr_in *serverAddr, struct load_socket *socks, int count) {
+	for (int i = 0; i < count; i++) {
+		socks[i].fd = socket(AF_INET, SOCK_DGRAM, 0);
+		if (socks[i].fd < 0) {
+			perror("Error creating socket");
+			return -1;
+		}
+
+		// IDs start from the clock, so a rerun on a reused port misses the server's reply cache
+		socks[i].nextId = (uint32_t)(NowNs() / 1000u) + (uint32_t)i * 0x10000000u;
+
+		// Connected: only datagrams from the server are delivered to this socket
+		if (connect(socks[i].fd, (const struct sockaddr *)serverAddr, sizeof(*serverAddr)) < 0) {
+			perror("Error connecting socket");
+			return -1;
+		}
+
+		int flags = fcntl(socks[i].fd, F_GETFL, 0);
+		if (flags < 0 || fcntl(socks[i].fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+			perror("Error setting non-blocking mode");
+			return -1;
+		}
+
+		// Large buffers so bursts are not dropped on the client side
+		int bufSize = 4 * 1024 * 1024;
+		setsockopt(socks[i].fd, SOL_SOCKET, SO_RCVBUF, &bufSize, sizeof(bufSize));
+		setsockopt(socks[i].fd, SOL_SOCKET, SO_SNDBUF, &bufSize, sizeof(bufSize));
+	}
+	return 0;
+}
+
+// Remove the oldest entry of the ring, counting it as lost if it was never answered
+static void PopLoadPending(struct load_socket *ls, struct load_stats *stats) {
+	if (!ls->pending[ls->head].answered) {
+		ls->outstanding--;
+		stats->lost++;
+	}
+	ls->head = (ls->head + 1) % LOAD_MAX_PENDING;
+	ls->count--;
+}
+
+// Send one request from the pool with the socket's next ID; returns 0 if it is now pending
+static int SendLoadRequest(struct load_socket *ls, const struct load_request *pool, uint64_t *next,
+                           uint64_t sentNs, struct load_stats *stats) {
+	char data[BUFFER_SIZE + REQUEST_ID_SIZE];
+
+	if (ls->count == LOAD_MAX_PENDING) {
+		// Ring full: the oldest request is given up as lost
+		PopLoadPending(ls, stats);
+	}
+
+	int slot = (int)(*next % LOAD_REQUEST_POOL);
+	(*next)++;
+
+	memcpy(data, pool[slot].data, (size_t)pool[slot].size);
+	int size = AppendRequestId(ls->nextId, data, pool[slot].size, (int)sizeof(data));
+	if (send(ls->fd, data, (size_t)size, 0) < 0) {
+		stats->sendErrors++;
+		return -1;
+	}
+	stats->sent++;
+
+	struct load_pending *p = &ls->pending[(ls->head + ls->count) % LOAD_MAX_PENDING];
+	p->sentNs = sentNs;
+	p->id = ls->nextId++;
+	p->slot = slot;
+	p->fetch = pool[slot].fetch;
+	p->answered = 0;
+	ls->count++;
+	ls->outstanding++;
+	return 0;
+}
+
+// Pending request answered by a response with this ID, or NULL (expired, or answered already)
+static struct load_pending *FindLoadPendingById(struct load_socket *ls, uint32_t id) {
+	if (ls->count == 0) {
+		return NULL;
+	}
+	uint32_t offset = id - ls->pending[ls->head].id;
+	if (offset >= (uint32_t)ls->count) {
+		return NULL;
+	}
+	struct load_pending *p = &ls->pending[(ls->head + (int)offset) % LOAD_MAX_PENDING];
+	return p->answered ? NULL : p;
+}
+
+// Oldest unanswered request expecting this type (servers without IDs); the ones
+// before it will not be answered in order any more and are counted as lost
+static struct load_pending *FindLoadPendingByType(struct load_socket *ls, const struct load_request *pool,
+                                                  char type, struct load_stats *stats) {
+	for (int i = 0; i < ls->count; i++) {
+		struct load_pending *p = &ls->pending[(ls->head + i) % LOAD_MAX_PENDING];
+		if (p->answered || pool[p->slot].respType != type) {
+			continue;
+		}
+		for (int k = 0; k < i; k++) {
+			struct load_pending *skipped = &ls->pending[(ls->head + k) % LOAD_MAX_PENDING];
+			if (!skipped->answered) {
+				skipped->answered = 1;
+				ls->outstanding--;
+				stats->lost++;
+			}
+		}
+		return p;
+	}
+	return NULL;
+}
+
+// Match a response to its request by ID (or by type without one)
+static void CompleteLoadResponse(struct load_socket *ls, const struct load_request *pool, const char *buffer,
+                                int size, uint64_t now, struct histogram *hist, struct load_stats *stats) {
+	struct response resp;
+	uint32_t id;
+	int body = size;
+	int hasId = SplitResponseId(buffer, &body, &id);
+
+	if (DeserializeResponse(buffer, body, &resp) != 0) {
+		stats->malformed++;
+		return;
+	}
+
+	struct load_pending *p = hasId ? FindLoadPendingById(ls, id) : FindLoadPendingByType(ls, pool, resp.type, stats);
+	if (p == NULL) {
+		stats->late++;
+		return;
+	}
+
+	HistogramRecord(hist, now > p->sentNs ? now - p->sentNs : 0);
+	stats->received++;
+	if (resp.status == STATUS_STALE_CATALOG && p->fetch > stats->staleFetch) {
+		stats->staleFetch = p->fetch;
+	}
+	if (resp.status <= STATUS_STALE_CATALOG) {
+		stats->status[resp.status]++;
+	} else {
+		stats->statusOther++;
+	}
+	p->answered = 1;
+	ls->outstanding--;
+
+	// Release the answered prefix of the ring
+	while (ls->count > 0 && ls->pending[ls->head].answered) {
+		PopLoadPending(ls, stats);
+	}
+}
+
+// Give up requests older than the timeout (and the answered ones queued behind them)
+static void ExpireLoadRequests(struct load_socket *ls, uint64_t now, uint64_t timeoutNs, struct load_stats *stats) {
+	while (ls->count > 0 &&
+	       (ls->pending[ls->head].answered || now - ls->pending[ls->head].sentNs > timeoutNs)) {
+		PopLoadPending(ls, stats);
+	}
+}
+
+static void PrintLoadReport(const struct load_config *config, const struct load_stats *stats,
+                            const struct histogram *hist, double elapsed, const struct city_catalog *catalog,
+                            int fetches) {
+	static const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+	static const char *labels[] = { "p50", "p90", "p99", "p99.9" };
+
+	if (config->rate > 0) {
+		printf("Load test: %.1f s, open loop at %.0f req/s, %d sockets\n",
+		       config->duration, config->rate, config->sockets);
+	} else {
+		printf("Load test: %.1f s, closed loop with %d in flight, %d sockets\n",
+		       config->duration, config->concurrency, config->sockets);
+	}
+	printf("Sent:       %llu (%.0f req/s, %llu send errors)\n", (unsigned long long)stats->sent,
+	       (double)stats->sent / config->duration, (unsigned long long)stats->sendErrors);
+	printf("Received:   %llu (%.0f req/s)\n", (unsigned long long)stats->received,
+	       (double)stats->received / elapsed);
+	printf("Lost:       %llu (%.3f%%), late %llu, malformed %llu\n", (unsigned long long)stats->lost,
+	       stats->sent ? 100.0 * (double)stats->lost / (double)stats->sent : 0.0,
+	       (unsigned long long)stats->late, (unsigned long long)stats->malformed);
+	printf("Status:     0=%llu 1=%llu 2=%llu", (unsigned long long)stats->status[0],
+	       (unsigned long long)stats->status[1], (unsigned long long)stats->status[2]);
+	if (config->compact) {
+		printf(" 3=%llu (stale catalog)", (unsigned long long)stats->status[STATUS_STALE_CATALOG]);
+	}
+	printf(" other=%llu\n", (unsigned long long)stats->statusOther);
+	if (config->compact) {
+		printf("Catalog:    %d cities, version %08x, fetched %d times\n", catalog->count,
+		       (unsigned)catalog->version, fetches);
+	}
+	printf("Latency:   ");
+	for (int i = 0; i < 4; i++) {
+		printf(" %s %.1f us", labels[i], (double)HistogramPercentile(hist, percentiles[i]) / 1000.0);
+	}
+	printf(" max %.1f us\n", (double)hist->max / 1000.0);
+}
+
+// poll() with a nanosecond timeout where available: millisecond sleeps
+// would delay open-loop sends and show up as latency
+static int WaitLoadSockets(struct pollfd *fds, int count, uint64_t timeoutNs) {
+#if defined(__linux__)
+	struct timespec ts;
+	ts.tv_sec = (time_t)(timeoutNs / 1000000000ull);
+	ts.tv_nsec = (long)(timeoutNs % 1000000000ull);
+	return ppoll(fds, (nfds_t)count, &ts, NULL);
+#else
+	return poll(fds, (nfds_t)count, (int)(timeoutNs / 1000000ull));
+#endif
+}
+
+// Run the load test and print the report; returns 0 on success
+int RunLoadGenerator(const struct load_config *config) {
+	struct sockaddr_in serverAddr;
+	struct addrinfo hints, *result;
+	struct pollfd fds[LOAD_MAX_SOCKETS];
+	struct load_stats stats;
+	struct city_catalog catalog;
+	char buffer[BUFFER_SIZE];
+	uint64_t next = 0;        // prossima richiesta del pool
+	int fetches = 0;
+	uint64_t scheduled = 0;   // invii programmati in ciclo aperto
+	int ret = -1;
+
+	memset(&catalog, 0, sizeof(catalog));
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	int gai = getaddrinfo(config->server, NULL, &hints, &result);
+	if (gai != 0) {
+		fprintf(stderr, "Error resolving server address: %s\n", gai_strerror(gai));
+		return -1;
+	}
+	memcpy(&serverAddr, result->ai_addr, sizeof(serverAddr));
+	serverAddr.sin_port = htons((unsigned short)config->port);
+	freeaddrinfo(result);
+
+	struct load_request *pool = calloc(LOAD_REQUEST_POOL, sizeof(*pool));
+	struct load_socket *socks = calloc((size_t)config->sockets, sizeof(*socks));
+	struct histogram *hist = calloc(1, sizeof(*hist));
+	if (pool == NULL || socks == NULL || hist == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+	for (int i = 0; i < config->sockets; i++) {
+		socks[i].fd = -1;
+	}
+	memset(&stats, 0, sizeof(stats));
+
+	// Compact mode: catalog cities are sent by ID
+	if (config->compact) {
+		if (FetchLoadCatalog(&serverAddr, config, &catalog) != 0) {
+			goto out;
+		}
+		fetches++;
+	}
+	if (BuildRequestPool(config, pool, config->compact ? &catalog : NULL, fetches) != 0 ||
+	    OpenLoadSockets(&serverAddr, socks, config->sockets) != 0) {
+		goto out;
+	}
+	for (int i = 0; i < config->sockets; i++) {
+		fds[i].fd = socks[i].fd;
+		fds[i].events = POLLIN;
+	}
+
+	uint64_t timeoutNs = (uint64_t)config->timeoutMs * 1000000ull;
+	uint64_t start = NowNs();
+	uint64_t end = start + (uint64_t)(config->duration * 1e9);
+	uint64_t drainEnd = end + timeoutNs;
+	double interval = config->rate > 0 ? 1e9 / config->rate : 0;
+
+	// Closed loop: spread the window over the sockets
+	for (int i = 0; config->rate == 0 && i < config->sockets; i++) {
+		socks[i].window = config->concurrency / config->sockets + (i < config->concurrency % config->sockets);
+	}
+
+	for (;;) {
+		uint64_t now = NowNs();
+		int sending = now < end;
+
+		if (sending && config->rate > 0) {
+			// Open loop: send everything that is due, stamped with its scheduled time
+			for (;;) {
+				uint64_t due = start + (uint64_t)((double)scheduled * interval);
+				if (due > now) {
+					break;
+				}
+				SendLoadRequest(&socks[scheduled % (uint64_t)config->sockets], pool, &next, due, &stats);
+				scheduled++;
+			}
+		} else if (sending) {
+			// Closed loop: top every window back up (answered, lost or failed sends)
+			for (int i = 0; i < config->sockets; i++) {
+				while (socks[i].outstanding < socks[i].window) {
+					if (SendLoadRequest(&socks[i], pool, &next, NowNs(), &stats) != 0) {
+						break;
+					}
+				}
+			}
+		}
+
+		// Done once sending is over and every request is answered or expired
+		int inFlight = 0;
+		for (int i = 0; i < config->sockets; i++) {
+			inFlight += socks[i].outstanding;
+		}
+		if (!sending && (inFlight == 0 || now >= drainEnd)) {
+			break;
+		}
+
+		// Sleep until the next send is due (at most 10 ms, to check for expiry)
+		uint64_t waitNs = 10000000ull;
+		if (config->rate > 0 && sending) {
+			uint64_t due = start + (uint64_t)((double)scheduled * interval);
+			waitNs = due > now ? due - now : 0;
+			if (waitNs > 10000000ull) {
+				waitNs = 10000000ull;
+			}
+		}
+		if (WaitLoadSockets(fds, config->sockets, waitNs) < 0 && errno != EINTR) {
+			perror("poll");
+			goto out;
+		}
+
+		now = NowNs();
+		for (int i = 0; i < config->sockets; i++) {
+			if (fds[i].revents & POLLIN) {
+				for (;;) {
+					int bytesReceived = (int)recv(socks[i].fd, buffer, BUFFER_SIZE, 0);
+					if (bytesReceived < 0) {
+						break;
+					}
+					CompleteLoadResponse(&socks[i], pool, buffer, bytesReceived, now, hist, &stats);
+				}
+			}
+			ExpireLoadRequests(&socks[i], now, timeoutNs, &stats);
+		}
+
+		// The server refused IDs of the latest catalog read: fetch it again and
+		// re-encode the pool (same requests, new IDs); stale replies to requests
+		// sent before that read do not count
+		if (config->compact && stats.staleFetch == fetches && now < end) {
+			if (FetchLoadCatalog(&serverAddr, config, &catalog) != 0) {
+				goto out;
+			}
+			fetches++;
+			for (int i = 0; i < LOAD_REQUEST_POOL; i++) {
+				EncodeLoadRequest(&pool[i], &catalog, fetches);
+			}
+		}
+	}
+
+	// Requests still pending at the end of the drain are lost
+	for (int i = 0; i < config->sockets; i++) {
+		stats.lost += (uint64_t)socks[i].outstanding;
+	}
+
+	double elapsed = (double)(NowNs() - start) / 1e9;
+	if (elapsed > config->duration) {
+		elapsed = config->duration; // throughput over the sending window
+	}
+	PrintLoadReport(config, &stats, hist, elapsed, &catalog, fetches);
+	ret = 0;
+
+out:
+	if (socks != NULL) {
+		for (int i = 0; i < config->sockets; i++) {
+			if (socks[i].fd >= 0) {
+				closesocket(socks[i].fd);
+			}
+		}
+	}
+	free(socks);
+	free(pool);
+	free(hist);
+	FreeCityCatalog(&catalog);
+	return ret;
+}
+
+#endif
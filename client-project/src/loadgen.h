@@ -0,0 +1,64 @@
+/*
+ * loadgen.h
+ *
+ * Load generator mode for the client (-l)
+ * Sends a configurable mix of requests over several sockets, either at a
+ * fixed rate (open loop) or with a fixed number in flight (closed loop),
+ * and reports throughput, loss and a latency histogram
+ */
+
+#ifndef LOADGEN_H_
+#define LOADGEN_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * LOAD GENERATOR CONSTANTS
+ * ============================================================================
+ */
+
+#define LOAD_DEFAULT_DURATION 10        // secondi
+#define LOAD_DEFAULT_TIMEOUT_MS 1000    // oltre questo tempo una richiesta è persa
+#define LOAD_MAX_SOCKETS 64
+#define LOAD_MAX_PENDING 4096           // richieste in volo per socket
+#define LOAD_REQUEST_POOL 1024          // richieste pre-serializzate
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Load test configuration (filled by ParseLoadArguments)
+struct load_config {
+    const char *server;
+    int port;
+    double rate;          // richieste/s (ciclo aperto), 0 = ciclo chiuso
+    int concurrency;      // richieste in volo in ciclo chiuso
+    double duration;      // secondi di invio
+    int sockets;          // socket UDP usati in parallelo
+    int timeoutMs;
+    int mixValid;         // percentuali del mix: città supportate,
+    int mixNotFound;      // città non supportate (status 1)
+    int mixInvalid;       // richieste non valide (status 2)
+    int compact;          // -K: città del catalogo come richieste compatte
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// 1 if the command line asks for load mode (-l)
+int IsLoadMode(int argc, char *argv[]);
+
+// Parse load mode arguments (-s and -p as in normal mode)
+int ParseLoadArguments(int argc, char *argv[], struct load_config *config);
+
+// Run the load test and print the report; returns 0 on success
+int RunLoadGenerator(const struct load_config *config);
+
+
+#endif /* LOADGEN_H_ */
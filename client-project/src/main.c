@@ -27,6 +27,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "protocol.h"
+#include "loadgen.h"
+#include "rto.h"
+#include "stream.h"
 
 #define NO_ERROR 0
 
@@ -36,16 +39,22 @@ void clearwinsock() {
 #endif
 }
 
-// Parse client command line arguments
-int ParseClientArguments(int argc, char *argv[], char **server, int *port, char **request) {
-	*server = "localhost"; // default
-	*port = SERVER_PORT; // default
-	*request = NULL;
+// Parse client command line arguments (-r may be repeated, up to BATCH_MAX_QUERIES times)
+int ParseClientArguments(int argc, char *argv[], struct client_config *config) {
+	config->server = "localhost"; // default
+	config->port = SERVER_PORT; // default
+	config->requestCount = 0;
+	config->attempts = RTO_DEFAULT_ATTEMPTS; // default
+	config->initialRtoMs = RTO_INITIAL_MS; // default
+	config->verbose = 0;
+	config->inputFile = NULL;
+	config->window = STREAM_DEFAULT_WINDOW; // default
+	config->compact = 0;
 	
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-s") == 0) {
 			if (i + 1 < argc) {
-				*server = argv[i + 1];
+				config->server = argv[i + 1];
 				i++;
 			} else {
 				fprintf(stderr, "Missing server address after -s\n");
@@ -53,8 +62,8 @@ int ParseClientArguments(int argc, char *argv[], char **server, int *port, char
 			}
 		} else if (strcmp(argv[i], "-p") == 0) {
 			if (i + 1 < argc) {
-				*port = atoi(argv[i + 1]);
-				if (*port <= 0 || *port > 65535) {
+				config->port = atoi(argv[i + 1]);
+				if (config->port <= 0 || config->port > 65535) {
 					fprintf(stderr, "Invalid port number\n");
 					return -1;
 				}
@@ -65,17 +74,78 @@ int ParseClientArguments(int argc, char *argv[], char **server, int *port, char
 			}
 		} else if (strcmp(argv[i], "-r") == 0) {
 			if (i + 1 < argc) {
-				*request = argv[i + 1];
+				if (config->requestCount == BATCH_MAX_QUERIES) {
+					fprintf(stderr, "Too many requests (maximum %d)\n", BATCH_MAX_QUERIES);
+					return -1;
+				}
+				config->requests[config->requestCount++] = argv[i + 1];
 				i++;
 			} else {
 				fprintf(stderr, "Missing request after -r\n");
 				return -1;
 			}
+		} else if (strcmp(argv[i], "-n") == 0) {
+			if (i + 1 < argc) {
+				config->attempts = atoi(argv[i + 1]);
+				if (config->attempts < 1) {
+					fprintf(stderr, "Invalid number of attempts\n");
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing number of attempts after -n\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-t") == 0) {
+			if (i + 1 < argc) {
+				config->initialRtoMs = atof(argv[i + 1]);
+				if (config->initialRtoMs <= 0) {
+					fprintf(stderr, "Invalid timeout\n");
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing timeout (ms) after -t\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-v") == 0) {
+			config->verbose = 1;
+		} else if (strcmp(argv[i], "-K") == 0) {
+			config->compact = 1;
+		} else if (strcmp(argv[i], "-f") == 0) {
+			if (i + 1 < argc) {
+				config->inputFile = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "Missing file name after -f\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-w") == 0) {
+			if (i + 1 < argc) {
+				config->window = atoi(argv[i + 1]);
+				if (config->window < 1 || config->window > STREAM_MAX_WINDOW) {
+					fprintf(stderr, "Invalid window (1-%d)\n", STREAM_MAX_WINDOW);
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing window size after -w\n");
+				return -1;
+			}
 		}
 	}
 	
-	if (*request == NULL) {
-		fprintf(stderr, "Missing required argument -r\n");
+	if (config->requestCount == 0 && config->inputFile == NULL) {
+		fprintf(stderr, "Missing required argument -r (or -f)\n");
+		return -1;
+	}
+	if (config->requestCount > 0 && config->inputFile != NULL) {
+		fprintf(stderr, "Use either -r or -f\n");
+		return -1;
+	}
+	if (config->compact && config->inputFile == NULL) {
+		// For a few requests the catalog fetch costs more than it saves
+		fprintf(stderr, "-K needs -f (or -l)\n");
 		return -1;
 	}
 	
@@ -250,77 +320,104 @@ int ResolveServerAddress(const char *server, int port, struct sockaddr_in *serve
 	return 0;
 }
 
-// Serialize request to buffer
-int SerializeRequest(const struct request *req, char *buffer, int bufferSize) {
-	if (req == NULL || buffer == NULL) {
-		return -1;
-	}
-	
-	int cityLen = (int)strlen(req->city);
-	int requiredSize = sizeof(char) + cityLen + 1; // type + city + null terminator
-	if (bufferSize < requiredSize) {
-		return -1;
-	}
-	
-	int offset = 0;
-	
-	// Serialize type (1 byte)
-	buffer[offset] = req->type;
-	offset += sizeof(char);
-	
-	// Serialize city (null-terminated string)
-	memcpy(buffer + offset, req->city, cityLen + 1);
-	offset += cityLen + 1;
-	
-	return offset;
+// Wait until sock is readable or timeoutMs elapses; returns 1 if readable, 0 on timeout
+static int WaitReadable(int sock, double timeoutMs) {
+	fd_set readSet;
+	struct timeval tv;
+	
+	if (timeoutMs < 0) {
+		timeoutMs = 0;
+	}
+	FD_ZERO(&readSet);
+	FD_SET(sock, &readSet);
+	tv.tv_sec = (long)(timeoutMs / 1000.0);
+	tv.tv_usec = (long)((timeoutMs - (double)tv.tv_sec * 1000.0) * 1000.0);
+	return select(sock + 1, &readSet, NULL, NULL, &tv) > 0;
 }
 
-// Deserialize response from buffer
-int DeserializeResponse(const char *buffer, int bufferSize, struct response *resp) {
-	if (buffer == NULL || resp == NULL) {
-		return -1;
-	}
-	
-	int requiredSize = sizeof(uint32_t) + sizeof(char) + sizeof(float);
-	if (bufferSize < requiredSize) {
-		return -1;
-	}
-	
-	int offset = 0;
-	
-	// Deserialize status (uint32_t) with network byte order
-	uint32_t netStatus;
-	memcpy(&netStatus, buffer + offset, sizeof(uint32_t));
-	resp->status = ntohl(netStatus);
-	offset += sizeof(uint32_t);
-	
-	// Deserialize type (1 byte)
-	resp->type = buffer[offset];
-	offset += sizeof(char);
-	
-	// Deserialize value (float) with network byte order
-	uint32_t temp;
-	memcpy(&temp, buffer + offset, sizeof(float));
-	temp = ntohl(temp);
-	memcpy(&resp->value, &temp, sizeof(float));
-	offset += sizeof(float);
-	
-	return 0;
+// Request IDs only have to differ between the requests of one socket within the
+// server's reply cache lifetime: start from the clock, so runs reusing a port differ too
+static uint32_t NextRequestId(void) {
+	static uint32_t next;
+	if (next == 0) {
+		next = (uint32_t)(RtoNowMs() * 1000.0) | 1u;
+	}
+	return next++;
 }
 
-// Format city name (first letter uppercase, rest lowercase)
-void FormatCityName(char *city) {
-	if (city == NULL || city[0] == '\0') {
-		return;
+// Send a request and wait for the reply of the queried server, retransmitting
+// with the estimator's timeout and backing off after every loss. If the request
+// carries an ID, replies with another ID (late replies to earlier requests) are skipped.
+// Returns the reply size, or -1 if all attempts fail.
+int ExchangeRequest(int sock, const struct sockaddr_in *serverAddr, const char *request, int requestSize,
+                    char *reply, int replySize, const struct client_config *config, struct rto_estimator *est) {
+	struct sockaddr_in fromAddr;
+	socklen_t fromAddrLen;
+	uint32_t requestId;
+	int bodySize = requestSize;
+	int hasId = SplitRequestId(request, &bodySize, &requestId);
+	
+	for (int attempt = 1; attempt <= config->attempts; attempt++) {
+		double sentAt = RtoNowMs();
+		double deadline = sentAt + est->rto;
+		
+		if (sendto(sock, request, requestSize, 0, (const struct sockaddr *)serverAddr, sizeof(*serverAddr)) < 0) {
+#if defined(_WIN32) || defined(WIN32)
+			fprintf(stderr, "Error sending request: %d\n", WSAGetLastError());
+#else
+			perror("Error sending request");
+#endif
+			return -1;
+		}
+		
+		while (WaitReadable(sock, deadline - RtoNowMs())) {
+			fromAddrLen = sizeof(fromAddr);
+			int bytesReceived = recvfrom(sock, reply, replySize, 0, (struct sockaddr *)&fromAddr, &fromAddrLen);
+			double now = RtoNowMs();
+			if (bytesReceived < 0) {
+				// e.g. ICMP port unreachable reported by Windows: keep waiting for this attempt
+				continue;
+			}
+			
+			// Only the queried server may answer
+			if (fromAddr.sin_addr.s_addr != serverAddr->sin_addr.s_addr || fromAddr.sin_port != serverAddr->sin_port) {
+				if (config->verbose) {
+					char fromIP[INET_ADDRSTRLEN];
+					inet_ntop(AF_INET, &fromAddr.sin_addr, fromIP, INET_ADDRSTRLEN);
+					fprintf(stderr, "[attempt %d] ignored datagram from %s:%d\n", attempt, fromIP,
+					        ntohs(fromAddr.sin_port));
+				}
+				continue;
+			}
+			
+			uint32_t replyId;
+			int replyBody = bytesReceived;
+			if (hasId && SplitResponseId(reply, &replyBody, &replyId) && replyId != requestId) {
+				if (config->verbose) {
+					fprintf(stderr, "[attempt %d] ignored reply to request %08x\n", attempt, (unsigned)replyId);
+				}
+				continue;
+			}
+			
+			// Karn's rule: after a retransmission the reply may belong to any copy
+			if (attempt == 1) {
+				RtoSample(est, now - sentAt);
+			}
+			if (config->verbose) {
+				fprintf(stderr, "[attempt %d] reply after %.3f ms (srtt %.3f ms, rto %.1f ms)\n", attempt,
+				        now - sentAt, est->srtt, est->rto);
+			}
+			return bytesReceived;
+		}
+		
+		if (config->verbose) {
+			fprintf(stderr, "[attempt %d] no reply within %.1f ms\n", attempt, est->rto);
+		}
+		RtoBackoff(est);
 	}
 	
-	// First letter uppercase
-	city[0] = toupper((unsigned char)city[0]);
-	
-	// Rest lowercase
-	for (int i = 1; city[i] != '\0'; i++) {
-		city[i] = tolower((unsigned char)city[i]);
-	}
+	fprintf(stderr, "No response from server after %d attempts\n", config->attempts);
+	return -1;
 }
 
 // Print response with proper formatting
@@ -359,38 +456,52 @@ void PrintResponse(const struct response *resp, const char *hostname, const char
 		printf("Città non disponibile\n");
 	} else if (resp->status == 2) {
 		printf("Richiesta non valida\n");
+	} else if (resp->status == STATUS_STALE_CATALOG) {
+		printf("Catalogo delle città cambiato sul server\n");
 	} else {
 		printf("Errore sconosciuto\n");
 	}
 }
 
 int main(int argc, char *argv[]) {
-	char *server;
-	int port;
-	char *requestStr;
-	char type;
-	char city[MAX_CITY_LENGTH];
-	struct request req;
+	struct client_config config;
+	struct rto_estimator est;
+	struct batch_request batch;
+	struct batch_response batchResp;
 	struct response resp;
 	struct sockaddr_in serverAddr;
 	char buffer[BUFFER_SIZE];
-	int bytesSent, bytesReceived;
+	char respBuffer[BUFFER_SIZE];
+	int bytesReceived;
 	char serverHostname[NI_MAXHOST];
 	char serverIP[INET_ADDRSTRLEN];
 	
-	// Parse arguments
-	if (ParseClientArguments(argc, argv, &server, &port, &requestStr) != 0) {
-		return 1;
+	// Load generator mode (-l)
+	if (IsLoadMode(argc, argv)) {
+		struct load_config loadConfig;
+		if (ParseLoadArguments(argc, argv, &loadConfig) != 0) {
+			return 1;
+		}
+		return RunLoadGenerator(&loadConfig) == 0 ? 0 : 1;
 	}
 	
-	// Validate and parse request
-	if (ValidateRequest(requestStr, &type, city) != 0) {
+	// Parse arguments
+	if (ParseClientArguments(argc, argv, &config) != 0) {
 		return 1;
 	}
 	
-	// Validate city length
-	if (ValidateCityLength(city) != 0) {
-		return 1;
+	// Validate and parse every request
+	memset(&batch, 0, sizeof(batch));
+	batch.count = config.requestCount;
+	for (int i = 0; i < config.requestCount; i++) {
+		if (ValidateRequest(config.requests[i], &batch.queries[i].type, batch.queries[i].city) != 0) {
+			return 1;
+		}
+		
+		// Validate city length
+		if (ValidateCityLength(batch.queries[i].city) != 0) {
+			return 1;
+		}
 	}
 
 #if defined(_WIN32) || defined(WIN32)
@@ -403,6 +514,14 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
+	// Streaming mode (-f): one socket and one resolution for every request
+	if (config.inputFile != NULL) {
+		int streamResult = RunStreamClient(&config);
+		printf("Client terminated.\n");
+		clearwinsock();
+		return streamResult == 0 ? 0 : 1;
+	}
+
 	// Create UDP socket
 	int my_socket = CreateUDPSocket();
 	if (my_socket < 0) {
@@ -411,7 +530,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	// Resolve server address and get hostname/IP
-	if (ResolveServerAddress(server, port, &serverAddr, serverHostname, NI_MAXHOST) != 0) {
+	if (ResolveServerAddress(config.server, config.port, &serverAddr, serverHostname, NI_MAXHOST) != 0) {
 		closesocket(my_socket);
 		clearwinsock();
 		return 1;
@@ -422,63 +541,60 @@ int main(int argc, char *argv[]) {
 		strcpy(serverIP, "unknown");
 	}
 
-	// Prepare request
-	memset(&req, 0, sizeof(req));
-	req.type = type;
-	strncpy(req.city, city, MAX_CITY_LENGTH - 1);
-	req.city[MAX_CITY_LENGTH - 1] = '\0';
-
-	// Serialize request
-	int reqSize = SerializeRequest(&req, buffer, BUFFER_SIZE);
-	if (reqSize < 0) {
-		closesocket(my_socket);
-		clearwinsock();
-		return 1;
+	// Serialize request: classic format for one request, multi-query format for more
+	int reqSize = (config.requestCount == 1) ? SerializeRequest(&batch.queries[0], buffer, BUFFER_SIZE)
+	                                  : SerializeBatchRequest(&batch, buffer, BUFFER_SIZE);
+	if (config.requestCount == 1 && reqSize > 0) {
+		// Retransmissions share the ID, so the server answers them from its reply cache
+		reqSize = AppendRequestId(NextRequestId(), buffer, reqSize, BUFFER_SIZE);
 	}
-
-	// Send request
-	bytesSent = sendto(my_socket, buffer, reqSize, 0,
-	                   (struct sockaddr *)&serverAddr, sizeof(serverAddr));
-	if (bytesSent < 0) {
-#if defined(_WIN32) || defined(WIN32)
-		fprintf(stderr, "Error sending request: %d\n", WSAGetLastError());
-#else
-		perror("Error sending request");
-#endif
+	if (reqSize < 0) {
+		fprintf(stderr, "Requests do not fit in one datagram\n");
 		closesocket(my_socket);
 		clearwinsock();
 		return 1;
 	}
 
-	// Receive response
-	socklen_t serverAddrLen = sizeof(serverAddr);
-	memset(buffer, 0, BUFFER_SIZE);
-	bytesReceived = recvfrom(my_socket, buffer, BUFFER_SIZE, 0,
-	                         (struct sockaddr *)&serverAddr, &serverAddrLen);
-	
+	// Send request and receive response, retransmitting on loss
+	RtoInit(&est, config.initialRtoMs);
+	bytesReceived = ExchangeRequest(my_socket, &serverAddr, buffer, reqSize, respBuffer, BUFFER_SIZE, &config, &est);
 	if (bytesReceived < 0) {
-#if defined(_WIN32) || defined(WIN32)
-		fprintf(stderr, "Error receiving response: %d\n", WSAGetLastError());
-#else
-		perror("Error receiving response");
-#endif
 		closesocket(my_socket);
 		clearwinsock();
 		return 1;
 	}
 
-	// Deserialize response
-	memset(&resp, 0, sizeof(resp));
-	if (DeserializeResponse(buffer, bytesReceived, &resp) != 0) {
-		fprintf(stderr, "Error deserializing response\n");
-		closesocket(my_socket);
-		clearwinsock();
-		return 1;
+	if (config.requestCount == 1) {
+		// Deserialize response
+		memset(&resp, 0, sizeof(resp));
+		if (DeserializeResponse(respBuffer, bytesReceived, &resp) != 0) {
+			fprintf(stderr, "Error deserializing response\n");
+			closesocket(my_socket);
+			clearwinsock();
+			return 1;
+		}
+		
+		// Print response
+		PrintResponse(&resp, serverHostname, serverIP, batch.queries[0].city);
+	} else {
+		// Deserialize multi-query response (a server without support answers "invalid request")
+		if (DeserializeBatchResponse(respBuffer, bytesReceived, &batchResp) != 0 || batchResp.count != config.requestCount) {
+			if (DeserializeResponse(respBuffer, bytesReceived, &resp) == 0 && resp.status == 2) {
+				fprintf(stderr, "Server does not support multi-query requests\n");
+			} else {
+				fprintf(stderr, "Error deserializing response\n");
+			}
+			closesocket(my_socket);
+			clearwinsock();
+			return 1;
+		}
+		
+		// Print one line per request, in request order
+		for (int i = 0; i < batchResp.count; i++) {
+			PrintResponse(&batchResp.results[i], serverHostname, serverIP, batch.queries[i].city);
+		}
 	}
 
-	// Print response
-	PrintResponse(&resp, serverHostname, serverIP, city);
-
 	// Close socket
 	closesocket(my_socket);
 
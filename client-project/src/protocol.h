@@ -20,6 +20,42 @@
 #define BUFFER_SIZE 512
 #define MAX_CITY_LENGTH 64
 
+// Multi-query datagrams (detected by the first two bytes; version 1 only)
+// Request:  magic, version, count, then count x (cityLen, type, city[cityLen])
+// Response: magic, version, count, then count x (status, type, value) as in struct response
+#define BATCH_MAGIC 0xB7
+#define BATCH_VERSION 1
+#define BATCH_HEADER_SIZE 3
+#define BATCH_RESPONSE_ENTRY_SIZE 9
+#define BATCH_MAX_QUERIES 56    // (BUFFER_SIZE - 1 - BATCH_HEADER_SIZE) / BATCH_RESPONSE_ENTRY_SIZE
+
+// City catalog pages (detected by the first two bytes; version 1 only)
+// Request:  magic, version, first city ID (uint32)
+// Response: magic, version, catalog version (uint32), city count (uint32), first city ID (uint32),
+//           name count, then count x (nameLen, name[nameLen]); no names once past the last city
+#define CATALOG_FETCH_MAGIC 0xB8
+#define CATALOG_FETCH_VERSION 1
+#define CATALOG_FETCH_SIZE 6
+#define CATALOG_PAGE_HEADER_SIZE 15
+#define CATALOG_PAGE_MAX_NAMES ((BUFFER_SIZE - CATALOG_PAGE_HEADER_SIZE) / 2)
+
+// Compact requests, sent with a city ID from the fetched catalog (exactly 4 bytes)
+// Request:  type | COMPACT_TYPE_FLAG, catalog tag, city ID (uint16)
+// Response: a classic response; status STATUS_STALE_CATALOG if the tag is of an earlier catalog
+//           of the server (with a tag it never issued the datagram is read as a classic request)
+#define COMPACT_REQUEST_SIZE 4
+#define COMPACT_TYPE_FLAG 0x80
+#define COMPACT_MAX_CITY_ID 0xFFFF
+#define CATALOG_TAG(version) ((uint8_t)((version) & 0xFF))
+#define STATUS_STALE_CATALOG 3
+
+// Optional request ID, after the city's NUL of a classic request or after a compact request
+// Request:  request, REQUEST_ID_MARKER, ID (uint32)
+// Response: the classic response followed by the same five bytes; a retransmission
+//           with the same ID gets the stored response again
+#define REQUEST_ID_MARKER 0xB9
+#define REQUEST_ID_SIZE 5
+
 /*
  * ============================================================================
  * PROTOCOL DATA STRUCTURES
@@ -32,12 +68,60 @@ struct request {
     char city[64];  // nome città (null-terminated)
 };
 
+// Request parsed in place: the city points into the received datagram
+struct request_view {
+    char type;
+    const char *city;  // non terminata, valida finché lo è il buffer
+    int cityLen;       // al più MAX_CITY_LENGTH - 1 (stesso troncamento di DeserializeRequest)
+};
+
+// Compact request: the city is an ID of the catalog fetched from the server
+struct compact_request {
+    char type;
+    uint8_t catalogTag;   // CATALOG_TAG della versione del catalogo usato
+    uint16_t cityId;
+};
+
 struct response {
-    unsigned int status;  // 0=successo, 1=città non trovata, 2=richiesta invalida
+    unsigned int status;  // 0=successo, 1=città non trovata, 2=richiesta invalida, 3=catalogo superato
     char type;            // eco del tipo richiesto
     float value;          // dato meteo generato
 };
 
+// Multi-query request and response (one entry per (type, city) pair)
+struct batch_request {
+    int count;
+    struct request queries[BATCH_MAX_QUERIES];
+};
+
+struct batch_response {
+    int count;
+    struct response results[BATCH_MAX_QUERIES];  // nello stesso ordine delle richieste
+};
+
+// One page of the server's city catalog
+struct catalog_page {
+    uint32_t version;     // versione del catalogo (il suo CATALOG_TAG va nelle richieste compatte)
+    uint32_t cityCount;   // città dell'intero catalogo
+    uint32_t firstId;     // ID del primo nome della pagina
+    int count;            // nomi nella pagina, 0 oltre la fine del catalogo
+    char names[CATALOG_PAGE_MAX_NAMES][MAX_CITY_LENGTH];
+};
+
+// Client runtime configuration (filled by ParseClientArguments)
+struct client_config {
+    const char *server;                   // nome o indirizzo del server
+    int port;
+    const char *requests[BATCH_MAX_QUERIES];
+    int requestCount;                     // più di una richiesta = datagramma multi-query
+    int attempts;                         // invii massimi per richiesta (ritrasmissioni incluse)
+    double initialRtoMs;                  // timeout prima del primo campione di RTT
+    int verbose;                          // 1 = tempi di ogni tentativo su stderr
+    const char *inputFile;                // -f: richieste da file ("-" = stdin), NULL = da -r
+    int window;                           // richieste in volo in modalità -f
+    int compact;                          // -K (con -f): richieste compatte (ID dal catalogo del server)
+};
+
 /*
  * ============================================================================
  * FUNCTION PROTOTYPES
@@ -45,7 +129,7 @@ struct response {
  */
 
 // Client argument parsing
-int ParseClientArguments(int argc, char *argv[], char **server, int *port, char **request);
+int ParseClientArguments(int argc, char *argv[], struct client_config *config);
 
 // Request validation
 int ValidateRequest(const char *requestStr, char *type, char *city);
@@ -59,11 +143,33 @@ int CreateUDPSocket(void);
 int ResolveServerAddress(const char *server, int port, struct sockaddr_in *serverAddr, char *hostname, int hostnameSize);
 int GetHostnameFromAddress(const struct sockaddr_in *addr, char *hostname, int hostnameSize);
 
+// Request exchange with retransmission (see rto.h)
+struct rto_estimator;
+int ExchangeRequest(int sock, const struct sockaddr_in *serverAddr, const char *request, int requestSize,
+                    char *reply, int replySize, const struct client_config *config, struct rto_estimator *est);
+
 // Serialization/Deserialization
 int SerializeRequest(const struct request *req, char *buffer, int bufferSize);
+int ParseRequestView(const char *buffer, int bufferSize, struct request_view *view);
 int DeserializeRequest(const char *buffer, int bufferSize, struct request *req);
-int SerializeResponse(const char *buffer, int bufferSize, struct response *resp);
+int SerializeResponse(const struct response *resp, char *buffer, int bufferSize);
 int DeserializeResponse(const char *buffer, int bufferSize, struct response *resp);
+int IsBatchDatagram(const char *buffer, int bufferSize);
+int SerializeBatchRequest(const struct batch_request *req, char *buffer, int bufferSize);
+int DeserializeBatchRequest(const char *buffer, int bufferSize, struct batch_request *req);
+int SerializeBatchResponse(const struct batch_response *resp, char *buffer, int bufferSize);
+int DeserializeBatchResponse(const char *buffer, int bufferSize, struct batch_response *resp);
+int SerializeCompactRequest(const struct compact_request *req, char *buffer, int bufferSize);
+int ParseCompactRequest(const char *buffer, int bufferSize, struct compact_request *req);
+int IsCatalogFetchDatagram(const char *buffer, int bufferSize);
+int SerializeCatalogFetch(uint32_t firstId, char *buffer, int bufferSize);
+int ParseCatalogFetch(const char *buffer, int bufferSize, uint32_t *firstId);
+int SerializeCatalogPage(uint32_t version, uint32_t cityCount, uint32_t firstId, const char *const *names,
+                         char *buffer, int bufferSize);
+int DeserializeCatalogPage(const char *buffer, int bufferSize, struct catalog_page *page);
+int AppendRequestId(uint32_t id, char *buffer, int size, int bufferSize);
+int SplitRequestId(const char *buffer, int *size, uint32_t *id);
+int SplitResponseId(const char *buffer, int *size, uint32_t *id);
 
 // Output formatting
 void FormatCityName(char *city);
@@ -0,0 +1,66 @@
+/*
+ * rto.c
+ *
+ * Retransmission timeout estimation (RFC 6298)
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "rto.h"
+
+static double ClampRto(double rto) {
+	if (rto < RTO_MIN_MS) {
+		return RTO_MIN_MS;
+	}
+	if (rto > RTO_MAX_MS) {
+		return RTO_MAX_MS;
+	}
+	return rto;
+}
+
+void RtoInit(struct rto_estimator *est, double initialMs) {
+	est->srtt = 0.0;
+	est->rttvar = 0.0;
+	est->rto = ClampRto(initialMs);
+	est->hasSample = 0;
+}
+
+void RtoSample(struct rto_estimator *est, double rttMs) {
+	if (!est->hasSample) {
+		est->srtt = rttMs;
+		est->rttvar = rttMs / 2.0;
+		est->hasSample = 1;
+	} else {
+		// RTTVAR first, with the old SRTT (alpha = 1/8, beta = 1/4)
+		double err = est->srtt - rttMs;
+		est->rttvar = 0.75 * est->rttvar + 0.25 * (err < 0 ? -err : err);
+		est->srtt = 0.875 * est->srtt + 0.125 * rttMs;
+	}
+
+	double spread = 4.0 * est->rttvar;
+	est->rto = ClampRto(est->srtt + (spread > RTO_GRANULARITY_MS ? spread : RTO_GRANULARITY_MS));
+}
+
+void RtoBackoff(struct rto_estimator *est) {
+	est->rto = ClampRto(est->rto * 2.0);
+}
+
+double RtoNowMs(void) {
+#if defined(_WIN32) || defined(WIN32)
+	static LARGE_INTEGER freq;
+	LARGE_INTEGER now;
+	if (freq.QuadPart == 0) {
+		QueryPerformanceFrequency(&freq);
+	}
+	QueryPerformanceCounter(&now);
+	return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1e6;
+#endif
+}
@@ -0,0 +1,55 @@
+/*
+ * rto.h
+ *
+ * Retransmission timeout estimation (RFC 6298): smoothed RTT and RTT
+ * variance from measured round trips, exponential backoff on timeouts
+ */
+
+#ifndef RTO_H_
+#define RTO_H_
+
+/*
+ * ============================================================================
+ * RTO CONSTANTS
+ * ============================================================================
+ */
+
+#define RTO_INITIAL_MS 250.0    // prima del primo campione (datagrammi su LAN/Internet vicina)
+#define RTO_MIN_MS 10.0
+#define RTO_MAX_MS 4000.0
+#define RTO_GRANULARITY_MS 1.0  // G in RFC 6298
+#define RTO_DEFAULT_ATTEMPTS 4
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+struct rto_estimator {
+    double srtt;      // RTT smussato (ms)
+    double rttvar;    // variazione dell'RTT (ms)
+    double rto;       // timeout corrente (ms), backoff incluso
+    int hasSample;    // 0 finché non arriva il primo campione
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Start with no samples and the given timeout
+void RtoInit(struct rto_estimator *est, double initialMs);
+
+// Feed a round trip measured on a request that was sent once (Karn's rule)
+void RtoSample(struct rto_estimator *est, double rttMs);
+
+// Double the timeout after a retransmission (clamped to RTO_MAX_MS)
+void RtoBackoff(struct rto_estimator *est);
+
+// Monotonic clock in milliseconds
+double RtoNowMs(void);
+
+
+#endif /* RTO_H_ */
@@ -0,0 +1,485 @@
+/*
+ * stream.c
+ *
+ * Streaming client.
+ *
+ * Every request carries a request ID (protocol.h), kept across its
+ * retransmissions, and a reply is matched to the request with its ID:
+ * the whole window can be in flight whatever the types.
+ * Until a reply with an ID arrives the server may not echo them, so the
+ * stream starts as for such servers: at most one datagram per response
+ * type is outstanding and a reply is matched to the transmission of its
+ * type, so a lost reply can never be credited to another request. After
+ * a retransmission the type stays blocked until the reply to the other
+ * copy arrives or times out.
+ *
+ * With -K a request whose city is in the server's catalog goes out as a
+ * compact request. A STATUS_STALE_CATALOG reply fetches the catalog again
+ * (on its own socket) and sends that request once more as text.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <string.h>
+#else
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#define closesocket close
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include "protocol.h"
+#include "rto.h"
+#include "city_catalog.h"
+#include "stream.h"
+
+#define SLOT_FREE 0
+#define SLOT_PENDING 1
+#define SLOT_DONE 2
+#define SLOT_FAILED 3
+
+// One request of the window, identified by its sequence number in the input
+// (pending with no sends = queued behind another request of the same type)
+struct stream_slot {
+	uint64_t seq;
+	uint32_t id;               // ID della richiesta, uguale nelle ritrasmissioni
+	int fetch;                 // lettura del catalogo usata (0 = richiesta testuale)
+	int state;
+	int sends;                 // datagrammi inviati per questa richiesta
+	struct request req;
+	struct response resp;
+	char data[BUFFER_SIZE];    // richiesta serializzata, per le ritrasmissioni
+	int size;
+};
+
+// One datagram sent and not yet answered or expired
+struct stream_tx {
+	uint64_t seq;
+	double sentAt;
+	double deadline;
+	int attempt;
+	char type;                 // tipo atteso nella risposta
+};
+
+struct stream_state {
+	const struct client_config *config;
+	int sock;
+	struct sockaddr_in serverAddr;
+	int window;
+	struct stream_slot *slots;     // indicizzati da seq % window
+	struct stream_tx *txs;         // al più uno per richiesta (o per tipo, senza ID)
+	int txCount;
+	int txCapacity;
+	int idReplies;                 // il server restituisce gli ID: nessun limite per tipo
+	uint32_t nextId;
+	int compact;                   // -K e catalogo disponibile
+	int fetches;                   // letture del catalogo riuscite
+	struct city_catalog catalog;
+	struct rto_estimator est;
+	uint64_t nextSeq;              // prossima richiesta letta dall'input
+	uint64_t flushSeq;             // prossima richiesta da stampare
+	int failed;
+};
+
+static struct stream_slot *SlotFor(struct stream_state *st, uint64_t seq) {
+	struct stream_slot *slot = &st->slots[seq % (uint64_t)st->window];
+	return (slot->state != SLOT_FREE && slot->seq == seq) ? slot : NULL;
+}
+
+static void RemoveTx(struct stream_state *st, int index) {
+	memmove(&st->txs[index], &st->txs[index + 1], (size_t)(st->txCount - index - 1) * sizeof(st->txs[0]));
+	st->txCount--;
+}
+
+// 1 if a datagram with this response type is outstanding
+static int TypeBusy(const struct stream_state *st, char type) {
+	for (int i = 0; i < st->txCount; i++) {
+		if (st->txs[i].type == type) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+static int SendSlot(struct stream_state *st, struct stream_slot *slot) {
+	if (st->txCount == st->txCapacity) {
+		return -1;
+	}
+	if (send(st->sock, slot->data, slot->size, 0) < 0) {
+		return -1;
+	}
+
+	struct stream_tx *tx = &st->txs[st->txCount++];
+	tx->seq = slot->seq;
+	tx->sentAt = RtoNowMs();
+	tx->deadline = tx->sentAt + st->est.rto;
+	tx->attempt = ++slot->sends;
+	tx->type = slot->req.type;
+	return 0;
+}
+
+// Serialize the slot's request with a new ID: compact if allowed and its city is
+// in the catalog, as text otherwise. Returns -1 if it does not fit.
+static int EncodeSlot(struct stream_state *st, struct stream_slot *slot, int allowCompact) {
+	slot->id = st->nextId++;
+	slot->fetch = 0;
+	slot->size = -1;
+	if (allowCompact && st->compact) {
+		slot->size = SerializeCatalogRequest(&st->catalog, slot->req.type, slot->req.city, slot->data, BUFFER_SIZE);
+		if (slot->size >= 0) {
+			slot->fetch = st->fetches;
+		}
+	}
+	if (slot->size < 0) {
+		slot->size = SerializeRequest(&slot->req, slot->data, BUFFER_SIZE);
+	}
+	if (slot->size >= 0) {
+		slot->size = AppendRequestId(slot->id, slot->data, slot->size, BUFFER_SIZE);
+	}
+	return (slot->size < 0) ? -1 : 0;
+}
+
+// Fetch the server's catalog on a socket of its own, so no reply of the stream is
+// read in its place. Returns 0 on success.
+static int FetchCatalog(struct stream_state *st) {
+	int sock = CreateUDPSocket();
+	if (sock < 0) {
+		return -1;
+	}
+	int ret = FetchCityCatalog(sock, &st->serverAddr, st->config, &st->est, &st->catalog);
+	closesocket(sock);
+	if (ret != 0) {
+		return -1;
+	}
+	st->fetches++;
+	if (st->config->verbose) {
+		fprintf(stderr, "City catalog version %08x (%d cities)\n", (unsigned)st->catalog.version, st->catalog.count);
+	}
+	return 0;
+}
+
+// The server swapped its catalog: fetch it again (or stop sending compact requests)
+// and encode the compact requests not sent yet once more
+static void RefreshCatalog(struct stream_state *st) {
+	if (FetchCatalog(st) != 0) {
+		st->compact = 0;
+	}
+	for (uint64_t seq = st->flushSeq; seq < st->nextSeq; seq++) {
+		struct stream_slot *slot = SlotFor(st, seq);
+		if (slot != NULL && slot->state == SLOT_PENDING && slot->sends == 0 && slot->fetch > 0 &&
+		    EncodeSlot(st, slot, 1) != 0) {
+			slot->state = SLOT_FAILED;
+		}
+	}
+}
+
+// Read the next valid request line into a free slot; returns 0 at end of input
+static int ReadNextRequest(struct stream_state *st, FILE *in, int *lineNumber) {
+	char line[STREAM_LINE_MAX];
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		(*lineNumber)++;
+		line[strcspn(line, "\r\n")] = '\0';
+
+		// Skip blank lines and comments
+		int start = (int)strspn(line, " ");
+		if (line[start] == '\0' || line[start] == '#') {
+			continue;
+		}
+
+		struct stream_slot *slot = &st->slots[st->nextSeq % (uint64_t)st->window];
+		memset(&slot->req, 0, sizeof(slot->req));
+		if (ValidateRequest(line, &slot->req.type, slot->req.city) != 0 || ValidateCityLength(slot->req.city) != 0) {
+			fprintf(stderr, "Skipping line %d\n", *lineNumber);
+			continue;
+		}
+		if (EncodeSlot(st, slot, 1) != 0) {
+			fprintf(stderr, "Skipping line %d\n", *lineNumber);
+			continue;
+		}
+
+		slot->seq = st->nextSeq++;
+		slot->state = SLOT_PENDING;
+		slot->sends = 0;
+		return 1;
+	}
+	return 0;
+}
+
+// Send queued requests in input order (only those whose response type is free,
+// until the server has shown that it echoes request IDs)
+static void DispatchQueued(struct stream_state *st) {
+	for (uint64_t seq = st->flushSeq; seq < st->nextSeq; seq++) {
+		struct stream_slot *slot = SlotFor(st, seq);
+		if (slot != NULL && slot->state == SLOT_PENDING && slot->sends == 0 &&
+		    (st->idReplies || !TypeBusy(st, slot->req.type))) {
+			if (SendSlot(st, slot) != 0) {
+				slot->state = SLOT_FAILED;
+			}
+		}
+	}
+}
+
+// Outstanding transmission of the request with this ID, or -1
+static int FindTxById(struct stream_state *st, uint32_t id) {
+	for (int i = 0; i < st->txCount; i++) {
+		const struct stream_slot *slot = SlotFor(st, st->txs[i].seq);
+		if (slot != NULL && slot->id == id) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Outstanding transmission expecting this response type, or -1
+static int FindTxByType(const struct stream_state *st, char type) {
+	for (int i = 0; i < st->txCount; i++) {
+		if (st->txs[i].type == type) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Match a reply to its request by ID, or to the outstanding transmission of its type
+// when the server does not echo IDs
+static void HandleReply(struct stream_state *st, const char *buffer, int size) {
+	struct response resp;
+	uint32_t id;
+	int body = size;
+	int hasId = SplitResponseId(buffer, &body, &id);
+	double now = RtoNowMs();
+
+	if (DeserializeResponse(buffer, body, &resp) != 0) {
+		return;
+	}
+	if (hasId) {
+		st->idReplies = 1;
+	}
+
+	int i = hasId ? FindTxById(st, id) : FindTxByType(st, resp.type);
+	if (i < 0) {
+		return; // expired, or already answered
+	}
+
+	struct stream_tx tx = st->txs[i];
+	struct stream_slot *slot = SlotFor(st, tx.seq);
+	if (slot == NULL || slot->state != SLOT_PENDING) {
+		RemoveTx(st, i);
+		return; // second reply to a retransmitted request
+	}
+	
+	// Without IDs a retransmitted request may get a reply for each copy: keep
+	// the type blocked until the other one arrives or the transmission expires
+	if (hasId || slot->sends == 1) {
+		RemoveTx(st, i);
+	}
+	// Karn's rule: only requests sent once give an unambiguous round trip
+	if (slot->sends == 1) {
+		RtoSample(&st->est, now - tx.sentAt);
+	}
+	if (st->config->verbose) {
+		fprintf(stderr, "[request %llu, attempt %d] reply after %.3f ms\n", (unsigned long long)slot->seq + 1,
+		        tx.attempt, now - tx.sentAt);
+	}
+	if (resp.status == STATUS_STALE_CATALOG && slot->fetch > 0) {
+		// The first stale reply of a catalog refreshes it; the request goes again as
+		// text, with a new ID since the server keeps the stale reply for the old one
+		if (slot->fetch == st->fetches) {
+			RefreshCatalog(st);
+		}
+		for (int j = st->txCount - 1; j >= 0; j--) {
+			if (st->txs[j].seq == slot->seq) {
+				RemoveTx(st, j);
+			}
+		}
+		if (EncodeSlot(st, slot, 0) != 0) {
+			slot->state = SLOT_FAILED;
+		}
+		slot->sends = 0;
+		return;
+	}
+	slot->resp = resp;
+	slot->state = SLOT_DONE;
+}
+
+// Retransmit requests whose latest datagram timed out; fail them after the last attempt
+static void ExpireTransmissions(struct stream_state *st) {
+	double now = RtoNowMs();
+	int backedOff = 0;
+
+	for (int i = 0; i < st->txCount;) {
+		if (st->txs[i].deadline > now) {
+			i++;
+			continue;
+		}
+
+		struct stream_tx tx = st->txs[i];
+		RemoveTx(st, i);
+		struct stream_slot *slot = SlotFor(st, tx.seq);
+		if (slot == NULL || slot->state != SLOT_PENDING || tx.attempt != slot->sends) {
+			continue;
+		}
+
+		if (st->config->verbose) {
+			fprintf(stderr, "[request %llu, attempt %d] no reply within %.1f ms\n", (unsigned long long)slot->seq + 1,
+			        tx.attempt, tx.deadline - tx.sentAt);
+		}
+		if (!backedOff) {
+			RtoBackoff(&st->est);
+			backedOff = 1;
+		}
+		if (slot->sends >= st->config->attempts || SendSlot(st, slot) != 0) {
+			slot->state = SLOT_FAILED;
+		}
+	}
+}
+
+// Print finished requests in input order
+static void FlushResults(struct stream_state *st, const char *hostname, const char *ip) {
+	while (st->flushSeq < st->nextSeq) {
+		struct stream_slot *slot = &st->slots[st->flushSeq % (uint64_t)st->window];
+		if (slot->state == SLOT_PENDING) {
+			break;
+		}
+		if (slot->state == SLOT_DONE) {
+			PrintResponse(&slot->resp, hostname, ip, slot->req.city);
+		} else {
+			fprintf(stderr, "No response for request %llu (%c %s) after %d attempts\n",
+			        (unsigned long long)slot->seq + 1, slot->req.type, slot->req.city, slot->sends);
+			st->failed++;
+		}
+		slot->state = SLOT_FREE;
+		st->flushSeq++;
+	}
+}
+
+// Run the streaming client on config->inputFile ("-" = stdin).
+// Returns 0 if every request got a reply.
+int RunStreamClient(const struct client_config *config) {
+	struct stream_state st;
+	char serverHostname[NI_MAXHOST];
+	char serverIP[INET_ADDRSTRLEN];
+	char buffer[BUFFER_SIZE];
+	static char outputBuffer[STREAM_OUTPUT_BUFFER];
+	int lineNumber = 0;
+	int eof = 0;
+	int ret = -1;
+
+	FILE *in = (strcmp(config->inputFile, "-") == 0) ? stdin : fopen(config->inputFile, "r");
+	if (in == NULL) {
+		perror(config->inputFile);
+		return -1;
+	}
+
+	memset(&st, 0, sizeof(st));
+	st.config = config;
+	st.window = config->window;
+	// One outstanding datagram per request, plus one per response type (a byte) left
+	// from before the first reply with an ID
+	st.txCapacity = st.window + 256;
+	st.nextId = (uint32_t)(RtoNowMs() * 1000.0) | 1u;
+	st.slots = calloc((size_t)st.window, sizeof(*st.slots));
+	st.txs = calloc((size_t)st.txCapacity, sizeof(*st.txs));
+	st.sock = -1;
+	if (st.slots == NULL || st.txs == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		goto out;
+	}
+	RtoInit(&st.est, config->initialRtoMs);
+
+	// Resolve once (forward and reverse) and connect: the kernel filters other senders
+	st.sock = CreateUDPSocket();
+	if (st.sock < 0 ||
+	    ResolveServerAddress(config->server, config->port, &st.serverAddr, serverHostname, NI_MAXHOST) != 0) {
+		goto out;
+	}
+	if (inet_ntop(AF_INET, &st.serverAddr.sin_addr, serverIP, INET_ADDRSTRLEN) == NULL) {
+		strcpy(serverIP, "unknown");
+	}
+	if (config->compact) {
+		if (FetchCatalog(&st) != 0) {
+			goto out;
+		}
+		st.compact = 1;
+	}
+	if (connect(st.sock, (struct sockaddr *)&st.serverAddr, sizeof(st.serverAddr)) < 0) {
+		perror("Error connecting socket");
+		goto out;
+	}
+
+	// Results are written in large blocks instead of one write per line
+	setvbuf(stdout, outputBuffer, _IOFBF, sizeof(outputBuffer));
+
+	for (;;) {
+		// Print what is finished, then refill the freed part of the window
+		FlushResults(&st, serverHostname, serverIP);
+		while (!eof && st.nextSeq - st.flushSeq < (uint64_t)st.window) {
+			if (!ReadNextRequest(&st, in, &lineNumber)) {
+				eof = 1;
+			}
+		}
+		DispatchQueued(&st);
+		if (eof && st.flushSeq == st.nextSeq) {
+			break;
+		}
+
+		// Sleep until a reply arrives or the earliest retransmission is due
+		double now = RtoNowMs();
+		double wait = RTO_MAX_MS;
+		for (int i = 0; i < st.txCount; i++) {
+			if (st.txs[i].deadline - now < wait) {
+				wait = st.txs[i].deadline - now;
+			}
+		}
+		if (wait < 0) {
+			wait = 0;
+		}
+
+		fd_set readSet;
+		struct timeval tv;
+		FD_ZERO(&readSet);
+		FD_SET(st.sock, &readSet);
+		tv.tv_sec = (long)(wait / 1000.0);
+		tv.tv_usec = (long)((wait - (double)tv.tv_sec * 1000.0) * 1000.0);
+		if (select(st.sock + 1, &readSet, NULL, NULL, &tv) > 0) {
+			// Drain every queued reply before looking at timers
+			do {
+				int bytesReceived = recv(st.sock, buffer, BUFFER_SIZE, 0);
+				if (bytesReceived < 0) {
+					break;
+				}
+				HandleReply(&st, buffer, bytesReceived);
+				FD_ZERO(&readSet);
+				FD_SET(st.sock, &readSet);
+				tv.tv_sec = 0;
+				tv.tv_usec = 0;
+			} while (select(st.sock + 1, &readSet, NULL, NULL, &tv) > 0);
+		}
+		ExpireTransmissions(&st);
+	}
+
+	fflush(stdout);
+	ret = (st.failed == 0) ? 0 : -1;
+
+out:
+	if (st.sock >= 0) {
+		closesocket(st.sock);
+	}
+	if (in != stdin) {
+		fclose(in);
+	}
+	free(st.slots);
+	free(st.txs);
+	FreeCityCatalog(&st.catalog);
+	return ret;
+}
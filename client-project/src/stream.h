@@ -0,0 +1,37 @@
+/*
+ * stream.h
+ *
+ * Streaming mode for the client (-f)
+ * Reads "type city" request lines from a file or stdin and keeps a window
+ * of them in flight on one connected socket, with the server resolved
+ * once; results are printed in input order through a large stdout buffer
+ */
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "protocol.h"
+
+/*
+ * ============================================================================
+ * STREAM CONSTANTS
+ * ============================================================================
+ */
+
+#define STREAM_DEFAULT_WINDOW 16      // richieste in volo
+#define STREAM_MAX_WINDOW 256
+#define STREAM_OUTPUT_BUFFER 65536    // stdout scritto a blocchi di questa dimensione
+#define STREAM_LINE_MAX 256
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Run the streaming client on config->inputFile ("-" = stdin).
+// Returns 0 if every request got a reply.
+int RunStreamClient(const struct client_config *config);
+
+
+#endif /* STREAM_H_ */
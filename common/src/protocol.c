@@ -0,0 +1,441 @@
+/*
+ * protocol.c
+ *
+ * Wire codec and city name formatting shared by client and server
+ * Built into each program against that program's protocol.h
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#endif
+
+#include <string.h>
+#include <ctype.h>
+#include "protocol.h"
+
+// Serialize request to buffer
+int SerializeRequest(const struct request *req, char *buffer, int bufferSize) {
+	if (req == NULL || buffer == NULL) {
+		return -1;
+	}
+	
+	int cityLen = (int)strlen(req->city);
+	int requiredSize = sizeof(char) + cityLen + 1; // type + city + null terminator
+	if (bufferSize < requiredSize) {
+		return -1;
+	}
+	
+	int offset = 0;
+	
+	// Serialize type (1 byte)
+	buffer[offset] = req->type;
+	offset += sizeof(char);
+	
+	// Serialize city (null-terminated string)
+	memcpy(buffer + offset, req->city, cityLen + 1);
+	offset += cityLen + 1;
+	
+	return offset;
+}
+
+// Parse a request without copying: the city ends at the first NUL, at the end of
+// the datagram or after MAX_CITY_LENGTH - 1 bytes, whichever comes first
+int ParseRequestView(const char *buffer, int bufferSize, struct request_view *view) {
+	if (buffer == NULL || view == NULL || bufferSize < (int)(sizeof(char) + 1)) {
+		return -1;
+	}
+	
+	int limit = bufferSize - 1;
+	if (limit > MAX_CITY_LENGTH - 1) {
+		limit = MAX_CITY_LENGTH - 1;
+	}
+	
+	view->type = buffer[0];
+	view->city = buffer + 1;
+	const char *end = memchr(view->city, '\0', (size_t)limit);
+	view->cityLen = (end != NULL) ? (int)(end - view->city) : limit;
+	return 0;
+}
+
+// Deserialize request from buffer (a copy of ParseRequestView's result)
+int DeserializeRequest(const char *buffer, int bufferSize, struct request *req) {
+	struct request_view view;
+	
+	if (req == NULL || ParseRequestView(buffer, bufferSize, &view) != 0) {
+		return -1;
+	}
+	
+	req->type = view.type;
+	memcpy(req->city, view.city, (size_t)view.cityLen);
+	req->city[view.cityLen] = '\0';
+	return 0;
+}
+
+// Serialize response to buffer
+int SerializeResponse(const struct response *resp, char *buffer, int bufferSize) {
+	if (resp == NULL || buffer == NULL) {
+		return -1;
+	}
+	
+	int requiredSize = sizeof(uint32_t) + sizeof(char) + sizeof(float);
+	if (bufferSize < requiredSize) {
+		return -1;
+	}
+	
+	int offset = 0;
+	
+	// Serialize status (uint32_t) with network byte order
+	uint32_t netStatus = htonl(resp->status);
+	memcpy(buffer + offset, &netStatus, sizeof(uint32_t));
+	offset += sizeof(uint32_t);
+	
+	// Serialize type (1 byte, no conversion needed)
+	buffer[offset] = resp->type;
+	offset += sizeof(char);
+	
+	// Serialize value (float) with network byte order
+	uint32_t temp;
+	memcpy(&temp, &resp->value, sizeof(float));
+	temp = htonl(temp);
+	memcpy(buffer + offset, &temp, sizeof(float));
+	offset += sizeof(float);
+	
+	return offset;
+}
+
+// Deserialize response from buffer
+int DeserializeResponse(const char *buffer, int bufferSize, struct response *resp) {
+	if (buffer == NULL || resp == NULL) {
+		return -1;
+	}
+	
+	int requiredSize = sizeof(uint32_t) + sizeof(char) + sizeof(float);
+	if (bufferSize < requiredSize) {
+		return -1;
+	}
+	
+	int offset = 0;
+	
+	// Deserialize status (uint32_t) with network byte order
+	uint32_t netStatus;
+	memcpy(&netStatus, buffer + offset, sizeof(uint32_t));
+	resp->status = ntohl(netStatus);
+	offset += sizeof(uint32_t);
+	
+	// Deserialize type (1 byte)
+	resp->type = buffer[offset];
+	offset += sizeof(char);
+	
+	// Deserialize value (float) with network byte order
+	uint32_t temp;
+	memcpy(&temp, buffer + offset, sizeof(float));
+	temp = ntohl(temp);
+	memcpy(&resp->value, &temp, sizeof(float));
+	offset += sizeof(float);
+	
+	return 0;
+}
+
+// Check whether a datagram uses the multi-query format (magic and version)
+int IsBatchDatagram(const char *buffer, int bufferSize) {
+	return buffer != NULL && bufferSize >= BATCH_HEADER_SIZE &&
+	       (unsigned char)buffer[0] == BATCH_MAGIC && buffer[1] == BATCH_VERSION;
+}
+
+// Serialize multi-query request to buffer
+int SerializeBatchRequest(const struct batch_request *req, char *buffer, int bufferSize) {
+	if (req == NULL || buffer == NULL || req->count < 1 || req->count > BATCH_MAX_QUERIES ||
+	    bufferSize < BATCH_HEADER_SIZE) {
+		return -1;
+	}
+	
+	// Header: magic, version, query count
+	buffer[0] = (char)BATCH_MAGIC;
+	buffer[1] = BATCH_VERSION;
+	buffer[2] = (char)req->count;
+	int offset = BATCH_HEADER_SIZE;
+	
+	// Queries: city length, type, city (no null terminator)
+	for (int i = 0; i < req->count; i++) {
+		int cityLen = (int)strlen(req->queries[i].city);
+		if (cityLen < 1 || cityLen > MAX_CITY_LENGTH - 1 || offset + 2 + cityLen > bufferSize) {
+			return -1;
+		}
+		buffer[offset++] = (char)cityLen;
+		buffer[offset++] = req->queries[i].type;
+		memcpy(buffer + offset, req->queries[i].city, cityLen);
+		offset += cityLen;
+	}
+	
+	return offset;
+}
+
+// Deserialize multi-query request from buffer (the whole datagram must be well formed)
+int DeserializeBatchRequest(const char *buffer, int bufferSize, struct batch_request *req) {
+	if (req == NULL || !IsBatchDatagram(buffer, bufferSize)) {
+		return -1;
+	}
+	
+	int count = (unsigned char)buffer[2];
+	if (count < 1 || count > BATCH_MAX_QUERIES) {
+		return -1;
+	}
+	
+	int offset = BATCH_HEADER_SIZE;
+	for (int i = 0; i < count; i++) {
+		if (offset + 2 > bufferSize) {
+			return -1;
+		}
+		int cityLen = (unsigned char)buffer[offset];
+		if (cityLen < 1 || cityLen > MAX_CITY_LENGTH - 1 || offset + 2 + cityLen > bufferSize ||
+		    memchr(buffer + offset + 2, '\0', cityLen) != NULL) {
+			return -1;
+		}
+		req->queries[i].type = buffer[offset + 1];
+		memcpy(req->queries[i].city, buffer + offset + 2, cityLen);
+		req->queries[i].city[cityLen] = '\0';
+		offset += 2 + cityLen;
+	}
+	
+	// Trailing bytes make the datagram malformed
+	if (offset != bufferSize) {
+		return -1;
+	}
+	
+	req->count = count;
+	return 0;
+}
+
+// Serialize multi-query response to buffer
+int SerializeBatchResponse(const struct batch_response *resp, char *buffer, int bufferSize) {
+	if (resp == NULL || buffer == NULL || resp->count < 1 || resp->count > BATCH_MAX_QUERIES) {
+		return -1;
+	}
+	
+	int requiredSize = BATCH_HEADER_SIZE + resp->count * BATCH_RESPONSE_ENTRY_SIZE;
+	if (bufferSize < requiredSize) {
+		return -1;
+	}
+	
+	buffer[0] = (char)BATCH_MAGIC;
+	buffer[1] = BATCH_VERSION;
+	buffer[2] = (char)resp->count;
+	
+	// Each entry has the same encoding as a single response
+	int offset = BATCH_HEADER_SIZE;
+	for (int i = 0; i < resp->count; i++) {
+		offset += SerializeResponse(&resp->results[i], buffer + offset, BATCH_RESPONSE_ENTRY_SIZE);
+	}
+	
+	return offset;
+}
+
+// Deserialize multi-query response from buffer
+int DeserializeBatchResponse(const char *buffer, int bufferSize, struct batch_response *resp) {
+	if (resp == NULL || !IsBatchDatagram(buffer, bufferSize)) {
+		return -1;
+	}
+	
+	int count = (unsigned char)buffer[2];
+	if (count < 1 || count > BATCH_MAX_QUERIES || bufferSize < BATCH_HEADER_SIZE + count * BATCH_RESPONSE_ENTRY_SIZE) {
+		return -1;
+	}
+	
+	for (int i = 0; i < count; i++) {
+		DeserializeResponse(buffer + BATCH_HEADER_SIZE + i * BATCH_RESPONSE_ENTRY_SIZE, BATCH_RESPONSE_ENTRY_SIZE,
+		                    &resp->results[i]);
+	}
+	
+	resp->count = count;
+	return 0;
+}
+
+// Serialize compact request to buffer (the type must be a plain ASCII character)
+int SerializeCompactRequest(const struct compact_request *req, char *buffer, int bufferSize) {
+	if (req == NULL || buffer == NULL || bufferSize < COMPACT_REQUEST_SIZE ||
+	    ((unsigned char)req->type & COMPACT_TYPE_FLAG) != 0) {
+		return -1;
+	}
+	
+	buffer[0] = (char)((unsigned char)req->type | COMPACT_TYPE_FLAG);
+	buffer[1] = (char)req->catalogTag;
+	uint16_t netId = htons(req->cityId);
+	memcpy(buffer + 2, &netId, sizeof(uint16_t));
+	return COMPACT_REQUEST_SIZE;
+}
+
+// Parse a compact request; returns -1 if the datagram is not one. A valid text request
+// starts with its type letter, never with the flag set, so legacy requests are unaffected.
+int ParseCompactRequest(const char *buffer, int bufferSize, struct compact_request *req) {
+	if (buffer == NULL || req == NULL || bufferSize != COMPACT_REQUEST_SIZE ||
+	    ((unsigned char)buffer[0] & COMPACT_TYPE_FLAG) == 0 || (unsigned char)buffer[0] == BATCH_MAGIC ||
+	    (unsigned char)buffer[0] == CATALOG_FETCH_MAGIC) {
+		return -1;
+	}
+	
+	uint16_t netId;
+	req->type = (char)((unsigned char)buffer[0] & ~COMPACT_TYPE_FLAG);
+	req->catalogTag = (uint8_t)buffer[1];
+	memcpy(&netId, buffer + 2, sizeof(uint16_t));
+	req->cityId = ntohs(netId);
+	return 0;
+}
+
+// Check whether a datagram is a catalog page request or response (magic and version)
+int IsCatalogFetchDatagram(const char *buffer, int bufferSize) {
+	return buffer != NULL && bufferSize >= CATALOG_FETCH_SIZE &&
+	       (unsigned char)buffer[0] == CATALOG_FETCH_MAGIC && buffer[1] == CATALOG_FETCH_VERSION;
+}
+
+static void PutUint32(char *buffer, uint32_t value) {
+	uint32_t net = htonl(value);
+	memcpy(buffer, &net, sizeof(uint32_t));
+}
+
+static uint32_t GetUint32(const char *buffer) {
+	uint32_t net;
+	memcpy(&net, buffer, sizeof(uint32_t));
+	return ntohl(net);
+}
+
+// Serialize the request for the catalog page that starts at firstId
+int SerializeCatalogFetch(uint32_t firstId, char *buffer, int bufferSize) {
+	if (buffer == NULL || bufferSize < CATALOG_FETCH_SIZE) {
+		return -1;
+	}
+	
+	buffer[0] = (char)CATALOG_FETCH_MAGIC;
+	buffer[1] = CATALOG_FETCH_VERSION;
+	PutUint32(buffer + 2, firstId);
+	return CATALOG_FETCH_SIZE;
+}
+
+int ParseCatalogFetch(const char *buffer, int bufferSize, uint32_t *firstId) {
+	if (firstId == NULL || bufferSize != CATALOG_FETCH_SIZE || !IsCatalogFetchDatagram(buffer, bufferSize)) {
+		return -1;
+	}
+	
+	*firstId = GetUint32(buffer + 2);
+	return 0;
+}
+
+// Serialize the page of names[0..cityCount-1] that starts at firstId, with as many
+// names as fit in bufferSize. Returns the page size.
+int SerializeCatalogPage(uint32_t version, uint32_t cityCount, uint32_t firstId, const char *const *names,
+                         char *buffer, int bufferSize) {
+	if (buffer == NULL || bufferSize < CATALOG_PAGE_HEADER_SIZE) {
+		return -1;
+	}
+	
+	buffer[0] = (char)CATALOG_FETCH_MAGIC;
+	buffer[1] = CATALOG_FETCH_VERSION;
+	PutUint32(buffer + 2, version);
+	PutUint32(buffer + 6, cityCount);
+	PutUint32(buffer + 10, firstId);
+	
+	int offset = CATALOG_PAGE_HEADER_SIZE;
+	int count = 0;
+	for (uint32_t id = firstId; id < cityCount && count < CATALOG_PAGE_MAX_NAMES; id++) {
+		int len = (int)strlen(names[id]);
+		if (len < 1 || len > MAX_CITY_LENGTH - 1 || offset + 1 + len > bufferSize) {
+			break;
+		}
+		buffer[offset++] = (char)len;
+		memcpy(buffer + offset, names[id], (size_t)len);
+		offset += len;
+		count++;
+	}
+	buffer[14] = (char)count;
+	return offset;
+}
+
+// Deserialize a catalog page (the whole datagram must be well formed)
+int DeserializeCatalogPage(const char *buffer, int bufferSize, struct catalog_page *page) {
+	if (page == NULL || bufferSize < CATALOG_PAGE_HEADER_SIZE || !IsCatalogFetchDatagram(buffer, bufferSize)) {
+		return -1;
+	}
+	
+	page->version = GetUint32(buffer + 2);
+	page->cityCount = GetUint32(buffer + 6);
+	page->firstId = GetUint32(buffer + 10);
+	page->count = (unsigned char)buffer[14];
+	if (page->count > CATALOG_PAGE_MAX_NAMES) {
+		return -1;
+	}
+	
+	int offset = CATALOG_PAGE_HEADER_SIZE;
+	for (int i = 0; i < page->count; i++) {
+		int len = (offset < bufferSize) ? (unsigned char)buffer[offset] : 0;
+		if (len < 1 || len > MAX_CITY_LENGTH - 1 || offset + 1 + len > bufferSize ||
+		    memchr(buffer + offset + 1, '\0', (size_t)len) != NULL) {
+			return -1;
+		}
+		memcpy(page->names[i], buffer + offset + 1, (size_t)len);
+		page->names[i][len] = '\0';
+		offset += 1 + len;
+	}
+	
+	// Trailing bytes make the page malformed
+	return (offset == bufferSize) ? 0 : -1;
+}
+
+// Append the request ID trailer to the size bytes of a request (or response) in buffer.
+// Returns the new size, or -1 if it does not fit.
+int AppendRequestId(uint32_t id, char *buffer, int size, int bufferSize) {
+	if (buffer == NULL || size < 0 || size + REQUEST_ID_SIZE > bufferSize) {
+		return -1;
+	}
+	
+	buffer[size] = (char)REQUEST_ID_MARKER;
+	PutUint32(buffer + size + 1, id);
+	return size + REQUEST_ID_SIZE;
+}
+
+// Find the ID trailer of a request: only after a NUL-terminated classic request or
+// after a compact request, so a datagram without one is never misread. On success
+// *size is shortened to the request proper and 1 is returned, otherwise 0.
+int SplitRequestId(const char *buffer, int *size, uint32_t *id) {
+	int body = *size - REQUEST_ID_SIZE;
+	
+	if (buffer == NULL || body < 2 || (unsigned char)buffer[body] != REQUEST_ID_MARKER) {
+		return 0;
+	}
+	if (buffer[body - 1] != '\0' &&
+	    (body != COMPACT_REQUEST_SIZE || ((unsigned char)buffer[0] & COMPACT_TYPE_FLAG) == 0)) {
+		return 0;
+	}
+	
+	*id = GetUint32(buffer + body + 1);
+	*size = body;
+	return 1;
+}
+
+// Find the ID trailer of a classic response; same contract as SplitRequestId
+int SplitResponseId(const char *buffer, int *size, uint32_t *id) {
+	if (buffer == NULL || *size != BATCH_RESPONSE_ENTRY_SIZE + REQUEST_ID_SIZE ||
+	    (unsigned char)buffer[BATCH_RESPONSE_ENTRY_SIZE] != REQUEST_ID_MARKER) {
+		return 0;
+	}
+	
+	*id = GetUint32(buffer + BATCH_RESPONSE_ENTRY_SIZE + 1);
+	*size = BATCH_RESPONSE_ENTRY_SIZE;
+	return 1;
+}
+
+// Format city name (first letter uppercase, rest lowercase)
+void FormatCityName(char *city) {
+	if (city == NULL || city[0] == '\0') {
+		return;
+	}
+	
+	// First letter uppercase
+	city[0] = toupper((unsigned char)city[0]);
+	
+	// Rest lowercase
+	for (int i = 1; city[i] != '\0'; i++) {
+		city[i] = tolower((unsigned char)city[i]);
+	}
+}
@@ -0,0 +1,199 @@
+/*
+ * async_log.c
+ *
+ * Asynchronous request logger.
+ * The ring is a bounded multi-producer/single-consumer queue where each
+ * cell carries a sequence number (Vyukov-style): producers claim a cell
+ * with one CAS on the enqueue position, the writer thread is the only
+ * consumer. Output is byte-identical to the synchronous printf.
+ * Windows has no writer thread and keeps the synchronous printf.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#if !defined(_WIN32) && !defined(WIN32)
+#include <time.h>
+#include <pthread.h>
+#endif
+#include "async_log.h"
+
+#define LOG_LINE_FORMAT "Richiesta ricevuta da %s (ip %s): type='%c', city='%s'\n"
+
+struct log_cell {
+	atomic_size_t seq;
+	struct log_record rec;
+};
+
+static struct log_cell g_ring[LOG_RING_SIZE];
+static atomic_size_t g_enqueuePos;
+static size_t g_dequeuePos = 0;          // only touched by the writer thread
+static atomic_uint_fast64_t g_dropped;
+static atomic_uint_fast64_t g_written;
+static atomic_int g_running;
+static int g_started = 0;
+#if !defined(_WIN32) && !defined(WIN32)
+static pthread_t g_writerThread;
+#endif
+
+// Bounded copy that always terminates dst
+static void CopyField(char *dst, const char *src, size_t size) {
+	size_t i = 0;
+	if (src != NULL) {
+		while (i < size - 1 && src[i] != '\0') {
+			dst[i] = src[i];
+			i++;
+		}
+	}
+	dst[i] = '\0';
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Pop one record into rec; returns 0 if the ring is empty
+static int PopRecord(struct log_record *rec) {
+	struct log_cell *cell = &g_ring[g_dequeuePos & (LOG_RING_SIZE - 1)];
+	size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+	if (seq != g_dequeuePos + 1) {
+		return 0;
+	}
+	*rec = cell->rec;
+	// Hand the cell back to producers for the next lap
+	atomic_store_explicit(&cell->seq, g_dequeuePos + LOG_RING_SIZE, memory_order_release);
+	g_dequeuePos++;
+	return 1;
+}
+
+// Format every queued record and write them in LOG_WRITE_BUFFER-sized chunks
+static size_t DrainRing(char *out) {
+	struct log_record rec;
+	size_t used = 0;
+	size_t count = 0;
+
+	while (PopRecord(&rec)) {
+		// %c may emit a NUL byte, so the length comes from snprintf, not strlen
+		int len = snprintf(out + used, LOG_WRITE_BUFFER - used, LOG_LINE_FORMAT,
+		                   rec.hostname, rec.ip, rec.type, rec.city);
+		if (len < 0) {
+			continue;
+		}
+		if (used + (size_t)len >= LOG_WRITE_BUFFER) {
+			// Line did not fit: flush what we have and format it again
+			fwrite(out, 1, used, stdout);
+			used = 0;
+			len = snprintf(out, LOG_WRITE_BUFFER, LOG_LINE_FORMAT,
+			               rec.hostname, rec.ip, rec.type, rec.city);
+		}
+		used += (size_t)len;
+		count++;
+	}
+
+	if (used > 0) {
+		fwrite(out, 1, used, stdout);
+		fflush(stdout);
+	}
+	atomic_fetch_add_explicit(&g_written, count, memory_order_relaxed);
+	return count;
+}
+
+// Writer thread: drain, then back off (up to 1 ms) while the ring is empty
+static void *WriterMain(void *arg) {
+	static char out[LOG_WRITE_BUFFER];
+	long idleNs = 1000;
+	(void)arg;
+
+	while (atomic_load_explicit(&g_running, memory_order_acquire)) {
+		if (DrainRing(out) > 0) {
+			idleNs = 1000;
+			continue;
+		}
+		struct timespec ts = { 0, idleNs };
+		nanosleep(&ts, NULL);
+		if (idleNs < 1000000) {
+			idleNs *= 2;
+		}
+	}
+
+	// Final drain after producers stopped
+	DrainRing(out);
+	return NULL;
+}
+
+int AsyncLogStart(void) {
+	for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+		atomic_init(&g_ring[i].seq, i);
+	}
+	atomic_init(&g_enqueuePos, 0);
+	atomic_init(&g_dropped, 0);
+	atomic_init(&g_written, 0);
+	atomic_init(&g_running, 1);
+
+	int err = pthread_create(&g_writerThread, NULL, WriterMain, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error starting log writer: %s\n", strerror(err));
+		return -1;
+	}
+	g_started = 1;
+	return 0;
+}
+
+void AsyncLogStop(void) {
+	if (!g_started) {
+		return;
+	}
+	g_started = 0;
+	atomic_store_explicit(&g_running, 0, memory_order_release);
+	pthread_join(g_writerThread, NULL);
+
+	uint64_t dropped = atomic_load_explicit(&g_dropped, memory_order_relaxed);
+	if (dropped > 0) {
+		fprintf(stderr, "Log writer: %llu records dropped\n", (unsigned long long)dropped);
+	}
+}
+
+#else
+// No writer thread: AsyncLogRequest prints every record itself
+int AsyncLogStart(void) {
+	return 0;
+}
+
+void AsyncLogStop(void) {
+}
+#endif
+
+void AsyncLogRequest(const char *hostname, const char *ip, char type, const char *city) {
+	if (!g_started) {
+		printf(LOG_LINE_FORMAT, hostname, ip, type, city);
+		return;
+	}
+
+	// Claim a cell: its sequence equals our position when it is free for this lap
+	size_t pos = atomic_load_explicit(&g_enqueuePos, memory_order_relaxed);
+	struct log_cell *cell;
+	while (1) {
+		cell = &g_ring[pos & (LOG_RING_SIZE - 1)];
+		size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&g_enqueuePos, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		} else if (seq < pos) {
+			// Writer is a full lap behind: drop instead of blocking the request path
+			atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+			return;
+		} else {
+			pos = atomic_load_explicit(&g_enqueuePos, memory_order_relaxed);
+		}
+	}
+
+	CopyField(cell->rec.hostname, hostname, LOG_HOST_MAX);
+	CopyField(cell->rec.ip, ip, LOG_IP_MAX);
+	cell->rec.type = type;
+	CopyField(cell->rec.city, city, LOG_CITY_MAX);
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+}
+
+void AsyncLogGetStats(struct async_log_stats *stats) {
+	stats->written = atomic_load_explicit(&g_written, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&g_dropped, memory_order_relaxed);
+}
@@ -0,0 +1,66 @@
+/*
+ * async_log.h
+ *
+ * Asynchronous request logger
+ * Request threads push fixed-size records into a lock-free ring buffer;
+ * a writer thread formats them and writes stdout in large batches
+ */
+
+#ifndef ASYNC_LOG_H_
+#define ASYNC_LOG_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * LOGGER CONSTANTS
+ * ============================================================================
+ */
+
+#define LOG_RING_SIZE 4096        // record nel ring buffer (potenza di 2)
+#define LOG_HOST_MAX 256          // nome host più lungo registrato (DNS: 253)
+#define LOG_IP_MAX 16             // INET_ADDRSTRLEN
+#define LOG_CITY_MAX 64           // MAX_CITY_LENGTH
+#define LOG_WRITE_BUFFER 65536    // byte formattati per ogni scrittura su stdout
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// One "Richiesta ricevuta" log line, before formatting
+struct log_record {
+    char hostname[LOG_HOST_MAX];
+    char ip[LOG_IP_MAX];
+    char type;
+    char city[LOG_CITY_MAX];
+};
+
+// Logger counters
+struct async_log_stats {
+    uint64_t written;   // record scritti su stdout
+    uint64_t dropped;   // record scartati perché il ring era pieno
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Start the writer thread; until then (always on Windows, which has none)
+// AsyncLogRequest prints synchronously
+int AsyncLogStart(void);
+
+// Stop the writer thread after draining every queued record
+void AsyncLogStop(void);
+
+// Queue a request log line; never blocks (a full ring drops and counts the record)
+void AsyncLogRequest(const char *hostname, const char *ip, char type, const char *city);
+
+// Snapshot of the logger counters
+void AsyncLogGetStats(struct async_log_stats *stats);
+
+
+#endif /* ASYNC_LOG_H_ */
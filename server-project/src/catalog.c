@@ -0,0 +1,237 @@
+/*
+ * catalog.c
+ *
+ * Catalog swap with quiescence-based reclamation.
+ * A reader stores the global epoch in its own slot when it enters and
+ * zero when it leaves; the reload thread publishes the new table, bumps
+ * the epoch and frees the old table once no slot holds an older epoch.
+ * Readers beyond the slots share two counters, one per epoch parity, so
+ * the reload only waits for those that entered before the bump.
+ * All of these accesses are sequentially consistent, so a reader that
+ * loads the old pointer is always seen by the reload thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#endif
+#include "catalog.h"
+#include "protocol.h"
+
+#define CATALOG_WAIT_NS 100000    // attesa tra due controlli dei lettori
+
+// One reader thread; its own cache line, since it is written on every request
+struct catalog_reader {
+    _Alignas(64) atomic_uint_fast64_t epoch;   // epoca di ingresso, 0 = fuori
+};
+
+static _Atomic(const struct city_table *) g_current = &g_cityTable;
+static atomic_uint_fast64_t g_epoch = 1;
+static struct catalog_reader g_readers[CATALOG_READER_SLOTS];
+static atomic_int g_readerCount;
+static atomic_int g_sharedReaders[2]; // lettori oltre gli slot dentro, per parità dell'epoca
+static _Thread_local int t_reader = -1;
+static _Thread_local int t_sharedParity;
+
+static const char *g_path = NULL;
+static int g_capacity = 0;
+static atomic_uint_fast64_t g_reloads;
+static atomic_uint_fast64_t g_failedReloads;
+static atomic_uint_fast64_t g_issuedTags[4];   // CATALOG_TAG di ogni catalogo pubblicato (bit per tag)
+
+const struct city_table *CatalogEnter(void) {
+	if (t_reader < 0) {
+		int slot = atomic_fetch_add(&g_readerCount, 1);
+		t_reader = (slot < CATALOG_READER_SLOTS) ? slot : CATALOG_READER_SLOTS;
+	}
+	if (t_reader < CATALOG_READER_SLOTS) {
+		atomic_store(&g_readers[t_reader].epoch, atomic_load(&g_epoch));
+	} else {
+		// Counted under an epoch that is still current after the count
+		while (1) {
+			uint64_t epoch = atomic_load(&g_epoch);
+			t_sharedParity = (int)(epoch & 1);
+			atomic_fetch_add(&g_sharedReaders[t_sharedParity], 1);
+			if (atomic_load(&g_epoch) == epoch) {
+				break;
+			}
+			atomic_fetch_sub(&g_sharedReaders[t_sharedParity], 1);
+		}
+	}
+	return atomic_load(&g_current);
+}
+
+// Remember the tag of a catalog about to be published
+static void MarkTagIssued(uint32_t version) {
+	uint8_t tag = CATALOG_TAG(version);
+	atomic_fetch_or_explicit(&g_issuedTags[tag >> 6], 1ull << (tag & 63), memory_order_relaxed);
+}
+
+int CatalogTagIssued(uint8_t tag) {
+	return (atomic_load_explicit(&g_issuedTags[tag >> 6], memory_order_relaxed) >> (tag & 63)) & 1;
+}
+
+void CatalogExit(void) {
+	if (t_reader < CATALOG_READER_SLOTS) {
+		atomic_store_explicit(&g_readers[t_reader].epoch, 0, memory_order_release);
+	} else {
+		atomic_fetch_sub_explicit(&g_sharedReaders[t_sharedParity], 1, memory_order_release);
+	}
+}
+
+int CatalogCapacity(void) {
+	return g_capacity;
+}
+
+void CatalogGetStats(struct catalog_stats *stats) {
+	const struct city_table *table = CatalogEnter();
+	stats->cities = table->count;
+	CatalogExit();
+	stats->capacity = g_capacity;
+	stats->reloads = atomic_load_explicit(&g_reloads, memory_order_relaxed);
+	stats->failedReloads = atomic_load_explicit(&g_failedReloads, memory_order_relaxed);
+}
+
+// Table built from g_path, or NULL if the file cannot be used
+static struct city_table *LoadTable(void) {
+	struct city_table *table = malloc(sizeof(*table));
+	if (table == NULL) {
+		fprintf(stderr, "Error allocating city catalog\n");
+		return NULL;
+	}
+	if (CityTableLoad(g_path, table) != 0) {
+		free(table);
+		return NULL;
+	}
+	if (g_capacity > 0 && table->count > g_capacity) {
+		fprintf(stderr, "City catalog %s has %d cities, more than the %d this server can hold (restart to grow)\n",
+		        g_path, table->count, g_capacity);
+		CityTableFree(table);
+		free(table);
+		return NULL;
+	}
+	return table;
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Wait until every reader has left or entered in epoch or later
+static void WaitForReaders(uint64_t epoch) {
+	const struct timespec pause = { 0, CATALOG_WAIT_NS };
+	int readers = atomic_load(&g_readerCount);
+
+	if (readers > CATALOG_READER_SLOTS) {
+		readers = CATALOG_READER_SLOTS;
+	}
+	for (int r = 0; r < readers; r++) {
+		while (1) {
+			uint64_t seen = atomic_load(&g_readers[r].epoch);
+			if (seen == 0 || seen >= epoch) {
+				break;
+			}
+			nanosleep(&pause, NULL);
+		}
+	}
+	// Overflow readers of the previous epoch: new ones count under the other parity
+	while (atomic_load(&g_sharedReaders[(epoch - 1) & 1]) != 0) {
+		nanosleep(&pause, NULL);
+	}
+}
+
+// Swap in a fresh table from g_path; the old one stays in use on failure
+static void Reload(void) {
+	struct city_table *table = LoadTable();
+	if (table == NULL) {
+		atomic_fetch_add_explicit(&g_failedReloads, 1, memory_order_relaxed);
+		fprintf(stderr, "City catalog not reloaded, keeping the current one\n");
+		return;
+	}
+
+	// Compact requests carry the low byte of the version: make it differ from the
+	// current one unless the catalog is unchanged, so stale IDs are always refused
+	const struct city_table *current = atomic_load(&g_current);
+	if (table->version != current->version && (table->version & 0xFF) == (current->version & 0xFF)) {
+		table->version ^= 1;
+	}
+
+	MarkTagIssued(table->version);
+	const struct city_table *old = atomic_exchange(&g_current, table);
+	uint64_t epoch = atomic_fetch_add(&g_epoch, 1) + 1;
+	WaitForReaders(epoch);
+	if (old != &g_cityTable) {
+		CityTableFree((struct city_table *)old);
+		free((void *)old);
+	}
+
+	atomic_fetch_add_explicit(&g_reloads, 1, memory_order_relaxed);
+	fprintf(stderr, "City catalog reloaded: %d cities\n", table->count);
+}
+
+// Signal thread: reload the catalog on every SIGHUP
+static void *ReloadMain(void *arg) {
+	sigset_t set;
+	int sig;
+	(void)arg;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	while (sigwait(&set, &sig) == 0) {
+		Reload();
+	}
+	return NULL;
+}
+#endif
+
+int CatalogStart(const char *path) {
+	if (path == NULL) {
+		g_capacity = g_cityTable.count;
+		MarkTagIssued(g_cityTable.version);
+		return 0;
+	}
+
+	g_path = path;
+	struct city_table *table = LoadTable();
+	if (table == NULL) {
+		return -1;
+	}
+	if (table->count > CATALOG_MAX_CITIES) {
+		fprintf(stderr, "City catalog %s has %d cities (at most %d)\n", path, table->count, CATALOG_MAX_CITIES);
+		CityTableFree(table);
+		free(table);
+		return -1;
+	}
+
+	// Room for the catalog to grow across reloads without resizing ID-indexed state
+	long capacity = (long)table->count * CATALOG_GROWTH;
+	if (capacity < CATALOG_MIN_CAPACITY) {
+		capacity = CATALOG_MIN_CAPACITY;
+	}
+	g_capacity = (capacity < CATALOG_MAX_CITIES) ? (int)capacity : CATALOG_MAX_CITIES;
+	MarkTagIssued(table->version);
+	atomic_store(&g_current, table);
+
+#if !defined(_WIN32) && !defined(WIN32)
+	// Inherited by every thread created from now on
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, ReloadMain, NULL);
+	if (err != 0) {
+		// The catalog just stays as loaded
+		fprintf(stderr, "Error starting catalog reload thread: %s\n", strerror(err));
+		return 0;
+	}
+	pthread_detach(thread);
+#endif
+	return 0;
+}
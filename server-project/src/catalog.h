@@ -0,0 +1,69 @@
+/*
+ * catalog.h
+ *
+ * City catalog used by the request threads
+ * The built-in table is used unless a city list is loaded with -C. On
+ * SIGHUP the list is loaded again and the new table is swapped in
+ * RCU-style: readers take no lock, they only publish the epoch they
+ * entered in, and the replaced table is freed once every reader has
+ * left or entered after the swap
+ */
+
+#ifndef CATALOG_H_
+#define CATALOG_H_
+
+#include <stdint.h>
+#include "city_hash.h"
+
+/*
+ * ============================================================================
+ * CATALOG CONSTANTS
+ * ============================================================================
+ */
+
+#define CATALOG_READER_SLOTS 66       // SERVER_MAX_WORKERS + 2: thread principale e di riserva
+#define CATALOG_MIN_CAPACITY 1024     // ID città riservati come minimo con -C
+#define CATALOG_GROWTH 4              // capacità = città del primo caricamento * CATALOG_GROWTH
+#define CATALOG_MAX_CITIES (1 << 20)
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+struct catalog_stats {
+    int cities;                 // città del catalogo in uso
+    int capacity;               // limite di ogni ricaricamento (CatalogCapacity)
+    uint64_t reloads;           // ricaricamenti riusciti
+    uint64_t failedReloads;     // ricaricamenti scartati (il catalogo precedente resta in uso)
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Load the city list at path (NULL keeps the built-in table) and, on POSIX,
+// reload it on every SIGHUP. Call before starting other threads, so that
+// they all leave SIGHUP blocked. Returns 0 on success.
+int CatalogStart(const char *path);
+
+// Number of city IDs any catalog may use: a reload with more cities is refused,
+// so state indexed by city ID (weather.h) can be sized once
+int CatalogCapacity(void);
+
+// Enter a read section and return the current table, valid until CatalogExit.
+// Sections of one thread must not nest.
+const struct city_table *CatalogEnter(void);
+void CatalogExit(void);
+
+// 1 if tag is the CATALOG_TAG of a catalog published since the start (the current
+// one or an earlier one), so a compact request carrying it is really one
+int CatalogTagIssued(uint8_t tag);
+
+void CatalogGetStats(struct catalog_stats *stats);
+
+
+#endif /* CATALOG_H_ */
@@ -0,0 +1,371 @@
+/*
+ * city_hash.c
+ *
+ * Hash-and-displace perfect hash over case-folded city names.
+ * Keys are split into buckets by the high half of the hash; each bucket
+ * gets the first displacement that moves all its keys to free slots.
+ * A lookup is one hash of the name, two multiply-shift reductions and
+ * one compare against the single candidate.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "city_hash.h"
+
+#define CITY_DEFAULT_SEED 0x243F6A8885A308D3ull
+#define CITY_MAX_DISPLACEMENT (1u << 20)
+#define CITY_MAX_LINE 256
+
+// Map x uniformly onto [0, n) without a division
+static uint32_t ReduceRange(uint32_t x, uint32_t n) {
+	return (uint32_t)(((uint64_t)x * n) >> 32);
+}
+
+// Slot of a key inside the table, given its bucket displacement
+static uint32_t CitySlot(uint64_t hash, uint32_t displacement, int slotCount) {
+	uint32_t x = (uint32_t)hash ^ displacement;
+	x ^= x >> 16;
+	x *= 0x85EBCA6Bu;
+	x ^= x >> 13;
+	x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+	return ReduceRange(x, (uint32_t)slotCount);
+}
+
+char CityFoldChar(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		return (char)(c + ('a' - 'A'));
+	}
+	return c;
+}
+
+uint64_t CityHashFolded(uint64_t seed, const char *folded, int len) {
+	uint64_t h = seed;
+
+	for (int i = 0; i < len; i += 8) {
+		// Little-endian word, zero padded past the end of the name
+		uint64_t word = 0;
+		int n = (len - i < 8) ? len - i : 8;
+		for (int j = 0; j < n; j++) {
+			word |= (uint64_t)(unsigned char)folded[i + j] << (8 * j);
+		}
+		h = CityHashStep(h, word);
+	}
+	return CityHashFinish(h, len);
+}
+
+int CityTableFind(const struct city_table *table, const char *folded, int len, uint64_t hash) {
+	uint32_t bucket = ReduceRange((uint32_t)(hash >> 32), (uint32_t)table->bucketCount);
+	uint32_t slot = CitySlot(hash, table->displacements[bucket], table->slotCount);
+	int id = table->slots[slot];
+
+	if (id >= 0 && table->lengths[id] == len && memcmp(table->keys[id], folded, (size_t)len) == 0) {
+		return id;
+	}
+	return CITY_NOT_FOUND;
+}
+
+int CityTableLookup(const struct city_table *table, const char *city) {
+	char folded[CITY_NAME_MAX];
+	int len = 0;
+
+	while (city[len] != '\0') {
+		if (len == CITY_NAME_MAX) {
+			return CITY_NOT_FOUND;
+		}
+		folded[len] = CityFoldChar(city[len]);
+		len++;
+	}
+	return CityTableFind(table, folded, len, CityHashFolded(table->seed, folded, len));
+}
+
+// Assign a displacement to every bucket, largest buckets first.
+// Returns 0 on success, -1 if some bucket cannot be placed, -2 if two keys share a hash.
+static int PlaceKeys(const uint64_t *hashes, int count, int bucketCount, int slotCount,
+                     uint32_t *displacements, int32_t *slots) {
+	int *bucketOf = malloc(sizeof(int) * (size_t)count);
+	int *bucketStart = calloc((size_t)bucketCount + 1, sizeof(int));
+	int *members = malloc(sizeof(int) * (size_t)count);
+	int *order = malloc(sizeof(int) * (size_t)bucketCount);
+	uint32_t *candidate = malloc(sizeof(uint32_t) * (size_t)count);
+	int *sizeStart = NULL;
+	int ret = -1;
+
+	if (bucketOf == NULL || bucketStart == NULL || members == NULL || order == NULL || candidate == NULL) {
+		goto done;
+	}
+
+	// Group keys by bucket (counting sort)
+	for (int i = 0; i < count; i++) {
+		bucketOf[i] = (int)ReduceRange((uint32_t)(hashes[i] >> 32), (uint32_t)bucketCount);
+		bucketStart[bucketOf[i] + 1]++;
+	}
+	for (int b = 0; b < bucketCount; b++) {
+		bucketStart[b + 1] += bucketStart[b];
+	}
+	// Fill positions start at each bucket's offset (order doubles as scratch here)
+	memcpy(order, bucketStart, sizeof(int) * (size_t)bucketCount);
+	for (int i = 0; i < count; i++) {
+		members[order[bucketOf[i]]++] = i;
+	}
+
+	// Visit buckets by decreasing size, ties in bucket order (stable counting sort:
+	// sizes are small, and large catalogs have too many buckets for a quadratic sort)
+	int maxSize = 0;
+	for (int b = 0; b < bucketCount; b++) {
+		int size = bucketStart[b + 1] - bucketStart[b];
+		maxSize = (size > maxSize) ? size : maxSize;
+	}
+	sizeStart = calloc((size_t)maxSize + 2, sizeof(int));
+	if (sizeStart == NULL) {
+		goto done;
+	}
+	for (int b = 0; b < bucketCount; b++) {
+		sizeStart[maxSize - (bucketStart[b + 1] - bucketStart[b]) + 1]++;
+	}
+	for (int k = 0; k <= maxSize; k++) {
+		sizeStart[k + 1] += sizeStart[k];
+	}
+	for (int b = 0; b < bucketCount; b++) {
+		order[sizeStart[maxSize - (bucketStart[b + 1] - bucketStart[b])]++] = b;
+	}
+
+	for (int i = 0; i < slotCount; i++) {
+		slots[i] = -1;
+	}
+	memset(displacements, 0, sizeof(uint32_t) * (size_t)bucketCount);
+
+	for (int i = 0; i < bucketCount; i++) {
+		int b = order[i];
+		int first = bucketStart[b];
+		int size = bucketStart[b + 1] - first;
+		if (size == 0) {
+			break;
+		}
+
+		uint32_t d;
+		for (d = 0; d < CITY_MAX_DISPLACEMENT; d++) {
+			int ok = 1;
+			for (int k = 0; k < size && ok; k++) {
+				candidate[k] = CitySlot(hashes[members[first + k]], d, slotCount);
+				if (slots[candidate[k]] != -1) {
+					ok = 0;
+				}
+				for (int m = 0; m < k && ok; m++) {
+					if (candidate[m] == candidate[k]) {
+						if (hashes[members[first + m]] == hashes[members[first + k]]) {
+							// No displacement can ever separate these two keys
+							ret = -2;
+							goto done;
+						}
+						ok = 0;
+					}
+				}
+			}
+			if (ok) {
+				break;
+			}
+		}
+		if (d == CITY_MAX_DISPLACEMENT) {
+			goto done;
+		}
+
+		displacements[b] = d;
+		for (int k = 0; k < size; k++) {
+			slots[candidate[k]] = members[first + k];
+		}
+	}
+	ret = 0;
+
+done:
+	free(bucketOf);
+	free(bucketStart);
+	free(members);
+	free(order);
+	free(candidate);
+	free(sizeStart);
+	return ret;
+}
+
+// FNV-1a over the display names in ID order, each with its terminator
+static uint32_t CatalogFingerprint(const char *const *names, int count) {
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < count; i++) {
+		const char *c = names[i];
+		do {
+			h = (h ^ (unsigned char)*c) * 16777619u;
+		} while (*c++ != '\0');
+	}
+	return h;
+}
+
+int CityTableBuild(const char *const *names, int count, struct city_table *table) {
+	memset(table, 0, sizeof(*table));
+	if (count <= 0) {
+		fprintf(stderr, "City table is empty\n");
+		return -1;
+	}
+
+	int bucketCount = count / CITY_BUCKET_LOAD + 1;
+	int slotCount = count + count / 4 + 1;
+	size_t textSize = 0;
+	for (int i = 0; i < count; i++) {
+		size_t len = strlen(names[i]);
+		if (len == 0 || len > CITY_NAME_MAX) {
+			fprintf(stderr, "Invalid city name length: '%s'\n", names[i]);
+			return -1;
+		}
+		textSize += 2 * (len + 1);
+	}
+
+	char **nameCopies = malloc(sizeof(char *) * (size_t)count);
+	char **keys = malloc(sizeof(char *) * (size_t)count);
+	uint8_t *lengths = malloc((size_t)count);
+	uint64_t *hashes = malloc(sizeof(uint64_t) * (size_t)count);
+	uint32_t *displacements = malloc(sizeof(uint32_t) * (size_t)bucketCount);
+	int32_t *slots = malloc(sizeof(int32_t) * (size_t)slotCount);
+	char *text = malloc(textSize);
+	if (nameCopies == NULL || keys == NULL || lengths == NULL || hashes == NULL ||
+	    displacements == NULL || slots == NULL || text == NULL) {
+		fprintf(stderr, "Error allocating city table\n");
+		goto fail;
+	}
+
+	// Display names and folded keys share one allocation (text)
+	char *cursor = text;
+	for (int i = 0; i < count; i++) {
+		size_t len = strlen(names[i]);
+		nameCopies[i] = cursor;
+		memcpy(cursor, names[i], len + 1);
+		cursor += len + 1;
+		keys[i] = cursor;
+		for (size_t j = 0; j <= len; j++) {
+			cursor[j] = CityFoldChar(names[i][j]);
+		}
+		cursor += len + 1;
+		lengths[i] = (uint8_t)len;
+	}
+
+	// Identical folded names collide under every seed, so they end up here too
+	for (int attempt = 0; attempt < CITY_BUILD_SEEDS; attempt++) {
+		uint64_t seed = CITY_DEFAULT_SEED + 0x9E3779B97F4A7C15ull * (uint64_t)attempt;
+		for (int i = 0; i < count; i++) {
+			hashes[i] = CityHashFolded(seed, keys[i], lengths[i]);
+		}
+		if (PlaceKeys(hashes, count, bucketCount, slotCount, displacements, slots) != 0) {
+			continue;
+		}
+
+		table->seed = seed;
+		table->count = count;
+		table->bucketCount = bucketCount;
+		table->slotCount = slotCount;
+		table->displacements = displacements;
+		table->slots = slots;
+		table->names = (const char *const *)nameCopies;
+		table->keys = (const char *const *)keys;
+		table->lengths = lengths;
+		table->version = CatalogFingerprint(names, count);
+
+		free(hashes);
+		return 0;
+	}
+	fprintf(stderr, "Cannot build city table (duplicate names?)\n");
+
+fail:
+	free(nameCopies);
+	free(keys);
+	free(lengths);
+	free(hashes);
+	free(displacements);
+	free(slots);
+	free(text);
+	return -1;
+}
+
+void CityTableFree(struct city_table *table) {
+	if (table->names != NULL) {
+		// Names and keys live in the block that starts at the first name
+		free((void *)table->names[0]);
+	}
+	free((void *)table->names);
+	free((void *)table->keys);
+	free((void *)table->lengths);
+	free((void *)table->displacements);
+	free((void *)table->slots);
+	memset(table, 0, sizeof(*table));
+}
+
+// Same character rule as the server's request validation (ClassifyCity, ScanRequest)
+static int IsValidCityName(const char *name) {
+	for (int i = 0; name[i] != '\0'; i++) {
+		if (!isalnum((unsigned char)name[i]) && name[i] != ' ' && name[i] != '\'' && name[i] != '-') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static void FreeNames(char **names, int count) {
+	for (int i = 0; i < count; i++) {
+		free(names[i]);
+	}
+	free(names);
+}
+
+int CityTableLoad(const char *path, struct city_table *table) {
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		perror(path);
+		return -1;
+	}
+
+	char **names = NULL;
+	int count = 0;
+	int capacity = 0;
+	char line[CITY_MAX_LINE];
+	int lineNo = 0;
+
+	while (fgets(line, sizeof(line), in) != NULL) {
+		lineNo++;
+		size_t len = strlen(line);
+		while (len > 0 && isspace((unsigned char)line[len - 1])) {
+			line[--len] = '\0';
+		}
+		if (len == 0 || line[0] == '#') {
+			continue;
+		}
+		if (len > CITY_NAME_MAX || !IsValidCityName(line)) {
+			fprintf(stderr, "%s:%d: invalid city name '%s'\n", path, lineNo, line);
+			goto fail;
+		}
+		if (count == capacity) {
+			capacity = capacity ? capacity * 2 : 16;
+			char **grown = realloc(names, sizeof(char *) * (size_t)capacity);
+			if (grown == NULL) {
+				fprintf(stderr, "Out of memory\n");
+				goto fail;
+			}
+			names = grown;
+		}
+		names[count] = malloc(len + 1);
+		if (names[count] == NULL) {
+			fprintf(stderr, "Out of memory\n");
+			goto fail;
+		}
+		memcpy(names[count], line, len + 1);
+		count++;
+	}
+	fclose(in);
+
+	int ret = CityTableBuild((const char *const *)names, count, table);
+	FreeNames(names, count);
+	return ret;
+
+fail:
+	fclose(in);
+	FreeNames(names, count);
+	return -1;
+}
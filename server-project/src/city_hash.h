@@ -0,0 +1,94 @@
+/*
+ * city_hash.h
+ *
+ * Perfect hash over case-folded city names
+ * The built-in table (city_table.c) is generated at build time by
+ * tools/gen_city_table.c from data/cities.txt; CityTableBuild and
+ * CityTableLoad build the same structure at runtime for benchmarks and
+ * for catalogs loaded by the server (-C)
+ */
+
+#ifndef CITY_HASH_H_
+#define CITY_HASH_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * CITY TABLE CONSTANTS
+ * ============================================================================
+ */
+
+#define CITY_NAME_MAX 63            // MAX_CITY_LENGTH - 1: caratteri utili di un nome
+#define CITY_BUCKET_LOAD 4          // chiavi medie per bucket di spostamento
+#define CITY_BUILD_SEEDS 16         // semi provati prima di rinunciare alla costruzione
+#define CITY_NOT_FOUND (-1)
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Hash-and-displace table: bucket = hash >> 32, slot = mix(hash ^ displacement[bucket])
+struct city_table {
+    uint64_t seed;                   // seme della funzione di hash
+    int count;                       // numero di città (ID da 0 a count-1)
+    int bucketCount;
+    int slotCount;
+    const uint32_t *displacements;   // uno per bucket
+    const int32_t *slots;            // slot -> ID città, -1 = vuoto
+    const char *const *names;        // nome da visualizzare, per ID
+    const char *const *keys;         // nome in minuscolo, per ID
+    const uint8_t *lengths;          // lunghezza del nome, per ID
+    uint32_t version;                // impronta dei nomi in ordine di ID: cambia se cambia un ID
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Built-in catalog generated from data/cities.txt
+extern const struct city_table g_cityTable;
+
+// Case folding used for keys ('A'-'Z' -> 'a'-'z', everything else unchanged)
+char CityFoldChar(char c);
+
+// Hash of an already folded name (8-byte little-endian words, zero padded)
+uint64_t CityHashFolded(uint64_t seed, const char *folded, int len);
+
+// Incremental form of CityHashFolded: start from seed, one step per word, then finish.
+// Inline so the request scanner can hash while it scans.
+static inline uint64_t CityHashStep(uint64_t h, uint64_t word) {
+    h = (h ^ word) * 0xFF51AFD7ED558CCDull;
+    return h ^ (h >> 32);
+}
+
+static inline uint64_t CityHashFinish(uint64_t h, int len) {
+    // Length is mixed in last so the hash can be computed before the end is known
+    h ^= (uint64_t)len * 0x9E3779B97F4A7C15ull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+// ID of an already folded and hashed name, or CITY_NOT_FOUND
+int CityTableFind(const struct city_table *table, const char *folded, int len, uint64_t hash);
+
+// ID of a city name in any case, or CITY_NOT_FOUND
+int CityTableLookup(const struct city_table *table, const char *city);
+
+// Build a table at runtime (names must be unique once folded); returns 0 on success
+int CityTableBuild(const char *const *names, int count, struct city_table *table);
+
+// Build a table from a city list file (one name per line, '#' comments); returns 0 on success
+int CityTableLoad(const char *path, struct city_table *table);
+
+// Release a table created by CityTableBuild or CityTableLoad
+void CityTableFree(struct city_table *table);
+
+
+#endif /* CITY_HASH_H_ */
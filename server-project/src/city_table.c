@@ -0,0 +1,59 @@
+/*
+ * city_table.c
+ *
+ * GENERATED by tools/gen_city_table.c from data/cities.txt - DO NOT EDIT
+ * Perfect hash over the built-in city list (see city_hash.h)
+ */
+
+#include "city_hash.h"
+
+static const char *const g_cityNames[10] = {
+	"Bari",
+	"Roma",
+	"Milano",
+	"Napoli",
+	"Torino",
+	"Palermo",
+	"Genova",
+	"Bologna",
+	"Firenze",
+	"Venezia",
+};
+
+static const char *const g_cityKeys[10] = {
+	"bari",
+	"roma",
+	"milano",
+	"napoli",
+	"torino",
+	"palermo",
+	"genova",
+	"bologna",
+	"firenze",
+	"venezia",
+};
+
+static const uint8_t g_cityLengths[10] = {
+	4, 4, 6, 6, 6, 7, 6, 7, 7, 7
+};
+
+static const uint32_t g_cityDisplacements[3] = {
+	2u, 4u, 3u
+};
+
+static const int32_t g_citySlots[13] = {
+	4, 6, 5, 7, 1, 3, -1, -1, 0, -1, 9, 8, 2
+};
+
+const struct city_table g_cityTable = {
+	0x243F6A8885A308D3ull,
+	10,
+	3,
+	13,
+	g_cityDisplacements,
+	g_citySlots,
+	g_cityNames,
+	g_cityKeys,
+	g_cityLengths,
+	0x25E3D3A5u
+};
@@ -0,0 +1,109 @@
+/*
+ * dedup.c
+ *
+ * Per-thread set-associative reply cache.
+ * Entries expire lazily: an expired entry is simply never returned and
+ * is the first to be replaced, so there is no sweeping.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "dedup.h"
+
+static _Thread_local struct dedup_set *t_table;
+static _Thread_local int t_tableFailed;
+
+// Same mixing as the rate limiter, over the whole key
+static uint32_t HashKey(uint32_t addr, uint16_t port, uint32_t id) {
+	uint32_t h = addr ^ ((uint32_t)port << 16) ^ (id * 0x9E3779B1u);
+	h ^= h >> 16;
+	h *= 0x7FEB352Du;
+	h ^= h >> 15;
+	h *= 0x846CA68Bu;
+	h ^= h >> 16;
+	return h;
+}
+
+static uint32_t NowMs(void) {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC_COARSE)
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#elif defined(_WIN32) || defined(WIN32)
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+// Table of the calling thread, allocated on first use and aligned to cache lines
+static struct dedup_set *ThreadTable(void) {
+	if (t_table == NULL && !t_tableFailed) {
+		char *raw = calloc(1, sizeof(struct dedup_set) * DEDUP_SETS + 64);
+		if (raw == NULL) {
+			t_tableFailed = 1;
+			return NULL;
+		}
+		t_table = (struct dedup_set *)(((uintptr_t)raw + 63) & ~(uintptr_t)63);
+	}
+	return t_table;
+}
+
+static int IsLive(const struct dedup_entry *e, uint32_t now) {
+	return e->addr != 0 && (uint32_t)(now - e->stampMs) < DEDUP_TTL_MS;
+}
+
+int DedupLookup(uint32_t addr, uint16_t port, uint32_t id, char *reply) {
+	struct dedup_set *table = ThreadTable();
+	if (table == NULL) {
+		return 0;
+	}
+
+	struct dedup_set *set = &table[HashKey(addr, port, id) & (DEDUP_SETS - 1)];
+	uint32_t now = NowMs();
+	for (int i = 0; i < DEDUP_WAYS; i++) {
+		const struct dedup_entry *e = &set->entries[i];
+		if (e->addr == addr && e->port == port && e->id == id && IsLive(e, now)) {
+			memcpy(reply, e->reply, e->length);
+			return e->length;
+		}
+	}
+	return 0;
+}
+
+void DedupStore(uint32_t addr, uint16_t port, uint32_t id, const char *reply, int length) {
+	struct dedup_set *table = ThreadTable();
+	if (table == NULL || length <= 0 || length > DEDUP_REPLY_MAX) {
+		return;
+	}
+
+	struct dedup_set *set = &table[HashKey(addr, port, id) & (DEDUP_SETS - 1)];
+	uint32_t now = NowMs();
+	struct dedup_entry *victim = &set->entries[0];
+	for (int i = 0; i < DEDUP_WAYS; i++) {
+		struct dedup_entry *e = &set->entries[i];
+		if (e->addr == addr && e->port == port && e->id == id) {
+			victim = e;
+			break;
+		}
+		// Free or expired entries first, then the oldest one
+		if (IsLive(victim, now) && (!IsLive(e, now) || (uint32_t)(now - e->stampMs) > (uint32_t)(now - victim->stampMs))) {
+			victim = e;
+		}
+	}
+
+	victim->addr = addr;
+	victim->port = port;
+	victim->id = id;
+	victim->stampMs = now;
+	victim->length = (uint8_t)length;
+	memcpy(victim->reply, reply, (size_t)length);
+}
@@ -0,0 +1,66 @@
+/*
+ * dedup.h
+ *
+ * Reply cache for retransmitted requests
+ * A request that carries an ID (REQUEST_ID_MARKER) has its encoded reply
+ * stored under (client address, client port, ID) for DEDUP_TTL_MS; a
+ * duplicate gets the stored bytes back without being validated, logged
+ * or answered with fresh weather data. Like the rate limiter, each
+ * request thread owns a set-associative table and takes no locks: with
+ * -j (SO_REUSEPORT) and -P (the receiver's choice) every datagram of a
+ * client socket reaches the same worker, unless its queue is full
+ */
+
+#ifndef DEDUP_H_
+#define DEDUP_H_
+
+#include <stdint.h>
+#include "protocol.h"
+
+/*
+ * ============================================================================
+ * DEDUP CONSTANTS
+ * ============================================================================
+ */
+
+#define DEDUP_SETS 2048          // set della tabella (potenza di 2)
+#define DEDUP_WAYS 2             // risposte per set: 2 x 32 byte in una cache line
+#define DEDUP_TTL_MS 5000        // oltre le ritrasmissioni del client con gli RTO predefiniti
+#define DEDUP_REPLY_MAX (BATCH_RESPONSE_ENTRY_SIZE + REQUEST_ID_SIZE)
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Reply stored for one request ID
+struct dedup_entry {
+    uint32_t addr;       // indirizzo IPv4 (network byte order), 0 = libero
+    uint32_t id;         // ID della richiesta
+    uint32_t stampMs;    // invio della risposta (scadenza e LRU)
+    uint16_t port;       // porta del client (network byte order)
+    uint8_t length;
+    char reply[DEDUP_REPLY_MAX];   // risposta codificata, ID incluso
+};
+
+// One cache line of the table
+struct dedup_set {
+    _Alignas(64) struct dedup_entry entries[DEDUP_WAYS];
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Copy the reply stored for (addr, port, id) into reply (DEDUP_REPLY_MAX bytes);
+// returns its length, or 0 if there is none or it has expired
+int DedupLookup(uint32_t addr, uint16_t port, uint32_t id, char *reply);
+
+// Store the encoded reply to (addr, port, id); longer replies are not stored
+void DedupStore(uint32_t addr, uint16_t port, uint32_t id, const char *reply, int length);
+
+
+#endif /* DEDUP_H_ */
@@ -0,0 +1,362 @@
+/*
+ * dns_cache.c
+ *
+ * Bounded reverse DNS cache with TTL and negative caching.
+ * The request path only reads the cache; getnameinfo runs on a
+ * background resolver thread fed through a bounded queue.
+ * Slots are written under their shard's lock, inside a sequence counter
+ * (seqlock, as for the weather snapshots): a lookup of a cached address
+ * reads the slot without the lock and retries if a write overlapped it.
+ * Only a new or expired address takes the lock, to mark it pending.
+ * Windows has no resolver thread: a miss is resolved in place, so the
+ * server (one thread there) needs no locks.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include "dns_cache.h"
+#include "thread_slot.h"
+
+// Slot states
+#define DNS_SLOT_EMPTY 0
+#define DNS_SLOT_PENDING 1    // in coda per il resolver
+#define DNS_SLOT_RESOLVED 2
+#define DNS_SLOT_NEGATIVE 3
+
+#if !defined(_WIN32) && !defined(WIN32)
+#define DNS_LOCK(lock) pthread_mutex_lock(lock)
+#define DNS_UNLOCK(lock) pthread_mutex_unlock(lock)
+#else
+#define DNS_LOCK(lock) ((void)0)
+#define DNS_UNLOCK(lock) ((void)0)
+#endif
+
+struct dns_slot {
+	atomic_uint seq;       // dispari = in scrittura
+	uint32_t addr;         // indirizzo IPv4 (network byte order)
+	int state;
+	time_t expires;
+	char hostname[DNS_HOST_MAX];
+};
+
+struct dns_shard {
+#if !defined(_WIN32) && !defined(WIN32)
+	pthread_mutex_t lock;  // per chi scrive
+#endif
+	struct dns_slot slots[DNS_CACHE_SHARD_SLOTS];
+};
+
+// Lookup counters of one request thread (thread_slot.h)
+struct dns_counters {
+	_Alignas(64) atomic_uint_fast64_t hits;
+	atomic_uint_fast64_t negativeHits;
+	atomic_uint_fast64_t misses;
+};
+
+static struct dns_shard g_shards[DNS_CACHE_SHARDS];
+static struct dns_counters g_counters[DNS_COUNTER_SLOTS];
+static atomic_int g_counterSlots;
+static _Thread_local struct dns_counters *t_counters;
+static _Thread_local int t_shared;        // t_counters è l'ultimo blocco, condiviso
+
+// Resolver queue and counters (protected by g_queueLock)
+#if !defined(_WIN32) && !defined(WIN32)
+static pthread_mutex_t g_queueLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queueCond = PTHREAD_COND_INITIALIZER;
+static uint32_t g_queue[DNS_QUEUE_SIZE];
+static int g_queueHead = 0;
+static int g_queueCount = 0;
+#endif
+static uint64_t g_queueDrops = 0;
+static uint64_t g_resolved = 0;
+static uint64_t g_failed = 0;
+static atomic_int g_started;   // set once the shard locks are initialised
+
+// Mix the address so consecutive IPs spread over shards and slots
+static uint32_t HashAddress(uint32_t addr) {
+	addr ^= addr >> 16;
+	addr *= 0x7FEB352Du;
+	addr ^= addr >> 15;
+	addr *= 0x846CA68Bu;
+	addr ^= addr >> 16;
+	return addr;
+}
+
+// Counters of the calling thread, claimed on first use
+static struct dns_counters *ThreadCounters(void) {
+	if (t_counters == NULL) {
+		t_counters = &g_counters[ThreadSlotClaim(&g_counterSlots, DNS_COUNTER_SLOTS, &t_shared)];
+	}
+	return t_counters;
+}
+
+// A slot is written between BeginWrite and EndWrite, under the shard lock
+static void BeginWrite(struct dns_slot *slot) {
+	unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void EndWrite(struct dns_slot *slot) {
+	unsigned seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+// Find the slot for addr, or the slot to reuse for it (caller holds the shard lock)
+static struct dns_slot *FindSlot(struct dns_shard *shard, uint32_t hash, uint32_t addr, time_t now) {
+	struct dns_slot *victim = NULL;
+
+	for (int i = 0; i < DNS_CACHE_MAX_PROBES; i++) {
+		struct dns_slot *slot = &shard->slots[(hash + i) % DNS_CACHE_SHARD_SLOTS];
+		if (slot->state != DNS_SLOT_EMPTY && slot->addr == addr) {
+			return slot;
+		}
+		// Prefer empty slots, then expired ones, then the one expiring first
+		if (slot->state == DNS_SLOT_EMPTY) {
+			if (victim == NULL || victim->state != DNS_SLOT_EMPTY) {
+				victim = slot;
+			}
+		} else if (victim == NULL ||
+		           (victim->state != DNS_SLOT_EMPTY && slot->expires < victim->expires)) {
+			victim = slot;
+		}
+	}
+
+	if (victim->state == DNS_SLOT_PENDING && victim->expires > now) {
+		// Never evict an address that is still waiting for the resolver
+		return NULL;
+	}
+	BeginWrite(victim);
+	victim->state = DNS_SLOT_EMPTY;
+	victim->addr = addr;
+	EndWrite(victim);
+	return victim;
+}
+
+// Store a resolver result in the cache
+static void StoreResult(uint32_t addr, const char *hostname) {
+	uint32_t hash = HashAddress(addr);
+	struct dns_shard *shard = &g_shards[hash % DNS_CACHE_SHARDS];
+	time_t now = time(NULL);
+
+	DNS_LOCK(&shard->lock);
+	struct dns_slot *slot = FindSlot(shard, hash / DNS_CACHE_SHARDS, addr, now);
+	if (slot != NULL) {
+		BeginWrite(slot);
+		if (hostname != NULL) {
+			strncpy(slot->hostname, hostname, DNS_HOST_MAX - 1);
+			slot->hostname[DNS_HOST_MAX - 1] = '\0';
+			slot->state = DNS_SLOT_RESOLVED;
+			slot->expires = now + DNS_CACHE_TTL;
+		} else {
+			slot->hostname[0] = '\0';
+			slot->state = DNS_SLOT_NEGATIVE;
+			slot->expires = now + DNS_CACHE_NEGATIVE_TTL;
+		}
+		EndWrite(slot);
+	}
+	DNS_UNLOCK(&shard->lock);
+}
+
+// The only place where getnameinfo is called
+static void Resolve(uint32_t addr) {
+	struct sockaddr_in sa;
+	char host[NI_MAXHOST];
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_addr.s_addr = addr;
+
+	// NI_NAMEREQD: a missing PTR record is a failure, not a numeric "name"
+	int ret = getnameinfo((struct sockaddr *)&sa, sizeof(sa), host, NI_MAXHOST, NULL, 0, NI_NAMEREQD);
+	StoreResult(addr, (ret == 0) ? host : NULL);
+
+	DNS_LOCK(&g_queueLock);
+	if (ret == 0) {
+		g_resolved++;
+	} else {
+		g_failed++;
+	}
+	DNS_UNLOCK(&g_queueLock);
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Queue an address for the resolver; returns 0 if the queue is full
+static int EnqueueResolve(uint32_t addr) {
+	int queued = 0;
+	pthread_mutex_lock(&g_queueLock);
+	if (g_queueCount < DNS_QUEUE_SIZE) {
+		g_queue[(g_queueHead + g_queueCount) % DNS_QUEUE_SIZE] = addr;
+		g_queueCount++;
+		queued = 1;
+		pthread_cond_signal(&g_queueCond);
+	} else {
+		g_queueDrops++;
+	}
+	pthread_mutex_unlock(&g_queueLock);
+	return queued;
+}
+
+// Background resolver
+static void *ResolverMain(void *arg) {
+	(void)arg;
+
+	while (1) {
+		pthread_mutex_lock(&g_queueLock);
+		while (g_queueCount == 0) {
+			pthread_cond_wait(&g_queueCond, &g_queueLock);
+		}
+		uint32_t addr = g_queue[g_queueHead];
+		g_queueHead = (g_queueHead + 1) % DNS_QUEUE_SIZE;
+		g_queueCount--;
+		pthread_mutex_unlock(&g_queueLock);
+
+		Resolve(addr);
+	}
+	return NULL;
+}
+
+int DnsCacheStart(void) {
+	for (int i = 0; i < DNS_CACHE_SHARDS; i++) {
+		pthread_mutex_init(&g_shards[i].lock, NULL);
+	}
+
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, ResolverMain, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error starting DNS resolver: %s\n", strerror(err));
+		return -1;
+	}
+	pthread_detach(thread);
+	atomic_store_explicit(&g_started, 1, memory_order_release);
+	return 0;
+}
+#else
+// No resolver thread: the request waits for getnameinfo, as before the cache
+static int EnqueueResolve(uint32_t addr) {
+	Resolve(addr);
+	return 1;
+}
+
+int DnsCacheStart(void) {
+	atomic_store_explicit(&g_started, 1, memory_order_release);
+	return 0;
+}
+#endif
+
+// State of the live slot of addr, read without the shard lock (the hostname is copied
+// for a resolved one), or DNS_SLOT_EMPTY if addr is not cached or has expired
+static int ReadSlot(const struct dns_shard *shard, uint32_t hash, uint32_t addr, time_t now, char *hostname,
+                    int hostnameSize) {
+	// A torn name may lack its NUL: never read past the slot
+	int copy = (hostnameSize < DNS_HOST_MAX) ? hostnameSize : DNS_HOST_MAX;
+
+	for (int i = 0; i < DNS_CACHE_MAX_PROBES; i++) {
+		const struct dns_slot *slot = &shard->slots[(hash + i) % DNS_CACHE_SHARD_SLOTS];
+		for (;;) {
+			unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			if (seq & 1) {
+				continue;
+			}
+			int state = slot->state;
+			int live = (state != DNS_SLOT_EMPTY && slot->addr == addr && slot->expires > now);
+			if (live && state == DNS_SLOT_RESOLVED) {
+				memcpy(hostname, slot->hostname, (size_t)copy);
+				hostname[copy - 1] = '\0';
+			}
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+				if (live) {
+					return state;
+				}
+				break;
+			}
+		}
+	}
+	return DNS_SLOT_EMPTY;
+}
+
+int DnsCacheLookup(const struct sockaddr_in *addr, char *hostname, int hostnameSize) {
+	if (!atomic_load_explicit(&g_started, memory_order_acquire) || hostnameSize <= 0) {
+		return 0;
+	}
+
+	uint32_t ip = addr->sin_addr.s_addr;
+	uint32_t hash = HashAddress(ip);
+	struct dns_shard *shard = &g_shards[hash % DNS_CACHE_SHARDS];
+	struct dns_counters *counters = ThreadCounters();
+	time_t now = time(NULL);
+
+	int state = ReadSlot(shard, hash / DNS_CACHE_SHARDS, ip, now, hostname, hostnameSize);
+	if (state == DNS_SLOT_RESOLVED) {
+		ThreadSlotAdd(&counters->hits, 1, t_shared);
+		return 1;
+	}
+	if (state == DNS_SLOT_NEGATIVE) {
+		ThreadSlotAdd(&counters->negativeHits, 1, t_shared);
+		return 0;
+	}
+	ThreadSlotAdd(&counters->misses, 1, t_shared);
+	if (state == DNS_SLOT_PENDING) {
+		return 0;
+	}
+
+	// New or expired: mark pending under the lock so concurrent misses queue it only once
+	int enqueue = 0;
+	DNS_LOCK(&shard->lock);
+	struct dns_slot *slot = FindSlot(shard, hash / DNS_CACHE_SHARDS, ip, now);
+	// NULL: probe window full of pending lookups, log the IP and retry later
+	if (slot != NULL && (slot->state == DNS_SLOT_EMPTY || slot->expires <= now)) {
+		BeginWrite(slot);
+		slot->state = DNS_SLOT_PENDING;
+		slot->expires = now + DNS_CACHE_NEGATIVE_TTL;
+		EndWrite(slot);
+		enqueue = 1;
+	}
+	DNS_UNLOCK(&shard->lock);
+
+	if (enqueue && !EnqueueResolve(ip)) {
+		// Queue full: forget the pending mark so a later request can retry
+		DNS_LOCK(&shard->lock);
+		if (slot->addr == ip && slot->state == DNS_SLOT_PENDING) {
+			BeginWrite(slot);
+			slot->state = DNS_SLOT_EMPTY;
+			EndWrite(slot);
+		}
+		DNS_UNLOCK(&shard->lock);
+	}
+#if defined(_WIN32) || defined(WIN32)
+	// Resolved in place: a found name is in the slot already
+	if (enqueue) {
+		return ReadSlot(shard, hash / DNS_CACHE_SHARDS, ip, now, hostname, hostnameSize) == DNS_SLOT_RESOLVED;
+	}
+#endif
+	return 0;
+}
+
+void DnsCacheGetStats(struct dns_cache_stats *stats) {
+	memset(stats, 0, sizeof(*stats));
+	for (int i = 0; i < DNS_COUNTER_SLOTS; i++) {
+		stats->hits += atomic_load_explicit(&g_counters[i].hits, memory_order_relaxed);
+		stats->negativeHits += atomic_load_explicit(&g_counters[i].negativeHits, memory_order_relaxed);
+		stats->misses += atomic_load_explicit(&g_counters[i].misses, memory_order_relaxed);
+	}
+	DNS_LOCK(&g_queueLock);
+	stats->queueDrops = g_queueDrops;
+	stats->resolved = g_resolved;
+	stats->failed = g_failed;
+	DNS_UNLOCK(&g_queueLock);
+}
@@ -0,0 +1,64 @@
+/*
+ * dns_cache.h
+ *
+ * Bounded reverse DNS cache for client logging
+ * Lookups never block: hits take no lock and misses are resolved by a
+ * background thread (on Windows a miss waits for its own resolution)
+ */
+
+#ifndef DNS_CACHE_H_
+#define DNS_CACHE_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * CACHE CONSTANTS
+ * ============================================================================
+ */
+
+#define DNS_CACHE_SHARDS 16           // shard indipendenti, ognuno con il proprio mutex (solo scritture)
+#define DNS_CACHE_SHARD_SLOTS 64      // slot per shard (totale 1024 indirizzi)
+#define DNS_CACHE_MAX_PROBES 8        // sondaggi lineari prima di sostituire uno slot
+#define DNS_CACHE_TTL 300             // secondi di validità di un nome risolto
+#define DNS_CACHE_NEGATIVE_TTL 60     // secondi di validità di una risoluzione fallita
+#define DNS_QUEUE_SIZE 256            // richieste in attesa del resolver
+#define DNS_HOST_MAX 256              // nome host più lungo memorizzato (DNS: 253)
+#define DNS_COUNTER_SLOTS 66          // SERVER_MAX_WORKERS + 2: contatori delle ricerche, uno per thread
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Cache counters (summed over the request threads)
+struct dns_cache_stats {
+    uint64_t hits;          // nome trovato in cache
+    uint64_t negativeHits;  // risoluzione fallita ancora valida
+    uint64_t misses;        // indirizzo assente o scaduto
+    uint64_t queueDrops;    // richieste scartate perché la coda era piena
+    uint64_t resolved;      // risoluzioni completate dal thread in background
+    uint64_t failed;        // risoluzioni fallite
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Start the background resolver (Windows: misses are resolved in place);
+// without it every lookup misses
+int DnsCacheStart(void);
+
+// Copy the cached hostname of addr into hostname and return 1.
+// Return 0 if it is not cached (the caller logs the raw IP); a miss
+// queues the address for background resolution.
+int DnsCacheLookup(const struct sockaddr_in *addr, char *hostname, int hostnameSize);
+
+// Snapshot of the cache counters (all zero until DnsCacheStart)
+void DnsCacheGetStats(struct dns_cache_stats *stats);
+
+
+#endif /* DNS_CACHE_H_ */
@@ -22,18 +22,79 @@
 #include <netdb.h>
 #include <ctype.h>
 #include <signal.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sched.h>
+#endif
 #define closesocket close
 #endif
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdatomic.h>
 #include <time.h>
 #include "protocol.h"
+#include "dns_cache.h"
+#include "async_log.h"
+#include "city_hash.h"
+#include "request_scan.h"
+#include "rng.h"
+#include "weather.h"
+#include "metrics.h"
+#include "ratelimit.h"
+#include "pipeline.h"
+#include "catalog.h"
+#include "dedup.h"
+#include "rx_drops.h"
+#include "rx_timestamp.h"
+#include "profile.h"
+#include "uring_loop.h"
 
 #define NO_ERROR 0
 
-// Global socket for cleanup on signal
+// Receive buffers leave SCAN_MIN_BUFFER bytes after the largest datagram:
+// the scanner reads that far past the start of any query it is given
+#define RX_BUFFER_SIZE (BUFFER_SIZE + SCAN_MIN_BUFFER)
+
+#if defined(__linux__)
+// Per-loop buffers for the recvmmsg/sendmmsg path
+struct batch_io {
+	struct mmsghdr rxMsgs[SERVER_MAX_BATCH];
+	struct mmsghdr txMsgs[SERVER_MAX_BATCH];
+	struct iovec rxIov[SERVER_MAX_BATCH];
+	struct iovec txIov[SERVER_MAX_BATCH];
+	struct sockaddr_in clientAddrs[SERVER_MAX_BATCH];
+	_Alignas(struct cmsghdr) char rxControl[SERVER_MAX_BATCH][RX_CONTROL_SIZE];
+	char rxBuffers[SERVER_MAX_BATCH][RX_BUFFER_SIZE];
+	char txBuffers[SERVER_MAX_BATCH][BUFFER_SIZE];
+	struct reply replies[SERVER_MAX_BATCH];
+};
+#endif
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Per-worker state for the multi-core mode
+struct worker {
+	int id;
+	int sock;         // socket dedicato (SO_REUSEPORT)
+	int cpu;          // CPU su cui fissare il thread, -1 = nessuna
+	int batchSize;
+	int useUring;
+	uint64_t seed;    // seme comune; ogni worker usa il proprio stream (id)
+	pthread_t thread;
+};
+#endif
+
+// Set by the first termination signal: the loops return and main shuts down
+static atomic_int g_stopping;
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Sockets shut down by the stop thread to wake the loops blocked on them
+static int g_serverSockets[SERVER_MAX_WORKERS];
+static int g_serverSocketCount = 0;
+#else
+// Socket closed by the console handler to wake the loop
 static int g_serverSocket = -1;
+#endif
 
 void clearwinsock() {
 #if defined(_WIN32) || defined(WIN32)
@@ -41,24 +102,94 @@ void clearwinsock() {
 #endif
 }
 
-// Signal handler for cleanup
+int ServerStopping(void) {
+	return atomic_load_explicit(&g_stopping, memory_order_acquire);
+}
+
+// Remember a socket the loops receive on, to wake them at shutdown
+static void RegisterServerSocket(int sock) {
+#if !defined(_WIN32) && !defined(WIN32)
+	g_serverSockets[g_serverSocketCount++] = sock;
+#else
+	g_serverSocket = sock;
+#endif
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+static void TerminationSignals(sigset_t *set) {
+	sigemptyset(set);
+	sigaddset(set, SIGINT);
+	sigaddset(set, SIGTERM);
+}
+
+// Stop thread: the first SIGINT/SIGTERM wakes every loop (a socket shut down for
+// reading returns from receive at once), a second one exits without waiting
+static void *StopMain(void *arg) {
+	sigset_t set;
+	int sig;
+	(void)arg;
+
+	TerminationSignals(&set);
+	if (sigwait(&set, &sig) != 0) {
+		return NULL;
+	}
+	atomic_store_explicit(&g_stopping, 1, memory_order_release);
+	for (int i = 0; i < g_serverSocketCount; i++) {
+		shutdown(g_serverSockets[i], SHUT_RD);
+	}
+	if (sigwait(&set, &sig) == 0) {
+		_exit(1);
+	}
+	return NULL;
+}
+
+// Start the stop thread once the sockets are registered; without it the
+// termination signals get their default action back
+static void StartStopThread(void) {
+	pthread_t thread;
+	int err = pthread_create(&thread, NULL, StopMain, NULL);
+	if (err != 0) {
+		sigset_t set;
+		fprintf(stderr, "Error starting stop thread: %s\n", strerror(err));
+		TerminationSignals(&set);
+		pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+		return;
+	}
+	pthread_detach(thread);
+}
+#else
+// Console handler: only flag the stop and close the socket, which fails the pending receive
 void signalHandler(int sig) {
+	(void)sig;
+	atomic_store_explicit(&g_stopping, 1, memory_order_release);
 	if (g_serverSocket != -1) {
 		closesocket(g_serverSocket);
 	}
-	clearwinsock();
-	exit(0);
 }
+#endif
 
 // Parse server command line arguments
-int ParseServerArguments(int argc, char *argv[], int *port) {
-	*port = SERVER_PORT; // default
+int ParseServerArguments(int argc, char *argv[], struct server_config *config) {
+	config->port = SERVER_PORT; // default
+	config->batchSize = 0; // default: SERVER_DEFAULT_BATCH, or PIPE_DEFAULT_BATCH with -P
+	config->workers = 1; // default
+	config->pinCpus = 0; // default
+	config->reverseDns = 1; // default
+	config->seed = RngDefaultSeed(); // default
+	config->useUring = 0; // default
+	config->tickMs = WEATHER_DEFAULT_TICK_MS; // default
+	config->statsPort = 0; // default
+	config->rateLimit = 0.0; // default
+	config->rateBurst = 0.0; // default
+	config->pipelineWorkers = 0; // default
+	config->catalogPath = NULL; // default
+	config->maxReceiveBuffer = 0; // default
 	
 	for (int i = 1; i < argc; i++) {
 		if (strcmp(argv[i], "-p") == 0) {
 			if (i + 1 < argc) {
-				*port = atoi(argv[i + 1]);
-				if (*port <= 0 || *port > 65535) {
+				config->port = atoi(argv[i + 1]);
+				if (config->port <= 0 || config->port > 65535) {
 					fprintf(stderr, "Invalid port number\n");
 					return -1;
 				}
@@ -67,8 +198,149 @@ int ParseServerArguments(int argc, char *argv[], int *port) {
 				fprintf(stderr, "Missing port number after -p\n");
 				return -1;
 			}
+		} else if (strcmp(argv[i], "-j") == 0) {
+			if (i + 1 < argc) {
+				config->workers = atoi(argv[i + 1]);
+				if (config->workers <= 0 || config->workers > SERVER_MAX_WORKERS) {
+					fprintf(stderr, "Invalid number of workers (1-%d)\n", SERVER_MAX_WORKERS);
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing number of workers after -j\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "--seed") == 0) {
+			if (i + 1 < argc) {
+				char *end;
+				config->seed = strtoull(argv[i + 1], &end, 0);
+				if (*end != '\0' || argv[i + 1][0] == '\0') {
+					fprintf(stderr, "Invalid seed\n");
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing seed after --seed\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-T") == 0) {
+			if (i + 1 < argc) {
+				config->tickMs = atoi(argv[i + 1]);
+				if (config->tickMs <= 0 || config->tickMs > WEATHER_MAX_TICK_MS) {
+					fprintf(stderr, "Invalid tick interval (1-%d ms)\n", WEATHER_MAX_TICK_MS);
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing tick interval after -T\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-m") == 0) {
+			if (i + 1 < argc) {
+				config->statsPort = atoi(argv[i + 1]);
+				if (config->statsPort <= 0 || config->statsPort > 65535) {
+					fprintf(stderr, "Invalid stats port number\n");
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing stats port number after -m\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-L") == 0) {
+			if (i + 1 < argc) {
+				// rate[,burst] in datagrams per second per client address
+				char *end;
+				config->rateLimit = strtod(argv[i + 1], &end);
+				config->rateBurst = (config->rateLimit > 1.0) ? config->rateLimit : 1.0;
+				if (*end == ',') {
+					config->rateBurst = strtod(end + 1, &end);
+				}
+				if (*end != '\0' || config->rateLimit <= 0.0 || config->rateBurst < 1.0) {
+					fprintf(stderr, "Invalid rate limit (rate[,burst], rate > 0, burst >= 1)\n");
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing rate limit after -L\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-C") == 0) {
+			if (i + 1 < argc) {
+				config->catalogPath = argv[i + 1];
+				i++;
+			} else {
+				fprintf(stderr, "Missing city list file after -C\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-R") == 0) {
+			if (i + 1 < argc) {
+				// Bytes, with an optional k or m suffix
+				char *end;
+				long bytes = strtol(argv[i + 1], &end, 10);
+				if (*end == 'k' || *end == 'K') {
+					bytes *= 1024;
+					end++;
+				} else if (*end == 'm' || *end == 'M') {
+					bytes *= 1024 * 1024;
+					end++;
+				}
+				if (*end != '\0' || bytes <= 0 || bytes > SERVER_MAX_RECEIVE_BUFFER) {
+					fprintf(stderr, "Invalid receive buffer limit (1-%d bytes, k and m suffixes allowed)\n",
+					        SERVER_MAX_RECEIVE_BUFFER);
+					return -1;
+				}
+				config->maxReceiveBuffer = (int)bytes;
+				i++;
+			} else {
+				fprintf(stderr, "Missing receive buffer limit after -R\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-P") == 0) {
+			if (i + 1 < argc) {
+				config->pipelineWorkers = atoi(argv[i + 1]);
+				if (config->pipelineWorkers <= 0 || config->pipelineWorkers > SERVER_MAX_WORKERS) {
+					fprintf(stderr, "Invalid number of pipeline workers (1-%d)\n", SERVER_MAX_WORKERS);
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing number of pipeline workers after -P\n");
+				return -1;
+			}
+		} else if (strcmp(argv[i], "-n") == 0) {
+			config->reverseDns = 0;
+		} else if (strcmp(argv[i], "-a") == 0) {
+			config->pinCpus = 1;
+		} else if (strcmp(argv[i], "-u") == 0) {
+			config->useUring = 1;
+		} else if (strcmp(argv[i], "-b") == 0) {
+			if (i + 1 < argc) {
+				config->batchSize = atoi(argv[i + 1]);
+				if (config->batchSize <= 0 || config->batchSize > SERVER_MAX_BATCH) {
+					fprintf(stderr, "Invalid batch size (1-%d)\n", SERVER_MAX_BATCH);
+					return -1;
+				}
+				i++;
+			} else {
+				fprintf(stderr, "Missing batch size after -b\n");
+				return -1;
+			}
 		}
 	}
+	if (config->workers > 1 && config->pipelineWorkers > 0) {
+		fprintf(stderr, "-j and -P cannot be used together\n");
+		return -1;
+	}
+	// The pipeline has its own receiver and sender, so io_uring would not be used
+	if (config->useUring && config->pipelineWorkers > 0) {
+		fprintf(stderr, "-u and -P cannot be used together\n");
+		return -1;
+	}
+	// Batching is opt-in for the loops; the pipeline's receiver and sender always batch
+	if (config->batchSize == 0) {
+		config->batchSize = (config->pipelineWorkers > 0) ? PIPE_DEFAULT_BATCH : SERVER_DEFAULT_BATCH;
+	}
 	return 0;
 }
 
@@ -86,198 +358,568 @@ int CreateUDPSocket(void) {
 	return sock;
 }
 
-// Validate request type
-int ValidateRequestType(char type) {
-	return (type == 't' || type == 'h' || type == 'w' || type == 'p');
+// Create and bind the server socket; reusePort lets several workers share the port
+int OpenServerSocket(int port, int reusePort) {
+	struct sockaddr_in serverAddr;
+	
+	int sock = CreateUDPSocket();
+	if (sock < 0) {
+		return -1;
+	}
+	
+#if defined(SO_REUSEPORT)
+	if (reusePort) {
+		int enable = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) < 0) {
+			perror("Error setting SO_REUSEPORT");
+			closesocket(sock);
+			return -1;
+		}
+	}
+#else
+	(void)reusePort;
+#endif
+	
+	// Report kernel drops with every datagram received after one, and stamp each datagram
+	RxDropsEnable(sock);
+	RxTimestampEnable(sock);
+	
+	// Configure server address
+	memset(&serverAddr, 0, sizeof(serverAddr));
+	serverAddr.sin_family = AF_INET;
+	serverAddr.sin_addr.s_addr = INADDR_ANY;
+	serverAddr.sin_port = htons((unsigned short)port);
+	
+	// Bind socket
+	if (bind(sock, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
+#if defined(_WIN32) || defined(WIN32)
+		fprintf(stderr, "Error binding socket: %d\n", WSAGetLastError());
+#else
+		perror("Error binding socket");
+#endif
+		closesocket(sock);
+		return -1;
+	}
+	return sock;
 }
 
-// Case-insensitive string comparison
-int CaseInsensitiveCompare(const char *s1, const char *s2) {
-	while (*s1 && *s2) {
-		if (tolower((unsigned char)*s1) != tolower((unsigned char)*s2)) {
-			return 1;
-		}
-		s1++;
-		s2++;
+// Validate and log one query laid out as a classic request (type, then city).
+// Fills resp except for the weather value, which is read later for cityId.
+static void ProcessQuery(const struct city_table *table, const char *query, int queryLen,
+                         const char *clientHostname, const char *clientIP, struct response *resp, int *cityId) {
+	struct request_scan scan;
+	
+	// Copy, classify, fold and hash the city in one pass
+	resp->status = ScanRequest(table, query, queryLen, &scan);
+	resp->type = scan.respType;
+	resp->value = 0.0f;
+	*cityId = scan.cityId;
+	PROFILE_LAP(PROFILE_SCAN);
+	
+	// Log request (formatted and written by the logger thread)
+	AsyncLogRequest(clientHostname, clientIP, scan.type, scan.city);
+	PROFILE_LAP(PROFILE_LOG);
+}
+
+// Validate and log one compact query against the catalog it was read from
+static void ProcessCompactQuery(const struct city_table *table, const struct compact_request *query,
+                                const char *clientHostname, const char *clientIP, struct response *resp,
+                                int *cityId) {
+	resp->type = query->type;
+	resp->value = 0.0f;
+	*cityId = CITY_NOT_FOUND;
+	
+	// The ID means nothing under another catalog: the client must fetch it again
+	if (query->catalogTag != CATALOG_TAG(table->version)) {
+		resp->status = STATUS_STALE_CATALOG;
+		PROFILE_LAP(PROFILE_SCAN);
+		AsyncLogRequest(clientHostname, clientIP, query->type, "(stale catalog)");
+		PROFILE_LAP(PROFILE_LOG);
+		return;
+	}
+	if (!ValidateRequestType(query->type)) {
+		resp->status = 2;
+	} else if (query->cityId >= table->count) {
+		resp->status = 1;
+	} else {
+		resp->status = 0;
+		*cityId = query->cityId;
 	}
-	return (*s1 != *s2);
+	PROFILE_LAP(PROFILE_SCAN);
+	AsyncLogRequest(clientHostname, clientIP, query->type,
+	                (query->cityId < table->count) ? table->names[query->cityId] : "(unknown city ID)");
+	PROFILE_LAP(PROFILE_LOG);
 }
 
-// Check if city has invalid characters (tabs, special chars)
-int HasInvalidCharacters(const char *city) {
-	for (int i = 0; city[i] != '\0'; i++) {
-		if (city[i] == '\t') {
-			return 1;
+// Locate the queries of a multi-query datagram without copying them.
+// Returns the query count, or 0 if the framing is malformed.
+static int FindBatchQueries(const char *buffer, int bytesReceived, int *offsets) {
+	int count = (unsigned char)buffer[2];
+	if (count < 1 || count > BATCH_MAX_QUERIES) {
+		return 0;
+	}
+	
+	int offset = BATCH_HEADER_SIZE;
+	for (int i = 0; i < count; i++) {
+		if (offset + 2 > bytesReceived) {
+			return 0;
 		}
-		// Check for special characters (non-alphanumeric, non-space, non-apostrophe, non-hyphen)
-		if (!isalnum((unsigned char)city[i]) && 
-		    city[i] != ' ' && 
-		    city[i] != '\'' && 
-		    city[i] != '-') {
-			return 1;
+		int cityLen = (unsigned char)buffer[offset];
+		if (cityLen < 1 || cityLen > MAX_CITY_LENGTH - 1 || offset + 2 + cityLen > bytesReceived ||
+		    memchr(buffer + offset + 2, '\0', cityLen) != NULL) {
+			return 0;
 		}
+		offsets[i] = offset;
+		offset += 2 + cityLen;
 	}
-	return 0;
+	return (offset == bytesReceived) ? count : 0;
 }
 
-// Check if city is supported (case-insensitive)
-int IsCitySupported(const char *city) {
-	const char *supportedCities[] = {
-		"Bari", "Roma", "Milano", "Napoli", "Torino",
-		"Palermo", "Genova", "Bologna", "Firenze", "Venezia"
-	};
-	int numCities = 10;
+// Process one request datagram (classic, multi-query, compact or catalog page request):
+// lookup, validation and logging. Fills reply except for the weather values and the
+// catalog names (added by SerializeReply); a retransmitted request ID only gets its
+// stored reply. Returns
+// the number of queries, or 0 if the sender is over its rate limit and the datagram
+// must be dropped unanswered. buffer must have SCAN_MIN_BUFFER readable bytes past
+// the datagram (RX_BUFFER_SIZE), since every query is scanned in place.
+int ProcessRequest(const char *buffer, int bytesReceived, const struct sockaddr_in *clientAddr,
+                   struct reply *reply) {
+	char clientHostname[NI_MAXHOST];
+	char clientIP[INET_ADDRSTRLEN];
+	
+	reply->isBatch = 0;
+	reply->isCatalogPage = 0;
+	reply->hasRequestId = 0;
+	reply->duplicateLength = 0;
+	PROFILE_MARK();
+	
+	// Rate limit first: a dropped datagram costs no DNS lookup and no log line
+	if (!RateLimitAllow(clientAddr->sin_addr.s_addr)) {
+		MetricsRecordRateLimited();
+		reply->data.count = 0;
+		return 0;
+	}
 	
-	for (int i = 0; i < numCities; i++) {
-		if (CaseInsensitiveCompare(city, supportedCities[i]) == 0) {
+	// Catalog page: the names are copied by SerializeReply
+	if (ParseCatalogFetch(buffer, bytesReceived, &reply->catalogFirst) == 0) {
+		reply->isCatalogPage = 1;
+		reply->data.count = 1;
+		return 1;
+	}
+	
+	// Retransmission of a request already answered: the stored reply goes back as it is
+	if (SplitRequestId(buffer, &bytesReceived, &reply->requestId)) {
+		reply->clientAddr = clientAddr->sin_addr.s_addr;
+		reply->clientPort = clientAddr->sin_port;
+		reply->duplicateLength = DedupLookup(reply->clientAddr, reply->clientPort, reply->requestId,
+		                                     reply->duplicate);
+		reply->hasRequestId = (reply->duplicateLength == 0);
+		if (reply->duplicateLength > 0) {
+			reply->data.count = 1;
 			return 1;
 		}
 	}
-	return 0;
-}
-
-// Validate city name
-int ValidateCity(const char *city) {
-	if (HasInvalidCharacters(city)) {
-		return 0;
+	PROFILE_LAP(PROFILE_ADMIT);
+	
+	// Get client IP address
+	if (inet_ntop(AF_INET, &clientAddr->sin_addr, clientIP, INET_ADDRSTRLEN) == NULL) {
+		strcpy(clientIP, "unknown");
 	}
-	return IsCitySupported(city);
-}
-
-// Get temperature (-10.0 to 40.0 °C)
-float GetTemperature(void) {
-	return ((float)rand() / RAND_MAX) * 50.0f - 10.0f;
+	
+	// Get client hostname from the reverse DNS cache (misses are resolved in background)
+	if (!DnsCacheLookup(clientAddr, clientHostname, NI_MAXHOST)) {
+		strncpy(clientHostname, clientIP, NI_MAXHOST - 1);
+		clientHostname[NI_MAXHOST - 1] = '\0';
+	}
+	PROFILE_LAP(PROFILE_DNS);
+	
+	// City IDs stay valid after the section: every catalog fits CatalogCapacity
+	const struct city_table *table = CatalogEnter();
+	struct compact_request compact;
+	int count = 0;
+	
+	// Only with the tag of one of our catalogs: any other 4-byte datagram whose type has
+	// the high bit set is a classic request, answered as invalid as it always was
+	if (ParseCompactRequest(buffer, bytesReceived, &compact) == 0 && CatalogTagIssued(compact.catalogTag)) {
+		// A city ID instead of the name: no string work at all
+		count = 1;
+		reply->data.count = 1;
+		ProcessCompactQuery(table, &compact, clientHostname, clientIP, &reply->data.results[0], &reply->cityIds[0]);
+	} else if (IsBatchDatagram(buffer, bytesReceived)) {
+		int offsets[BATCH_MAX_QUERIES];
+		count = FindBatchQueries(buffer, bytesReceived, offsets);
+		if (count > 0) {
+			// Each query is (cityLen, type, city): from the type on it reads like a classic request
+			reply->isBatch = 1;
+			reply->data.count = count;
+			for (int i = 0; i < count; i++) {
+				ProcessQuery(table, buffer + offsets[i] + 1, 1 + (unsigned char)buffer[offsets[i]],
+				             clientHostname, clientIP, &reply->data.results[i], &reply->cityIds[i]);
+			}
+		}
+		// Malformed: answered like the invalid classic request it would otherwise be
+	}
+	
+	if (count == 0) {
+		reply->data.count = 1;
+		count = 1;
+		ProcessQuery(table, buffer, bytesReceived, clientHostname, clientIP, &reply->data.results[0],
+		             &reply->cityIds[0]);
+	}
+	CatalogExit();
+	return count;
 }
 
-// Get humidity (20.0 to 100.0%)
-float GetHumidity(void) {
-	return ((float)rand() / RAND_MAX) * 80.0f + 20.0f;
+// Serialize a reply in the format of its request. Entries are copied already
+// encoded from the response cache (weather.h), with the current weather values.
+int SerializeReply(const struct reply *reply, char *buffer, int bufferSize) {
+	int offset = 0;
+	
+	PROFILE_MARK();
+	if (reply->duplicateLength > 0) {
+		if (bufferSize < reply->duplicateLength) {
+			return -1;
+		}
+		memcpy(buffer, reply->duplicate, (size_t)reply->duplicateLength);
+		return reply->duplicateLength;
+	}
+	if (reply->isCatalogPage) {
+		// From the catalog in use now; the page carries its version
+		const struct city_table *table = CatalogEnter();
+		int size = SerializeCatalogPage(table->version, (uint32_t)table->count, reply->catalogFirst, table->names,
+		                                buffer, bufferSize);
+		CatalogExit();
+		return size;
+	}
+	if (reply->isBatch) {
+		// Same header as SerializeBatchResponse; a classic response is one entry
+		offset = BATCH_HEADER_SIZE;
+		buffer[0] = (char)BATCH_MAGIC;
+		buffer[1] = BATCH_VERSION;
+		buffer[2] = (char)reply->data.count;
+	}
+	if (bufferSize < offset + reply->data.count * BATCH_RESPONSE_ENTRY_SIZE) {
+		return -1;
+	}
+	EncodeWeatherResponses(reply->data.results, reply->cityIds, reply->data.count, buffer + offset);
+	offset += reply->data.count * BATCH_RESPONSE_ENTRY_SIZE;
+	
+	// Echo the request ID and keep the reply for retransmissions
+	if (reply->hasRequestId) {
+		offset = AppendRequestId(reply->requestId, buffer, offset, bufferSize);
+		DedupStore(reply->clientAddr, reply->clientPort, reply->requestId, buffer, offset);
+	}
+	PROFILE_LAP(PROFILE_ENCODE);
+	return offset;
 }
 
-// Get wind speed (0.0 to 100.0 km/h)
-float GetWind(void) {
-	return ((float)rand() / RAND_MAX) * 100.0f;
+// Handle one request datagram: processing, weather data and response encoding.
+// Returns the size of the response written to respBuffer, 0 if the datagram is
+// dropped by the rate limit, or -1 on error.
+int HandleRequest(const char *buffer, int bytesReceived, const struct sockaddr_in *clientAddr,
+                  char *respBuffer, int respBufferSize) {
+	struct reply reply;
+	uint64_t start = MetricsNowNs();
+	
+	if (ProcessRequest(buffer, bytesReceived, clientAddr, &reply) == 0) {
+		return 0;
+	}
+	
+	// Copy the encoded response with the current weather data
+	int respSize = SerializeReply(&reply, respBuffer, respBufferSize);
+	MetricsRecordReply(&reply, bytesReceived, respSize, MetricsNowNs() - start);
+	return respSize;
 }
 
-// Get pressure (950.0 to 1050.0 hPa)
-float GetPressure(void) {
-	return ((float)rand() / RAND_MAX) * 100.0f + 950.0f;
+// One-at-a-time loop: one recvfrom (recvmsg, for the drop counter) and one sendto per request
+void RunSingleLoop(int sock) {
+	struct sockaddr_in clientAddr;
+	socklen_t clientAddrLen;
+	char buffer[RX_BUFFER_SIZE];
+	int bytesReceived, bytesSent;
+#if !defined(_WIN32) && !defined(WIN32)
+	_Alignas(struct cmsghdr) char control[RX_CONTROL_SIZE];
+	struct iovec iov;
+	struct msghdr msg;
+#endif
+	
+	// Cleared once: the scanner masks whatever follows each datagram
+	memset(buffer, 0, RX_BUFFER_SIZE);
+	
+	while (1) {
+		clientAddrLen = sizeof(clientAddr);
+		
+		// Receive request
+		PROFILE_MARK();
+#if defined(_WIN32) || defined(WIN32)
+		bytesReceived = recvfrom(sock, buffer, BUFFER_SIZE - 1, 0,
+		                         (struct sockaddr *)&clientAddr, &clientAddrLen);
+#else
+		iov.iov_base = buffer;
+		iov.iov_len = BUFFER_SIZE - 1;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &clientAddr;
+		msg.msg_namelen = clientAddrLen;
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		bytesReceived = (int)recvmsg(sock, &msg, 0);
+		if (bytesReceived >= 0) {
+			clientAddrLen = msg.msg_namelen;
+			RxDropsRecord(sock, &msg);
+			RxTimestampRecord(&msg, RxTimestampNow());
+		}
+#endif
+		PROFILE_LAP(PROFILE_RECEIVE);
+		
+		if (ServerStopping()) {
+			return;
+		}
+		if (bytesReceived < 0) {
+			MetricsRecordRecvError();
+#if defined(_WIN32) || defined(WIN32)
+			int error = WSAGetLastError();
+			if (error != WSAECONNRESET) {
+				fprintf(stderr, "Error receiving data: %d\n", error);
+			}
+#else
+			perror("Error receiving data");
+#endif
+			continue;
+		}
+		
+		// Serialize and send response
+		int respSize = HandleRequest(buffer, bytesReceived, &clientAddr, buffer, BUFFER_SIZE);
+		if (respSize > 0) {
+			PROFILE_MARK();
+			bytesSent = sendto(sock, buffer, respSize, 0,
+			                   (struct sockaddr *)&clientAddr, clientAddrLen);
+			PROFILE_LAP(PROFILE_SEND);
+			if (bytesSent < 0) {
+				MetricsRecordSendErrors(1);
+#if defined(_WIN32) || defined(WIN32)
+				fprintf(stderr, "Error sending response: %d\n", WSAGetLastError());
+#else
+				perror("Error sending response");
+#endif
+			}
+		}
+	}
 }
 
-// Format city name (first letter uppercase, rest lowercase)
-void FormatCityName(char *city) {
-	if (city == NULL || city[0] == '\0') {
+#if defined(__linux__)
+// Batched loop: up to batchSize datagrams per recvmmsg, all replies flushed with one sendmmsg
+void RunBatchLoop(int sock, int batchSize) {
+	struct batch_io *io = calloc(1, sizeof(struct batch_io));
+	if (io == NULL) {
+		fprintf(stderr, "Error allocating batch buffers, falling back to single loop\n");
+		RunSingleLoop(sock);
 		return;
 	}
 	
-	// First letter uppercase
-	city[0] = toupper((unsigned char)city[0]);
-	
-	// Rest lowercase
-	for (int i = 1; city[i] != '\0'; i++) {
-		city[i] = tolower((unsigned char)city[i]);
+	while (1) {
+		// Re-arm receive slots (recvmmsg overwrites name and length fields)
+		for (int i = 0; i < batchSize; i++) {
+			io->rxIov[i].iov_base = io->rxBuffers[i];
+			io->rxIov[i].iov_len = BUFFER_SIZE - 1;
+			memset(&io->rxMsgs[i].msg_hdr, 0, sizeof(io->rxMsgs[i].msg_hdr));
+			io->rxMsgs[i].msg_hdr.msg_name = &io->clientAddrs[i];
+			io->rxMsgs[i].msg_hdr.msg_namelen = sizeof(io->clientAddrs[i]);
+			io->rxMsgs[i].msg_hdr.msg_iov = &io->rxIov[i];
+			io->rxMsgs[i].msg_hdr.msg_iovlen = 1;
+			io->rxMsgs[i].msg_hdr.msg_control = io->rxControl[i];
+			io->rxMsgs[i].msg_hdr.msg_controllen = RX_CONTROL_SIZE;
+		}
+		
+		// Block for the first datagram, then take whatever else is already queued
+		PROFILE_MARK();
+		int received = recvmmsg(sock, io->rxMsgs, batchSize, MSG_WAITFORONE, NULL);
+		PROFILE_LAP(PROFILE_RECEIVE);
+		if (ServerStopping()) {
+			free(io);
+			return;
+		}
+		if (received < 0) {
+			MetricsRecordRecvError();
+			perror("Error receiving data");
+			continue;
+		}
+		RxDropsRecord(sock, &io->rxMsgs[received - 1].msg_hdr);
+		uint64_t receivedNs = RxTimestampNow();
+		for (int i = 0; i < received; i++) {
+			RxTimestampRecord(&io->rxMsgs[i].msg_hdr, receivedNs);
+		}
+		uint64_t start = MetricsNowNs();
+		
+		// Validate and log the whole batch
+		for (int i = 0; i < received; i++) {
+			ProcessRequest(io->rxBuffers[i], (int)io->rxMsgs[i].msg_len, &io->clientAddrs[i], &io->replies[i]);
+		}
+		
+		int pending = 0;
+		for (int i = 0; i < received; i++) {
+			if (io->replies[i].data.count == 0) {
+				continue; // rate limited
+			}
+			int respSize = SerializeReply(&io->replies[i], io->txBuffers[pending], BUFFER_SIZE);
+			// Service time includes the wait behind earlier datagrams of the batch
+			MetricsRecordReply(&io->replies[i], (int)io->rxMsgs[i].msg_len, respSize, MetricsNowNs() - start);
+			if (respSize <= 0) {
+				continue;
+			}
+			io->txIov[pending].iov_base = io->txBuffers[pending];
+			io->txIov[pending].iov_len = respSize;
+			memset(&io->txMsgs[pending].msg_hdr, 0, sizeof(io->txMsgs[pending].msg_hdr));
+			io->txMsgs[pending].msg_hdr.msg_name = &io->clientAddrs[i];
+			io->txMsgs[pending].msg_hdr.msg_namelen = io->rxMsgs[i].msg_hdr.msg_namelen;
+			io->txMsgs[pending].msg_hdr.msg_iov = &io->txIov[pending];
+			io->txMsgs[pending].msg_hdr.msg_iovlen = 1;
+			pending++;
+		}
+		
+		// Flush all replies; sendmmsg may send fewer than requested
+		PROFILE_MARK();
+		int sent = 0;
+		while (sent < pending) {
+			int n = sendmmsg(sock, io->txMsgs + sent, pending - sent, 0);
+			if (n < 0) {
+				MetricsRecordSendErrors(1);
+				perror("Error sending response");
+				// Skip the datagram that failed and keep the rest of the batch
+				sent++;
+				continue;
+			}
+			sent += n;
+		}
+		PROFILE_LAP(PROFILE_SEND);
 	}
 }
+#endif
 
-// Get hostname from address (reverse DNS lookup)
-int GetHostnameFromAddress(const struct sockaddr_in *addr, char *hostname, int hostnameSize) {
-	char ipStr[INET_ADDRSTRLEN];
-	if (inet_ntop(AF_INET, &addr->sin_addr, ipStr, INET_ADDRSTRLEN) == NULL) {
-		return -1;
+// Run the reception loop selected by -u and the batch size, until the server stops
+void RunServerLoop(int sock, int batchSize, int useUring) {
+	// io_uring fails right away if it cannot run here: fall back to the loops below
+	if (useUring) {
+		if (RunUringLoop(sock) == 0) {
+			return;
+		}
+		fprintf(stderr, "io_uring not available (needs Linux 6.0 and make IO_URING=1), using the %s loop\n",
+		        batchSize > 1 ? "recvmmsg" : "recvfrom");
 	}
-	
-#if defined(_WIN32) || defined(WIN32)
-	char host[NI_MAXHOST];
-	char serv[NI_MAXSERV];
-	if (getnameinfo((struct sockaddr *)addr, sizeof(struct sockaddr_in), host, NI_MAXHOST, serv, NI_MAXSERV, 0) != 0) {
-		strncpy(hostname, ipStr, hostnameSize - 1);
-		hostname[hostnameSize - 1] = '\0';
-		return 0;
+#if defined(__linux__)
+	if (batchSize > 1) {
+		RunBatchLoop(sock, batchSize);
+		return;
 	}
-	strncpy(hostname, host, hostnameSize - 1);
-	hostname[hostnameSize - 1] = '\0';
 #else
-	if (getnameinfo((struct sockaddr *)addr, sizeof(struct sockaddr_in), hostname, hostnameSize, NULL, 0, 0) != 0) {
-		strncpy(hostname, ipStr, hostnameSize - 1);
-		hostname[hostnameSize - 1] = '\0';
-		return 0;
-	}
+	(void)batchSize;
 #endif
-	return 0;
+	RunSingleLoop(sock);
 }
 
-// Deserialize request from buffer
-int DeserializeRequest(const char *buffer, int bufferSize, struct request *req) {
-	if (buffer == NULL || req == NULL || bufferSize < (int)(sizeof(char) + 1)) {
-		return -1;
-	}
-	
-	int offset = 0;
-	
-	// Deserialize type (1 byte)
-	req->type = buffer[offset];
-	offset += sizeof(char);
+#if !defined(_WIN32) && !defined(WIN32)
+// Worker thread: optional CPU pinning, own random state, own socket
+void *WorkerMain(void *arg) {
+	struct worker *w = (struct worker *)arg;
 	
-	// Deserialize city (up to 64 bytes including null terminator)
-	int cityLen = 0;
-	while (offset < bufferSize && cityLen < MAX_CITY_LENGTH - 1 && buffer[offset] != '\0') {
-		req->city[cityLen++] = buffer[offset++];
+#if defined(__linux__)
+	if (w->cpu >= 0) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(w->cpu, &cpus);
+		int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if (err != 0) {
+			fprintf(stderr, "Worker %d: cannot pin to CPU %d: %s\n", w->id, w->cpu, strerror(err));
+		}
 	}
-	req->city[cityLen] = '\0';
+#endif
 	
-	return 0;
+	RngSeed(w->seed, w->id);
+	RunServerLoop(w->sock, w->batchSize, w->useUring);
+	return NULL;
 }
 
-// Serialize response to buffer
-int SerializeResponse(const struct response *resp, char *buffer, int bufferSize) {
-	if (resp == NULL || buffer == NULL) {
+// Start config->workers threads, each on its own SO_REUSEPORT socket, and wait for them to stop
+int RunWorkers(const struct server_config *config) {
+	struct worker *workers = calloc((size_t)config->workers, sizeof(struct worker));
+	if (workers == NULL) {
+		fprintf(stderr, "Error allocating workers\n");
 		return -1;
 	}
 	
-	int requiredSize = sizeof(uint32_t) + sizeof(char) + sizeof(float);
-	if (bufferSize < requiredSize) {
-		return -1;
+	long cpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpuCount <= 0) {
+		cpuCount = 1;
 	}
 	
-	int offset = 0;
+	// Bind every socket before starting any thread so the kernel spreads load from the start
+	for (int i = 0; i < config->workers; i++) {
+		workers[i].id = i;
+		workers[i].batchSize = config->batchSize;
+		workers[i].useUring = config->useUring;
+		workers[i].cpu = config->pinCpus ? (int)(i % cpuCount) : -1;
+		workers[i].seed = config->seed;
+		workers[i].sock = OpenServerSocket(config->port, 1);
+		if (workers[i].sock < 0) {
+			for (int j = 0; j < i; j++) {
+				closesocket(workers[j].sock);
+			}
+			free(workers);
+			return -1;
+		}
+		RegisterServerSocket(workers[i].sock);
+	}
+	StartStopThread();
 	
-	// Serialize status (uint32_t) with network byte order
-	uint32_t netStatus = htonl(resp->status);
-	memcpy(buffer + offset, &netStatus, sizeof(uint32_t));
-	offset += sizeof(uint32_t);
+	printf("Server listening on port %d (%d workers)\n", config->port, config->workers);
+	fflush(stdout);
 	
-	// Serialize type (1 byte, no conversion needed)
-	buffer[offset] = resp->type;
-	offset += sizeof(char);
+	int started = 0;
+	while (started < config->workers) {
+		int err = pthread_create(&workers[started].thread, NULL, WorkerMain, &workers[started]);
+		if (err != 0) {
+			fprintf(stderr, "Error starting worker %d: %s\n", started, strerror(err));
+			break;
+		}
+		started++;
+	}
 	
-	// Serialize value (float) with network byte order
-	uint32_t temp;
-	memcpy(&temp, &resp->value, sizeof(float));
-	temp = htonl(temp);
-	memcpy(buffer + offset, &temp, sizeof(float));
-	offset += sizeof(float);
+	for (int i = 0; i < started; i++) {
+		pthread_join(workers[i].thread, NULL);
+	}
 	
-	return offset;
+	for (int i = 0; i < config->workers; i++) {
+		closesocket(workers[i].sock);
+	}
+	free(workers);
+	return (started > 0) ? 0 : -1;
+}
+#endif
+
+// Orderly shutdown once the loops have returned: weather ticks, then the request log
+static void StopServices(void) {
+	WeatherStop();
+	AsyncLogStop();
 }
 
 int main(int argc, char *argv[]) {
-	int port;
-	struct sockaddr_in serverAddr, clientAddr;
-	char buffer[BUFFER_SIZE];
-	struct request req;
-	struct response resp;
-	socklen_t clientAddrLen;
-	int bytesReceived, bytesSent;
-	char clientHostname[NI_MAXHOST];
-	char clientIP[INET_ADDRSTRLEN];
-	
-	// Initialize random seed
-	srand((unsigned int)time(NULL));
+	struct server_config config;
 	
 	// Parse arguments
-	if (ParseServerArguments(argc, argv, &port) != 0) {
+	if (ParseServerArguments(argc, argv, &config) != 0) {
 		return 1;
 	}
+	
+	// Initialize random seed (workers use their own streams of the same seed)
+	RngSeed(config.seed, 0);
+
+#if !defined(_WIN32) && !defined(WIN32)
+	// Block the termination signals before any thread starts: the stop thread takes them
+	sigset_t termination;
+	TerminationSignals(&termination);
+	pthread_sigmask(SIG_BLOCK, &termination, NULL);
+#endif
 
 #if defined(_WIN32) || defined(WIN32)
 	// Initialize Winsock
@@ -289,142 +931,96 @@ int main(int argc, char *argv[]) {
 	}
 #endif
 
-	// Setup signal handler
-#if !defined(_WIN32) && !defined(WIN32)
-	signal(SIGINT, signalHandler);
-	signal(SIGTERM, signalHandler);
-#endif
+	if (RateLimitConfigure(config.rateLimit, config.rateBurst) != 0) {
+		clearwinsock();
+		return 1;
+	}
+	RxDropsConfigure(config.maxReceiveBuffer);
+	PROFILE_START();
+	
+	// Load the city catalog before any thread starts: they all inherit the blocked SIGHUP
+	if (CatalogStart(config.catalogPath) != 0) {
+		clearwinsock();
+		return 1;
+	}
+	
+	// Start the metrics threads first: every later thread inherits the blocked SIGUSR1
+	if (MetricsStart(config.statsPort) != 0) {
+		clearwinsock();
+		return 1;
+	}
 
-	// Create UDP socket
-	int my_socket = CreateUDPSocket();
-	if (my_socket < 0) {
+	// Start the background reverse DNS resolver (-n logs raw IPs only)
+	if (config.reverseDns && DnsCacheStart() != 0) {
 		clearwinsock();
 		return 1;
 	}
-	g_serverSocket = my_socket;
 
-	// Configure server address
-	memset(&serverAddr, 0, sizeof(serverAddr));
-	serverAddr.sin_family = AF_INET;
-	serverAddr.sin_addr.s_addr = INADDR_ANY;
-	serverAddr.sin_port = htons((unsigned short)port);
+	// Start the weather simulation; requests read its latest snapshot
+	WeatherStart(CatalogCapacity(), config.seed, config.tickMs);
 
-	// Bind socket
-	if (bind(my_socket, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) < 0) {
-#if defined(_WIN32) || defined(WIN32)
-		fprintf(stderr, "Error binding socket: %d\n", WSAGetLastError());
+	// Start the asynchronous request logger (stopped with the weather in StopServices)
+	AsyncLogStart();
+
+#if !defined(_WIN32) && !defined(WIN32)
+	// Multi-core mode: one SO_REUSEPORT socket and thread per worker
+	if (config.workers > 1) {
+		int ret = RunWorkers(&config);
+		StopServices();
+		if (ret == 0) {
+			printf("Server terminated.\n");
+		}
+		clearwinsock();
+		return (ret == 0) ? 0 : 1;
+	}
 #else
-		perror("Error binding socket");
+	if (config.workers > 1) {
+		fprintf(stderr, "Multiple workers are not supported on this platform, using 1\n");
+	}
 #endif
-		closesocket(my_socket);
+
+	// Create and bind UDP socket
+	int my_socket = OpenServerSocket(config.port, 0);
+	if (my_socket < 0) {
+		StopServices();
 		clearwinsock();
 		return 1;
 	}
-
-	printf("Server listening on port %d\n", port);
-
-	// UDP datagram reception loop
-	while (1) {
-		clientAddrLen = sizeof(clientAddr);
-		memset(buffer, 0, BUFFER_SIZE);
-		
-		// Receive request
-		bytesReceived = recvfrom(my_socket, buffer, BUFFER_SIZE - 1, 0,
-		                         (struct sockaddr *)&clientAddr, &clientAddrLen);
-		
-		if (bytesReceived < 0) {
-#if defined(_WIN32) || defined(WIN32)
-			int error = WSAGetLastError();
-			if (error != WSAECONNRESET) {
-				fprintf(stderr, "Error receiving data: %d\n", error);
-			}
+	RegisterServerSocket(my_socket);
+#if !defined(_WIN32) && !defined(WIN32)
+	StartStopThread();
 #else
-			perror("Error receiving data");
+	signal(SIGINT, signalHandler);
+	signal(SIGTERM, signalHandler);
 #endif
-			continue;
-		}
-		
-		// Get client IP address
-		if (inet_ntop(AF_INET, &clientAddr.sin_addr, clientIP, INET_ADDRSTRLEN) == NULL) {
-			strcpy(clientIP, "unknown");
-		}
-		
-		// Get client hostname (reverse DNS lookup)
-		if (GetHostnameFromAddress(&clientAddr, clientHostname, NI_MAXHOST) != 0) {
-			strncpy(clientHostname, clientIP, NI_MAXHOST - 1);
-			clientHostname[NI_MAXHOST - 1] = '\0';
-		}
-		
-		// Deserialize request
-		memset(&req, 0, sizeof(req));
-		if (DeserializeRequest(buffer, bytesReceived, &req) != 0) {
-			// Invalid request format, send error response
-			resp.status = 2;
-			resp.type = '?';
-			resp.value = 0.0f;
-		} else {
-			// Validate request type
-			if (!ValidateRequestType(req.type)) {
-				resp.status = 2;
-				resp.type = req.type;
-				resp.value = 0.0f;
-			} else if (!ValidateCity(req.city)) {
-				// City not found or invalid characters
-				if (HasInvalidCharacters(req.city)) {
-					resp.status = 2;
-				} else {
-					resp.status = 1;
-				}
-				resp.type = req.type;
-				resp.value = 0.0f;
-			} else {
-				// Valid request, generate weather data
-				resp.status = 0;
-				resp.type = req.type;
-				
-				switch (req.type) {
-					case 't':
-						resp.value = GetTemperature();
-						break;
-					case 'h':
-						resp.value = GetHumidity();
-						break;
-					case 'w':
-						resp.value = GetWind();
-						break;
-					case 'p':
-						resp.value = GetPressure();
-						break;
-					default:
-						resp.status = 2;
-						resp.value = 0.0f;
-						break;
-				}
-			}
+
+	// Pipeline mode: this thread receives, -P workers process, one thread sends
+	if (config.pipelineWorkers > 0) {
+		printf("Server listening on port %d (pipeline, %d workers)\n", config.port, config.pipelineWorkers);
+		fflush(stdout);
+		if (RunPipeline(my_socket, config.pipelineWorkers, config.batchSize) != 0) {
+			// Do not serve with another model than the one asked for
+			fprintf(stderr, "Pipeline could not start\n");
+			StopServices();
+			closesocket(my_socket);
+			clearwinsock();
+			return 1;
 		}
+	} else {
+		printf("Server listening on port %d\n", config.port);
 		
-		// Log request
-		printf("Richiesta ricevuta da %s (ip %s): type='%c', city='%s'\n",
-		       clientHostname, clientIP, req.type, req.city);
-		
-		// Serialize and send response
-		int respSize = SerializeResponse(&resp, buffer, BUFFER_SIZE);
-		if (respSize > 0) {
-			bytesSent = sendto(my_socket, buffer, respSize, 0,
-			                   (struct sockaddr *)&clientAddr, clientAddrLen);
-			if (bytesSent < 0) {
-#if defined(_WIN32) || defined(WIN32)
-				fprintf(stderr, "Error sending response: %d\n", WSAGetLastError());
-#else
-				perror("Error sending response");
-#endif
-			}
-		}
+		// UDP datagram reception loop
+		RunServerLoop(my_socket, config.batchSize, config.useUring);
 	}
 
+	// Stopped by a termination signal: the log is drained before the last line
+	StopServices();
 	printf("Server terminated.\n");
 
+#if !defined(_WIN32) && !defined(WIN32)
+	// On Windows the console handler has closed it already
 	closesocket(my_socket);
+#endif
 	clearwinsock();
 	return 0;
 } // main end
@@ -0,0 +1,395 @@
+/*
+ * metrics.c
+ *
+ * Per-thread counters, summed and formatted off the request path.
+ * SIGUSR1 is blocked in every thread and taken by a sigwait thread, so
+ * request loops are never interrupted by a dump. Windows has neither
+ * SIGUSR1 nor the stats thread, so the metrics are not reported there.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#define closesocket close
+#endif
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+#include "weather.h"
+#include "async_log.h"
+#include "dns_cache.h"
+#include "catalog.h"
+#include "rx_drops.h"
+#include "profile.h"
+#include "thread_slot.h"
+
+static const char g_typeLabels[METRICS_TYPES][8] = { "t", "h", "w", "p", "invalid" };
+
+static struct worker_metrics g_slots[METRICS_SLOTS];
+static atomic_int g_slotCount;
+static _Thread_local struct worker_metrics *t_metrics;
+static _Thread_local int t_shared;        // t_metrics è l'ultimo blocco, condiviso
+#if !defined(_WIN32) && !defined(WIN32)
+static int g_statsSocket = -1;
+#endif
+
+static void MetricAdd(atomic_uint_fast64_t *c, uint64_t n) {
+	ThreadSlotAdd(c, n, t_shared);
+}
+
+// Counters of the calling thread, claimed on first use
+static struct worker_metrics *ThreadMetrics(void) {
+	if (t_metrics == NULL) {
+		t_metrics = &g_slots[ThreadSlotClaim(&g_slotCount, METRICS_SLOTS, &t_shared)];
+	}
+	return t_metrics;
+}
+
+static int TypeIndex(char type) {
+	switch (type) {
+		case 't':
+			return 0;
+		case 'h':
+			return 1;
+		case 'w':
+			return 2;
+		case 'p':
+			return 3;
+		default:
+			return 4;
+	}
+}
+
+static int LatencyBucket(uint64_t ns) {
+	if (ns < 128) {
+		return 0;
+	}
+#if defined(__GNUC__)
+	int bucket = 63 - __builtin_clzll(ns) - 6;
+#else
+	int bucket = 0;
+	for (uint64_t limit = 128; ns >= limit && bucket <= METRICS_LATENCY_BUCKETS; limit <<= 1) {
+		bucket++;
+	}
+#endif
+	return bucket < METRICS_LATENCY_BUCKETS ? bucket : METRICS_LATENCY_BUCKETS;
+}
+
+uint64_t MetricsNowNs(void) {
+	struct timespec ts;
+#if defined(_WIN32) || defined(WIN32)
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void MetricsRecordReply(const struct reply *reply, int bytesIn, int bytesOut, uint64_t serviceNs) {
+	struct worker_metrics *m = ThreadMetrics();
+
+	if (reply->duplicateLength > 0) {
+		MetricAdd(&m->idRequests, 1);
+		MetricAdd(&m->duplicates, 1);
+	} else if (reply->isCatalogPage) {
+		MetricAdd(&m->catalogPages, 1);
+	} else {
+		if (reply->hasRequestId) {
+			MetricAdd(&m->idRequests, 1);
+		}
+		for (int i = 0; i < reply->data.count; i++) {
+			const struct response *r = &reply->data.results[i];
+			MetricAdd(&m->requests[TypeIndex(r->type)][r->status < METRICS_STATUSES ? r->status : 2], 1);
+		}
+	}
+	MetricAdd(&m->datagrams, 1);
+	MetricAdd(&m->bytesIn, (uint64_t)bytesIn);
+	MetricAdd(&m->bytesOut, (uint64_t)(bytesOut > 0 ? bytesOut : 0));
+	MetricAdd(&m->latency[LatencyBucket(serviceNs)], 1);
+	MetricAdd(&m->latencySumNs, serviceNs);
+}
+
+void MetricsRecordRecvError(void) {
+	MetricAdd(&ThreadMetrics()->recvErrors, 1);
+}
+
+void MetricsRecordSendErrors(int count) {
+	MetricAdd(&ThreadMetrics()->sendErrors, (uint64_t)count);
+}
+
+void MetricsRecordRateLimited(void) {
+	MetricAdd(&ThreadMetrics()->rateLimited, 1);
+}
+
+void MetricsRecordIngressDrops(int count) {
+	MetricAdd(&ThreadMetrics()->ingressDrops, (uint64_t)count);
+}
+
+void MetricsRecordKernelDrops(uint32_t count) {
+	MetricAdd(&ThreadMetrics()->kernelDrops, count);
+}
+
+void MetricsRecordQueueDelay(uint64_t delayNs) {
+	struct worker_metrics *m = ThreadMetrics();
+	MetricAdd(&m->queueDelay[LatencyBucket(delayNs)], 1);
+	MetricAdd(&m->queueDelaySumNs, delayNs);
+}
+
+static uint64_t Load(const atomic_uint_fast64_t *c) {
+	return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+// snprintf into out at *len, keeping *len within size
+static void Append(char *out, int size, int *len, const char *format, ...) {
+	va_list args;
+	if (*len >= size - 1) {
+		return;
+	}
+	va_start(args, format);
+	int n = vsnprintf(out + *len, (size_t)(size - *len), format, args);
+	va_end(args);
+	if (n > 0) {
+		*len = (*len + n < size - 1) ? *len + n : size - 1;
+	}
+}
+
+static void AppendCounter(char *out, int size, int *len, const char *name, const char *help, uint64_t value) {
+	Append(out, size, len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n", name, help, name, name,
+	       (unsigned long long)value);
+}
+
+// Latency histogram with cumulative buckets, bounds in seconds
+static void AppendHistogram(char *out, int size, int *len, const char *name, const char *help,
+                            const atomic_uint_fast64_t *buckets, uint64_t sumNs) {
+	Append(out, size, len, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	uint64_t cumulative = 0;
+	for (int b = 0; b < METRICS_LATENCY_BUCKETS; b++) {
+		cumulative += Load(&buckets[b]);
+		Append(out, size, len, "%s_bucket{le=\"%g\"} %llu\n", name, (double)(128ull << b) / 1e9,
+		       (unsigned long long)cumulative);
+	}
+	cumulative += Load(&buckets[METRICS_LATENCY_BUCKETS]);
+	Append(out, size, len, "%s_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)cumulative);
+	Append(out, size, len, "%s_sum %.9f\n%s_count %llu\n", name, (double)sumNs / 1e9, name,
+	       (unsigned long long)cumulative);
+}
+
+int MetricsFormat(char *out, int size) {
+	struct worker_metrics sum;
+	int slots = atomic_load_explicit(&g_slotCount, memory_order_relaxed);
+	int len = 0;
+
+	if (slots > METRICS_SLOTS) {
+		slots = METRICS_SLOTS;
+	}
+	memset(&sum, 0, sizeof(sum));
+	for (int s = 0; s < slots; s++) {
+		const struct worker_metrics *m = &g_slots[s];
+		for (int t = 0; t < METRICS_TYPES; t++) {
+			for (int st = 0; st < METRICS_STATUSES; st++) {
+				sum.requests[t][st] += Load(&m->requests[t][st]);
+			}
+		}
+		sum.datagrams += Load(&m->datagrams);
+		sum.catalogPages += Load(&m->catalogPages);
+		sum.idRequests += Load(&m->idRequests);
+		sum.duplicates += Load(&m->duplicates);
+		sum.bytesIn += Load(&m->bytesIn);
+		sum.bytesOut += Load(&m->bytesOut);
+		sum.recvErrors += Load(&m->recvErrors);
+		sum.sendErrors += Load(&m->sendErrors);
+		sum.rateLimited += Load(&m->rateLimited);
+		sum.ingressDrops += Load(&m->ingressDrops);
+		sum.kernelDrops += Load(&m->kernelDrops);
+		for (int b = 0; b <= METRICS_LATENCY_BUCKETS; b++) {
+			sum.latency[b] += Load(&m->latency[b]);
+		}
+		sum.latencySumNs += Load(&m->latencySumNs);
+		for (int b = 0; b <= METRICS_LATENCY_BUCKETS; b++) {
+			sum.queueDelay[b] += Load(&m->queueDelay[b]);
+		}
+		sum.queueDelaySumNs += Load(&m->queueDelaySumNs);
+	}
+
+	Append(out, size, &len, "# HELP weather_requests_total Queries answered, by requested type and status.\n"
+	       "# TYPE weather_requests_total counter\n");
+	for (int t = 0; t < METRICS_TYPES; t++) {
+		for (int st = 0; st < METRICS_STATUSES; st++) {
+			Append(out, size, &len, "weather_requests_total{type=\"%s\",status=\"%d\"} %llu\n", g_typeLabels[t], st,
+			       (unsigned long long)sum.requests[t][st]);
+		}
+	}
+	AppendCounter(out, size, &len, "weather_datagrams_total", "Request datagrams answered.", sum.datagrams);
+	AppendCounter(out, size, &len, "weather_received_bytes_total", "Bytes of request datagrams.", sum.bytesIn);
+	AppendCounter(out, size, &len, "weather_sent_bytes_total", "Bytes of response datagrams.", sum.bytesOut);
+	AppendCounter(out, size, &len, "weather_receive_errors_total", "Failed receive calls.", sum.recvErrors);
+	AppendCounter(out, size, &len, "weather_send_errors_total", "Responses that could not be sent.", sum.sendErrors);
+	AppendCounter(out, size, &len, "weather_rate_limited_total", "Datagrams dropped by the per-client rate limit.",
+	              sum.rateLimited);
+	AppendCounter(out, size, &len, "weather_ingress_drops_total", "Datagrams dropped by the pipeline on full queues.",
+	              sum.ingressDrops);
+	AppendCounter(out, size, &len, "weather_kernel_drops_total",
+	              "Datagrams dropped by the kernel on a full receive buffer (SO_RXQ_OVFL).", sum.kernelDrops);
+
+	struct rx_drops_stats rx;
+	RxDropsGetStats(&rx);
+	Append(out, size, &len, "# HELP weather_receive_buffer_bytes Largest socket receive buffer, as reported by the kernel.\n"
+	       "# TYPE weather_receive_buffer_bytes gauge\nweather_receive_buffer_bytes %d\n", rx.receiveBuffer);
+	AppendCounter(out, size, &len, "weather_receive_buffer_grows_total", "Receive buffers grown after sustained drops.",
+	              rx.grows);
+
+	// Queueing in the socket, then processing: together the time since the kernel had the datagram
+	AppendHistogram(out, size, &len, "weather_queue_delay_seconds",
+	                "Time from the kernel receive timestamp to reception by the server.", sum.queueDelay,
+	                Load(&sum.queueDelaySumNs));
+	AppendHistogram(out, size, &len, "weather_service_seconds", "Time from reception to encoded response.",
+	                sum.latency, Load(&sum.latencySumNs));
+
+	// Per-thread totals show how SO_REUSEPORT spreads the load
+	Append(out, size, &len, "# HELP weather_thread_datagrams_total Request datagrams answered by each thread.\n"
+	       "# TYPE weather_thread_datagrams_total counter\n");
+	for (int s = 0; s < slots; s++) {
+		Append(out, size, &len, "weather_thread_datagrams_total{thread=\"%d\"} %llu\n", s,
+		       (unsigned long long)Load(&g_slots[s].datagrams));
+	}
+
+	struct weather_cache_stats cache;
+	struct async_log_stats log;
+	struct dns_cache_stats dns;
+	WeatherGetCacheStats(&cache);
+	AsyncLogGetStats(&log);
+	DnsCacheGetStats(&dns);
+	AppendCounter(out, size, &len, "weather_response_cache_hits_total",
+	              "Responses copied already encoded from the weather snapshot.", cache.hits);
+	AppendCounter(out, size, &len, "weather_response_cache_misses_total",
+	              "Responses not taken from the snapshot (errors such as unknown cities, or before the first one).",
+	              cache.misses);
+	AppendCounter(out, size, &len, "weather_response_cache_encoded_total", "Responses encoded by the tick thread.",
+	              cache.encoded);
+	AppendCounter(out, size, &len, "weather_log_dropped_total", "Log records dropped on a full ring.", log.dropped);
+	AppendCounter(out, size, &len, "weather_dns_cache_hits_total", "Reverse DNS cache hits.",
+	              dns.hits + dns.negativeHits);
+	AppendCounter(out, size, &len, "weather_dns_cache_misses_total", "Reverse DNS cache misses.", dns.misses);
+	AppendCounter(out, size, &len, "weather_dedup_requests_total", "Requests answered that carried a request ID.",
+	              sum.idRequests);
+	AppendCounter(out, size, &len, "weather_dedup_duplicates_total", "Retransmissions answered with the stored reply.",
+	              sum.duplicates);
+	Append(out, size, &len, "# HELP weather_dedup_hit_ratio Share of requests with an ID that were duplicates.\n"
+	       "# TYPE weather_dedup_hit_ratio gauge\nweather_dedup_hit_ratio %g\n",
+	       sum.idRequests ? (double)sum.duplicates / (double)sum.idRequests : 0.0);
+
+	struct catalog_stats catalog;
+	CatalogGetStats(&catalog);
+	Append(out, size, &len, "# HELP weather_catalog_cities Cities in the catalog in use.\n"
+	       "# TYPE weather_catalog_cities gauge\nweather_catalog_cities %d\n", catalog.cities);
+	AppendCounter(out, size, &len, "weather_catalog_pages_total", "Catalog pages sent for compact requests.",
+	              sum.catalogPages);
+	AppendCounter(out, size, &len, "weather_catalog_reloads_total", "City catalogs swapped in on SIGHUP.",
+	              catalog.reloads);
+	AppendCounter(out, size, &len, "weather_catalog_failed_reloads_total", "City catalog reloads refused.",
+	              catalog.failedReloads);
+	return len;
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Signal thread: dump the metrics to stderr on every SIGUSR1
+static void *SignalMain(void *arg) {
+	static char text[METRICS_TEXT_MAX];
+	sigset_t set;
+	int sig;
+	(void)arg;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	while (sigwait(&set, &sig) == 0) {
+		int len = MetricsFormat(text, sizeof(text));
+		fwrite(text, 1, (size_t)len, stderr);
+		fflush(stderr);
+		PROFILE_REPORT();
+	}
+	return NULL;
+}
+
+// Stats thread: any datagram on the stats port gets the metrics back
+static void *StatsMain(void *arg) {
+	static char text[METRICS_TEXT_MAX];
+	char request[64];
+	struct sockaddr_in from;
+	(void)arg;
+
+	while (1) {
+		socklen_t fromLen = sizeof(from);
+		if (recvfrom(g_statsSocket, request, sizeof(request), 0, (struct sockaddr *)&from, &fromLen) < 0) {
+			continue;
+		}
+		int len = MetricsFormat(text, sizeof(text));
+		sendto(g_statsSocket, text, len, 0, (struct sockaddr *)&from, fromLen);
+	}
+	return NULL;
+}
+
+int MetricsStart(int statsPort) {
+	pthread_t thread;
+	int err;
+
+	// Inherited by every thread created from now on
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+	err = pthread_create(&thread, NULL, SignalMain, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error starting metrics signal thread: %s\n", strerror(err));
+		return -1;
+	}
+	pthread_detach(thread);
+
+	if (statsPort <= 0) {
+		return 0;
+	}
+
+	// Local only: the metrics are not meant for clients
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((unsigned short)statsPort);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	g_statsSocket = CreateUDPSocket();
+	if (g_statsSocket < 0) {
+		return -1;
+	}
+	if (bind(g_statsSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror("Error binding stats socket");
+		closesocket(g_statsSocket);
+		g_statsSocket = -1;
+		return -1;
+	}
+
+	err = pthread_create(&thread, NULL, StatsMain, NULL);
+	if (err != 0) {
+		fprintf(stderr, "Error starting stats thread: %s\n", strerror(err));
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
+#else
+int MetricsStart(int statsPort) {
+	if (statsPort > 0) {
+		fprintf(stderr, "The stats port is not supported on this platform\n");
+	}
+	return 0;
+}
+#endif
@@ -0,0 +1,86 @@
+/*
+ * metrics.h
+ *
+ * Server metrics
+ * Every request thread owns one block of counters and is its only writer,
+ * so recording is a plain load, add and store (thread_slot.h).
+ * Blocks are summed only when the metrics are read, in Prometheus text
+ * format, from the stats port (-m) or with SIGUSR1 (dumped to stderr)
+ */
+
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include "protocol.h"
+
+/*
+ * ============================================================================
+ * METRICS CONSTANTS
+ * ============================================================================
+ */
+
+#define METRICS_TYPES 5                // 't', 'h', 'w', 'p', altro
+#define METRICS_STATUSES 4              // 0-2 e STATUS_STALE_CATALOG
+#define METRICS_LATENCY_BUCKETS 24     // limite del bucket i: 2^(i+7) ns, da 128 ns a ~1 s
+#define METRICS_SLOTS (SERVER_MAX_WORKERS + 1)
+#define METRICS_TEXT_MAX 16384         // testo restituito dalla porta delle statistiche
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Counters of one request thread (one writer, read by the metrics threads)
+struct worker_metrics {
+    _Alignas(64) atomic_uint_fast64_t requests[METRICS_TYPES][METRICS_STATUSES];
+    atomic_uint_fast64_t datagrams;     // datagrammi a cui è stata preparata una risposta
+    atomic_uint_fast64_t catalogPages;  // di cui pagine del catalogo
+    atomic_uint_fast64_t idRequests;    // di cui richieste con ID (dedup.h)
+    atomic_uint_fast64_t duplicates;    // di cui ritrasmissioni con la risposta memorizzata
+    atomic_uint_fast64_t bytesIn;
+    atomic_uint_fast64_t bytesOut;
+    atomic_uint_fast64_t recvErrors;
+    atomic_uint_fast64_t sendErrors;
+    atomic_uint_fast64_t rateLimited;   // datagrammi scartati dal limite per client
+    atomic_uint_fast64_t ingressDrops;  // datagrammi scartati dalla pipeline (code piene)
+    atomic_uint_fast64_t kernelDrops;   // datagrammi scartati dal kernel (SO_RXQ_OVFL, rx_drops.h)
+    atomic_uint_fast64_t latency[METRICS_LATENCY_BUCKETS + 1];   // ultimo = oltre l'ultimo limite
+    atomic_uint_fast64_t latencySumNs;
+    atomic_uint_fast64_t queueDelay[METRICS_LATENCY_BUCKETS + 1];   // attesa nella coda del socket (rx_timestamp.h)
+    atomic_uint_fast64_t queueDelaySumNs;
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Start the metrics threads (POSIX only): SIGUSR1 dumps and, with statsPort > 0,
+// a UDP stats port on 127.0.0.1 that answers any datagram with the metrics.
+// Call before starting other threads, so that they all leave SIGUSR1 blocked.
+int MetricsStart(int statsPort);
+
+// Monotonic clock for service times
+uint64_t MetricsNowNs(void);
+
+// Count one answered datagram: its queries (or catalog page, or duplicate), sizes and service time
+void MetricsRecordReply(const struct reply *reply, int bytesIn, int bytesOut, uint64_t serviceNs);
+
+void MetricsRecordRecvError(void);
+void MetricsRecordSendErrors(int count);
+void MetricsRecordRateLimited(void);
+void MetricsRecordIngressDrops(int count);
+void MetricsRecordKernelDrops(uint32_t count);
+
+// Count the time a datagram waited in the socket queue (kernel timestamp to reception)
+void MetricsRecordQueueDelay(uint64_t delayNs);
+
+// Write the summed metrics to out; returns the length written
+int MetricsFormat(char *out, int size);
+
+
+#endif /* METRICS_H_ */
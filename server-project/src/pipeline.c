@@ -0,0 +1,435 @@
+/*
+ * pipeline.c
+ *
+ * Receiver -> workers -> sender over SPSC rings.
+ * Every slot index travels receiver -> worker ring -> sender ring ->
+ * free ring -> receiver, and each ring has exactly one producer and one
+ * consumer. Idle stages spin briefly, then yield, then sleep with
+ * exponential backoff (as the log writer does), so an idle server
+ * costs little CPU.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#endif
+
+#include <stdio.h>
+#include "pipeline.h"
+
+#if defined(__linux__)
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include "metrics.h"
+#include "rx_drops.h"
+#include "rx_timestamp.h"
+#include "profile.h"
+
+// Bounded ring of slot indices; head and tail on their own cache lines,
+// each side keeping a cached copy of the other's position
+struct spsc_ring {
+	_Alignas(64) atomic_uint head;     // consumer
+	unsigned cachedTail;
+	_Alignas(64) atomic_uint tail;     // producer
+	unsigned cachedHead;
+	_Alignas(64) unsigned mask;
+	uint32_t *items;
+};
+
+struct pipeline {
+	int sock;
+	int workers;
+	int batchSize;
+	struct pipe_slot *slots;
+	struct spsc_ring freeRing;         // sender -> receiver
+	struct spsc_ring *toWorker;        // receiver -> worker i
+	struct spsc_ring *toSender;        // worker i -> sender
+	struct mmsghdr *sendMsgs;          // buffers of the sender, batchSize each
+	struct iovec *sendIov;
+	uint32_t *sendIds;
+	atomic_int stop;                   // 1: idle workers exit, 2: idle sender exits
+};
+
+// Argument of one worker thread
+struct pipe_worker {
+	struct pipeline *pipe;
+	int id;
+	pthread_t thread;
+};
+
+static int RingInit(struct spsc_ring *ring, unsigned size) {
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->cachedTail = 0;
+	ring->cachedHead = 0;
+	ring->mask = size - 1;
+	ring->items = calloc(size, sizeof(uint32_t));
+	return (ring->items != NULL) ? 0 : -1;
+}
+
+static int RingPush(struct spsc_ring *ring, uint32_t item) {
+	unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	if (tail - ring->cachedHead > ring->mask) {
+		ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+		if (tail - ring->cachedHead > ring->mask) {
+			return 0;
+		}
+	}
+	ring->items[tail & ring->mask] = item;
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return 1;
+}
+
+static int RingPop(struct spsc_ring *ring, uint32_t *item) {
+	unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	if (head == ring->cachedTail) {
+		ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+		if (head == ring->cachedTail) {
+			return 0;
+		}
+	}
+	*item = ring->items[head & ring->mask];
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return 1;
+}
+
+// Wait a little longer each time a stage finds nothing to do (up to 100 us)
+static void Backoff(int *idle) {
+	if (*idle < 64) {
+		(*idle)++;
+		return;
+	}
+	if (*idle < 80) {
+		(*idle)++;
+		sched_yield();
+		return;
+	}
+	long ns = 1000L << (*idle - 80 < 7 ? *idle - 80 : 7);
+	struct timespec ts = { 0, ns < 100000L ? ns : 100000L };
+	nanosleep(&ts, NULL);
+	(*idle)++;
+}
+
+// Worker: validate, log and encode, then hand the slot to the sender
+static void *PipeWorkerMain(void *arg) {
+	struct pipe_worker *w = arg;
+	struct pipeline *pipe = w->pipe;
+	struct reply reply;
+	int idle = 0;
+	uint32_t id;
+
+	while (1) {
+		if (!RingPop(&pipe->toWorker[w->id], &id)) {
+			if (atomic_load_explicit(&pipe->stop, memory_order_relaxed)) {
+				break;
+			}
+			Backoff(&idle);
+			continue;
+		}
+		idle = 0;
+
+		struct pipe_slot *slot = &pipe->slots[id];
+		slot->respLength = 0;
+		if (ProcessRequest(slot->rx, slot->length, &slot->addr, &reply) > 0) {
+			slot->respLength = SerializeReply(&reply, slot->tx, BUFFER_SIZE);
+			MetricsRecordReply(&reply, slot->length, slot->respLength, MetricsNowNs() - slot->receivedNs);
+		}
+
+		// The sender ring is as large as the worker ring: this only waits while the sender catches up
+		int wait = 0;
+		while (!RingPush(&pipe->toSender[w->id], id)) {
+			Backoff(&wait);
+		}
+	}
+	return NULL;
+}
+
+// Sender: gather replies from every worker, one sendmmsg per round, then recycle the slots
+static void *PipeSenderMain(void *arg) {
+	struct pipeline *pipe = arg;
+	struct mmsghdr *msgs = pipe->sendMsgs;
+	struct iovec *iov = pipe->sendIov;
+	uint32_t *ids = pipe->sendIds;
+	int idle = 0;
+	int next = 0;
+
+	while (1) {
+		int count = 0;
+		int pending = 0;
+		uint32_t id;
+
+		// Round robin over the workers, starting after the last one served
+		for (int k = 0; k < pipe->workers && count < pipe->batchSize; k++) {
+			int w = (next + k) % pipe->workers;
+			while (count < pipe->batchSize && RingPop(&pipe->toSender[w], &id)) {
+				ids[count++] = id;
+			}
+		}
+		next = (next + 1) % pipe->workers;
+		if (count == 0) {
+			if (atomic_load_explicit(&pipe->stop, memory_order_acquire) >= 2) {
+				break;
+			}
+			Backoff(&idle);
+			continue;
+		}
+		idle = 0;
+
+		for (int i = 0; i < count; i++) {
+			struct pipe_slot *slot = &pipe->slots[ids[i]];
+			if (slot->respLength <= 0) {
+				continue; // rate limited
+			}
+			iov[pending].iov_base = slot->tx;
+			iov[pending].iov_len = (size_t)slot->respLength;
+			memset(&msgs[pending].msg_hdr, 0, sizeof(msgs[pending].msg_hdr));
+			msgs[pending].msg_hdr.msg_name = &slot->addr;
+			msgs[pending].msg_hdr.msg_namelen = slot->addrLen;
+			msgs[pending].msg_hdr.msg_iov = &iov[pending];
+			msgs[pending].msg_hdr.msg_iovlen = 1;
+			pending++;
+		}
+
+		PROFILE_MARK();
+		int sent = 0;
+		while (sent < pending) {
+			int n = sendmmsg(pipe->sock, msgs + sent, pending - sent, 0);
+			if (n < 0) {
+				MetricsRecordSendErrors(1);
+				perror("Error sending response");
+				sent++;
+				continue;
+			}
+			sent += n;
+		}
+		PROFILE_LAP(PROFILE_SEND);
+
+		// The free ring holds every slot, so this never fails
+		for (int i = 0; i < count; i++) {
+			RingPush(&pipe->freeRing, ids[i]);
+		}
+	}
+	return NULL;
+}
+
+// Worker for the datagram in slot, by source address and port: one client socket is
+// always served by the same worker, so its replies leave in request order (as from
+// the other loops) and its retransmissions find that worker's reply cache (dedup.h)
+static int PickWorker(const struct pipeline *pipe, const struct pipe_slot *slot) {
+	uint32_t h = (slot->addr.sin_addr.s_addr ^ ((uint32_t)slot->addr.sin_port << 16)) * 0x9E3779B1u;
+	return (int)((h >> 16) % (uint32_t)pipe->workers);
+}
+
+// Receiver (calling thread): fill free slots with recvmmsg and deal them to the workers.
+// Returns 0 once the server stops, -1 if its buffers cannot be allocated.
+static int RunReceiver(struct pipeline *pipe) {
+	struct mmsghdr *msgs = calloc((size_t)pipe->batchSize, sizeof(struct mmsghdr));
+	struct iovec *iov = calloc((size_t)pipe->batchSize, sizeof(struct iovec));
+	uint32_t *held = calloc((size_t)pipe->batchSize, sizeof(uint32_t));
+	char (*control)[RX_CONTROL_SIZE] = calloc((size_t)pipe->batchSize, RX_CONTROL_SIZE);
+	char scratch[BUFFER_SIZE];
+	int heldCount = 0;
+
+	if (msgs == NULL || iov == NULL || held == NULL || control == NULL) {
+		fprintf(stderr, "Error allocating receiver buffers\n");
+		free(msgs);
+		free(iov);
+		free(held);
+		free(control);
+		return -1;
+	}
+
+	while (1) {
+		while (heldCount < pipe->batchSize && RingPop(&pipe->freeRing, &held[heldCount])) {
+			heldCount++;
+		}
+
+		// Every slot in flight: read and drop, so the socket buffer does not back up behind us
+		if (heldCount == 0) {
+			int length = (int)recv(pipe->sock, scratch, sizeof(scratch), 0);
+			if (ServerStopping()) {
+				break;
+			}
+			if (length >= 0) {
+				MetricsRecordIngressDrops(1);
+			}
+			continue;
+		}
+
+		for (int i = 0; i < heldCount; i++) {
+			struct pipe_slot *slot = &pipe->slots[held[i]];
+			iov[i].iov_base = slot->rx;
+			iov[i].iov_len = BUFFER_SIZE - 1;
+			memset(&msgs[i].msg_hdr, 0, sizeof(msgs[i].msg_hdr));
+			msgs[i].msg_hdr.msg_name = &slot->addr;
+			msgs[i].msg_hdr.msg_namelen = sizeof(slot->addr);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = RX_CONTROL_SIZE;
+		}
+
+		PROFILE_MARK();
+		int received = recvmmsg(pipe->sock, msgs, heldCount, MSG_WAITFORONE, NULL);
+		PROFILE_LAP(PROFILE_RECEIVE);
+		if (ServerStopping()) {
+			break;
+		}
+		if (received < 0) {
+			MetricsRecordRecvError();
+			perror("Error receiving data");
+			continue;
+		}
+		RxDropsRecord(pipe->sock, &msgs[received - 1].msg_hdr);
+		uint64_t receivedNs = RxTimestampNow();
+		for (int i = 0; i < received; i++) {
+			RxTimestampRecord(&msgs[i].msg_hdr, receivedNs);
+		}
+		uint64_t now = MetricsNowNs();
+
+		// Slots that were not filled, or found their worker's ring full, stay held for the next round
+		int kept = 0;
+		for (int i = 0; i < heldCount; i++) {
+			uint32_t id = held[i];
+			int queued = 0;
+			if (i < received) {
+				struct pipe_slot *slot = &pipe->slots[id];
+				slot->length = (int)msgs[i].msg_len;
+				slot->addrLen = msgs[i].msg_hdr.msg_namelen;
+				slot->receivedNs = now;
+				// No other worker takes the overflow: it would answer out of order
+				queued = RingPush(&pipe->toWorker[PickWorker(pipe, slot)], id);
+				if (!queued) {
+					MetricsRecordIngressDrops(1);
+				}
+			}
+			if (!queued) {
+				held[kept++] = id;
+			}
+		}
+		heldCount = kept;
+	}
+
+	// Slots still held never reached a worker: nothing to hand back
+	free(msgs);
+	free(iov);
+	free(held);
+	free(control);
+	return 0;
+}
+
+// Release the pipeline (NULL members were never allocated)
+static void FreePipeline(struct pipeline *pipe, struct pipe_worker *threads) {
+	if (pipe != NULL) {
+		for (int i = 0; i < pipe->workers; i++) {
+			if (pipe->toWorker != NULL) {
+				free(pipe->toWorker[i].items);
+			}
+			if (pipe->toSender != NULL) {
+				free(pipe->toSender[i].items);
+			}
+		}
+		free(pipe->freeRing.items);
+		free(pipe->toWorker);
+		free(pipe->toSender);
+		free(pipe->sendMsgs);
+		free(pipe->sendIov);
+		free(pipe->sendIds);
+		free(pipe->slots);
+		free(pipe);
+	}
+	free(threads);
+}
+
+// Stop and join the threads started so far, then free. Workers go first and
+// empty their rings, so the sender still answers every datagram they took.
+static void StopPipeline(struct pipeline *pipe, struct pipe_worker *threads, int workersStarted,
+                         const pthread_t *sender) {
+	atomic_store_explicit(&pipe->stop, 1, memory_order_release);
+	for (int i = 0; i < workersStarted; i++) {
+		pthread_join(threads[i].thread, NULL);
+	}
+	atomic_store_explicit(&pipe->stop, 2, memory_order_release);
+	if (sender != NULL) {
+		pthread_join(*sender, NULL);
+	}
+	FreePipeline(pipe, threads);
+}
+
+int RunPipeline(int sock, int workers, int batchSize) {
+	struct pipeline *pipe = calloc(1, sizeof(struct pipeline));
+	struct pipe_worker *threads = calloc((size_t)workers, sizeof(struct pipe_worker));
+	if (pipe == NULL || threads == NULL) {
+		fprintf(stderr, "Error allocating pipeline\n");
+		FreePipeline(pipe, threads);
+		return -1;
+	}
+
+	pipe->sock = sock;
+	pipe->workers = workers;
+	pipe->batchSize = batchSize;
+	pipe->slots = calloc(PIPE_SLOTS, sizeof(struct pipe_slot));
+	pipe->toWorker = calloc((size_t)workers, sizeof(struct spsc_ring));
+	pipe->toSender = calloc((size_t)workers, sizeof(struct spsc_ring));
+	pipe->sendMsgs = calloc((size_t)batchSize, sizeof(struct mmsghdr));
+	pipe->sendIov = calloc((size_t)batchSize, sizeof(struct iovec));
+	pipe->sendIds = calloc((size_t)batchSize, sizeof(uint32_t));
+	atomic_init(&pipe->stop, 0);
+	if (pipe->slots == NULL || pipe->toWorker == NULL || pipe->toSender == NULL || pipe->sendMsgs == NULL ||
+	    pipe->sendIov == NULL || pipe->sendIds == NULL || RingInit(&pipe->freeRing, PIPE_SLOTS) != 0) {
+		fprintf(stderr, "Error allocating pipeline\n");
+		FreePipeline(pipe, threads);
+		return -1;
+	}
+	for (int i = 0; i < workers; i++) {
+		if (RingInit(&pipe->toWorker[i], PIPE_RING_SIZE) != 0 || RingInit(&pipe->toSender[i], PIPE_RING_SIZE) != 0) {
+			fprintf(stderr, "Error allocating pipeline\n");
+			FreePipeline(pipe, threads);
+			return -1;
+		}
+	}
+	for (uint32_t id = 0; id < PIPE_SLOTS; id++) {
+		RingPush(&pipe->freeRing, id);
+	}
+
+	pthread_t sender;
+	int err = pthread_create(&sender, NULL, PipeSenderMain, pipe);
+	if (err != 0) {
+		fprintf(stderr, "Error starting sender: %s\n", strerror(err));
+		FreePipeline(pipe, threads);
+		return -1;
+	}
+	for (int i = 0; i < workers; i++) {
+		threads[i].pipe = pipe;
+		threads[i].id = i;
+		err = pthread_create(&threads[i].thread, NULL, PipeWorkerMain, &threads[i]);
+		if (err != 0) {
+			fprintf(stderr, "Error starting pipeline worker %d: %s\n", i, strerror(err));
+			StopPipeline(pipe, threads, i, &sender);
+			return -1;
+		}
+	}
+
+	int ret = RunReceiver(pipe);
+	StopPipeline(pipe, threads, workers, &sender);
+	return ret;
+}
+
+#else
+
+int RunPipeline(int sock, int workers, int batchSize) {
+	(void)sock;
+	(void)workers;
+	(void)batchSize;
+	fprintf(stderr, "The pipeline model is not supported on this platform\n");
+	return -1;
+}
+
+#endif
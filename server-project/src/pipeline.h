@@ -0,0 +1,60 @@
+/*
+ * pipeline.h
+ *
+ * Staged server model (-P N, Linux)
+ * A receiver thread reads datagrams with recvmmsg into preallocated
+ * slots and deals them to N worker threads (DNS cache lookup, scan,
+ * logging, encoding) by client socket; one sender thread returns the
+ * replies with sendmmsg. Stages are connected by bounded single-producer/
+ * single-consumer rings of slot indices, so no stage takes a lock; when
+ * every slot or the worker's ring is full the datagram is dropped at ingress
+ */
+
+#ifndef PIPELINE_H_
+#define PIPELINE_H_
+
+#include "protocol.h"
+#include "request_scan.h"
+
+/*
+ * ============================================================================
+ * PIPELINE CONSTANTS
+ * ============================================================================
+ */
+
+#define PIPE_SLOTS 4096          // datagrammi in lavorazione (potenza di 2)
+#define PIPE_RING_SIZE 1024      // slot in coda verso ogni worker (potenza di 2)
+#define PIPE_DEFAULT_BATCH 32    // datagrammi per recvmmsg/sendmmsg con -P senza -b
+#define PIPE_RX_SIZE (BUFFER_SIZE + SCAN_MIN_BUFFER)
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// One datagram moving through the stages, with its reply
+struct pipe_slot {
+    struct sockaddr_in addr;
+    unsigned int addrLen;
+    int length;                  // byte del datagramma ricevuto
+    int respLength;              // byte della risposta, 0 = nessuna risposta
+    uint64_t receivedNs;         // per il tempo di servizio
+    char rx[PIPE_RX_SIZE];       // con il margine letto dallo scanner
+    char tx[BUFFER_SIZE];
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Run the pipeline on sock with workers validator threads; the calling
+// thread becomes the receiver. Returns 0 once the server stops
+// (ServerStopping), -1 if it cannot start, after stopping the threads
+// it started.
+int RunPipeline(int sock, int workers, int batchSize);
+
+
+#endif /* PIPELINE_H_ */
@@ -0,0 +1,173 @@
+/*
+ * profile.c
+ *
+ * Stage histograms with PROFILE_SUB_BUCKETS buckets per power of two of
+ * the tick count: small enough for one block per thread, fine enough
+ * for a p99. Ticks become nanoseconds only in the report, with the TSC
+ * rate measured against the monotonic clock since ProfileStart.
+ */
+
+#include "profile.h"
+
+#if defined(SERVER_PROFILE)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "thread_slot.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TSC 1
+#endif
+
+// Samples of one thread (one writer, read by the report)
+struct profile_block {
+    _Alignas(64) atomic_uint_fast64_t counts[PROFILE_STAGES][PROFILE_BUCKETS];
+    atomic_uint_fast64_t ticks[PROFILE_STAGES];
+};
+
+static struct profile_block g_blocks[PROFILE_SLOTS];
+static atomic_int g_blockCount;
+static _Thread_local struct profile_block *t_block;
+static _Thread_local int t_shared;        // t_block è l'ultimo blocco, condiviso
+static _Thread_local uint64_t t_mark;
+static uint64_t g_startTicks;
+static uint64_t g_startNs;
+
+static const char *g_stageNames[PROFILE_STAGES] = {
+	"receive", "admit", "dns", "scan", "log", "encode", "send"
+};
+
+static uint64_t ClockNs(void) {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#elif defined(_WIN32) || defined(WIN32)
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t Now(void) {
+#if defined(PROFILE_TSC)
+	return __rdtsc();
+#else
+	return ClockNs();
+#endif
+}
+
+// Block of the calling thread, claimed on first use
+static struct profile_block *ThreadBlock(void) {
+	if (t_block == NULL) {
+		t_block = &g_blocks[ThreadSlotClaim(&g_blockCount, PROFILE_SLOTS, &t_shared)];
+	}
+	return t_block;
+}
+
+static int Bucket(uint64_t ticks) {
+	if (ticks < PROFILE_SUB_BUCKETS) {
+		return (int)ticks;
+	}
+#if defined(__GNUC__)
+	int msb = 63 - __builtin_clzll(ticks);
+#else
+	int msb = 2;
+	while ((ticks >> (msb + 1)) != 0) {
+		msb++;
+	}
+#endif
+	return (msb - 1) * PROFILE_SUB_BUCKETS + (int)((ticks >> (msb - 2)) & (PROFILE_SUB_BUCKETS - 1));
+}
+
+// First tick count past bucket b
+static double BucketLimit(int b) {
+	if (b < PROFILE_SUB_BUCKETS) {
+		return (double)(b + 1);
+	}
+	int msb = b / PROFILE_SUB_BUCKETS + 1;
+	int sub = b % PROFILE_SUB_BUCKETS;
+	return (double)(PROFILE_SUB_BUCKETS + sub + 1) * (double)(1ull << (msb - 2));
+}
+
+void ProfileMark(void) {
+	t_mark = Now();
+}
+
+void ProfileLap(int stage) {
+	uint64_t now = Now();
+	uint64_t ticks = now - t_mark;
+	struct profile_block *b = ThreadBlock();
+
+	ThreadSlotAdd(&b->counts[stage][Bucket(ticks)], 1, t_shared);
+	ThreadSlotAdd(&b->ticks[stage], ticks, t_shared);
+	t_mark = now;
+}
+
+void ProfileReport(void) {
+	static uint64_t counts[PROFILE_STAGES][PROFILE_BUCKETS];
+	uint64_t samples[PROFILE_STAGES] = { 0 };
+	uint64_t ticks[PROFILE_STAGES] = { 0 };
+	uint64_t totalTicks = 0;
+	int blocks = atomic_load_explicit(&g_blockCount, memory_order_relaxed);
+
+	if (blocks > PROFILE_SLOTS) {
+		blocks = PROFILE_SLOTS;
+	}
+	for (int s = 0; s < PROFILE_STAGES; s++) {
+		for (int k = 0; k < PROFILE_BUCKETS; k++) {
+			counts[s][k] = 0;
+			for (int t = 0; t < blocks; t++) {
+				counts[s][k] += atomic_load_explicit(&g_blocks[t].counts[s][k], memory_order_relaxed);
+			}
+			samples[s] += counts[s][k];
+		}
+		for (int t = 0; t < blocks; t++) {
+			ticks[s] += atomic_load_explicit(&g_blocks[t].ticks[s], memory_order_relaxed);
+		}
+		totalTicks += ticks[s];
+	}
+
+	// Ticks per nanosecond over the whole run
+	double perNs = 1.0;
+#if defined(PROFILE_TSC)
+	uint64_t elapsedNs = ClockNs() - g_startNs;
+	if (elapsedNs > 1000000) {
+		perNs = (double)(Now() - g_startTicks) / (double)elapsedNs;
+	}
+#endif
+
+	fprintf(stderr, "Request profile (%d threads, %.3f ticks/ns; receive includes waiting for datagrams)\n",
+	        blocks, perNs);
+	fprintf(stderr, "%-8s %12s %12s %12s %8s\n", "stage", "samples", "mean ns", "p99 ns", "share");
+	for (int s = 0; s < PROFILE_STAGES; s++) {
+		double p99 = 0.0;
+		uint64_t seen = 0;
+		for (int k = 0; k < PROFILE_BUCKETS && samples[s] > 0; k++) {
+			seen += counts[s][k];
+			if (seen * 100 >= samples[s] * 99) {
+				p99 = BucketLimit(k) / perNs;
+				break;
+			}
+		}
+		fprintf(stderr, "%-8s %12llu %12.1f %12.1f %7.1f%%\n", g_stageNames[s], (unsigned long long)samples[s],
+		        samples[s] ? (double)ticks[s] / perNs / (double)samples[s] : 0.0, p99,
+		        totalTicks ? 100.0 * (double)ticks[s] / (double)totalTicks : 0.0);
+	}
+	fflush(stderr);
+}
+
+void ProfileStart(void) {
+	g_startNs = ClockNs();
+	g_startTicks = Now();
+	atexit(ProfileReport);
+}
+
+#else
+
+// ISO C wants something in every translation unit
+typedef int profile_disabled;
+
+#endif
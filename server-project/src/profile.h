@@ -0,0 +1,75 @@
+/*
+ * profile.h
+ *
+ * Per-stage request profiler (make PROFILE=1)
+ * The request path is cut into stages with PROFILE_MARK/PROFILE_LAP:
+ * each lap adds the time since the thread's previous mark or lap to the
+ * histogram of its stage, in the thread's own block (one writer, as for
+ * the metrics), so stages spread over several functions need no state
+ * passed around. Time is read with rdtsc on x86 and CLOCK_MONOTONIC_RAW
+ * elsewhere. The breakdown (mean, p99, share of the total) goes to
+ * stderr on SIGUSR1 and at exit. Without PROFILE=1 every macro expands
+ * to nothing
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * PROFILE CONSTANTS
+ * ============================================================================
+ */
+
+// Stages, in request order
+#define PROFILE_RECEIVE 0    // recvmsg/recvmmsg/io_uring_enter (attesa inclusa; con io_uring anche gli invii)
+#define PROFILE_ADMIT 1      // limite per client, cache delle risposte, formato
+#define PROFILE_DNS 2        // indirizzo in testo e cache DNS inversa
+#define PROFILE_SCAN 3       // parsing, validazione e ricerca della città
+#define PROFILE_LOG 4        // accodamento della riga di log
+#define PROFILE_ENCODE 5     // valori meteo e codifica della risposta
+#define PROFILE_SEND 6       // sendto/sendmmsg
+#define PROFILE_STAGES 7
+
+#define PROFILE_SUB_BUCKETS 4    // bucket per potenza di 2 (errore del p99 sotto il 19%)
+#define PROFILE_BUCKETS (64 * PROFILE_SUB_BUCKETS)
+#define PROFILE_SLOTS 68         // thread che registrano (oltre: blocco condiviso)
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+#if defined(SERVER_PROFILE)
+
+// Start the clock calibration and print the breakdown at exit
+void ProfileStart(void);
+
+// Start timing the next stage of the calling thread
+void ProfileMark(void);
+
+// Add the time since the last mark or lap to stage, and start the next one
+void ProfileLap(int stage);
+
+// Print the breakdown of every thread's samples
+void ProfileReport(void);
+
+#define PROFILE_START() ProfileStart()
+#define PROFILE_MARK() ProfileMark()
+#define PROFILE_LAP(stage) ProfileLap(stage)
+#define PROFILE_REPORT() ProfileReport()
+
+#else
+
+#define PROFILE_START() ((void)0)
+#define PROFILE_MARK() ((void)0)
+#define PROFILE_LAP(stage) ((void)0)
+#define PROFILE_REPORT() ((void)0)
+
+#endif
+
+
+#endif /* PROFILE_H_ */
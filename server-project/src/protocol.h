@@ -20,6 +20,52 @@
 #define BUFFER_SIZE 512
 #define MAX_CITY_LENGTH 64
 
+// Multi-query datagrams (detected by the first two bytes; version 1 only)
+// Request:  magic, version, count, then count x (cityLen, type, city[cityLen])
+// Response: magic, version, count, then count x (status, type, value) as in struct response
+#define BATCH_MAGIC 0xB7
+#define BATCH_VERSION 1
+#define BATCH_HEADER_SIZE 3
+#define BATCH_RESPONSE_ENTRY_SIZE 9
+#define BATCH_MAX_QUERIES 56    // (BUFFER_SIZE - 1 - BATCH_HEADER_SIZE) / BATCH_RESPONSE_ENTRY_SIZE
+
+// City catalog pages (detected by the first two bytes; version 1 only)
+// Request:  magic, version, first city ID (uint32)
+// Response: magic, version, catalog version (uint32), city count (uint32), first city ID (uint32),
+//           name count, then count x (nameLen, name[nameLen]); no names once past the last city
+#define CATALOG_FETCH_MAGIC 0xB8
+#define CATALOG_FETCH_VERSION 1
+#define CATALOG_FETCH_SIZE 6
+#define CATALOG_PAGE_HEADER_SIZE 15
+#define CATALOG_PAGE_MAX_NAMES ((BUFFER_SIZE - CATALOG_PAGE_HEADER_SIZE) / 2)
+
+// Compact requests, sent with a city ID from the fetched catalog (exactly 4 bytes)
+// Request:  type | COMPACT_TYPE_FLAG, catalog tag, city ID (uint16)
+// Response: a classic response; status STATUS_STALE_CATALOG if the tag is of an earlier catalog
+//           of the server (with a tag it never issued the datagram is read as a classic request)
+#define COMPACT_REQUEST_SIZE 4
+#define COMPACT_TYPE_FLAG 0x80
+#define COMPACT_MAX_CITY_ID 0xFFFF
+#define CATALOG_TAG(version) ((uint8_t)((version) & 0xFF))
+#define STATUS_STALE_CATALOG 3
+
+// Optional request ID, after the city's NUL of a classic request or after a compact request
+// Request:  request, REQUEST_ID_MARKER, ID (uint32)
+// Response: the classic response followed by the same five bytes; a retransmission
+//           with the same ID gets the stored response again
+#define REQUEST_ID_MARKER 0xB9
+#define REQUEST_ID_SIZE 5
+
+// Datagrams handled per recvmmsg/sendmmsg call (1 = one-at-a-time loop; -b N to batch)
+#define SERVER_DEFAULT_BATCH 1
+#define SERVER_MAX_BATCH 64
+
+// Worker threads for -j (each with its own SO_REUSEPORT socket)
+#define SERVER_MAX_WORKERS 64
+
+// Largest receive buffer -R may grow a socket to (bytes)
+#define SERVER_MAX_RECEIVE_BUFFER (1 << 30)
+
 /*
  * ============================================================================
  * PROTOCOL DATA STRUCTURES
@@ -32,12 +78,79 @@ struct request {
     char city[64];  // nome città (null-terminated)
 };
 
+// Request parsed in place: the city points into the received datagram
+struct request_view {
+    char type;
+    const char *city;  // non terminata, valida finché lo è il buffer
+    int cityLen;       // al più MAX_CITY_LENGTH - 1 (stesso troncamento di DeserializeRequest)
+};
+
+// Compact request: the city is an ID of the catalog fetched from the server
+struct compact_request {
+    char type;
+    uint8_t catalogTag;   // CATALOG_TAG della versione del catalogo usato
+    uint16_t cityId;
+};
+
 struct response {
-    unsigned int status;  // 0=successo, 1=città non trovata, 2=richiesta invalida
+    unsigned int status;  // 0=successo, 1=città non trovata, 2=richiesta invalida, 3=catalogo superato
     char type;            // eco del tipo richiesto
     float value;          // dato meteo generato
 };
 
+// Multi-query request and response (one entry per (type, city) pair)
+struct batch_request {
+    int count;
+    struct request queries[BATCH_MAX_QUERIES];
+};
+
+struct batch_response {
+    int count;
+    struct response results[BATCH_MAX_QUERIES];  // nello stesso ordine delle richieste
+};
+
+// One page of the server's city catalog
+struct catalog_page {
+    uint32_t version;     // versione del catalogo (il suo CATALOG_TAG va nelle richieste compatte)
+    uint32_t cityCount;   // città dell'intero catalogo
+    uint32_t firstId;     // ID del primo nome della pagina
+    int count;            // nomi nella pagina, 0 oltre la fine del catalogo
+    char names[CATALOG_PAGE_MAX_NAMES][MAX_CITY_LENGTH];
+};
+
+// Reply being built for one received datagram
+struct reply {
+    int isBatch;                  // 1 = risposta multi-query
+    int isCatalogPage;            // 1 = pagina del catalogo (nessun risultato meteo)
+    uint32_t catalogFirst;        // primo ID della pagina richiesta
+    int hasRequestId;             // 1 = la risposta termina con l'ID e va memorizzata (dedup.h)
+    uint32_t requestId;
+    uint32_t clientAddr;          // chiave della risposta memorizzata (network byte order)
+    uint16_t clientPort;
+    int duplicateLength;          // > 0 = ritrasmissione: la risposta è già in duplicate
+    char duplicate[BATCH_RESPONSE_ENTRY_SIZE + REQUEST_ID_SIZE];
+    struct batch_response data;   // un solo elemento per le richieste classiche
+    int cityIds[BATCH_MAX_QUERIES];  // ID città di ogni query (CITY_NOT_FOUND se non valida)
+};
+
+// Server runtime configuration (filled by ParseServerArguments)
+struct server_config {
+    int port;       // porta UDP di ascolto
+    int batchSize;  // datagrammi per chiamata recvmmsg/sendmmsg (1 = ciclo classico, predefinito)
+    int workers;    // thread worker, ognuno con il proprio socket SO_REUSEPORT
+    int pinCpus;    // 1 = fissa il worker i sulla CPU i
+    int reverseDns; // 0 = nessuna risoluzione inversa, nel log solo l'IP
+    uint64_t seed;  // seme del generatore (--seed per esecuzioni riproducibili)
+    int useUring;   // 1 = ciclo io_uring (-u), se disponibile
+    int tickMs;     // intervallo di aggiornamento dei dati meteo (-T)
+    int statsPort;  // porta UDP locale delle metriche (-m), 0 = nessuna
+    double rateLimit;  // datagrammi al secondo per indirizzo client (-L), 0 = nessun limite
+    double rateBurst;  // datagrammi accettati di seguito dopo una pausa
+    int pipelineWorkers;  // -P: ricevitore, N worker e mittente su code SPSC (0 = disattivato)
+    const char *catalogPath;  // -C: elenco delle città, ricaricato con SIGHUP (NULL = tabella integrata)
+    int maxReceiveBuffer;     // -R: limite di crescita del buffer di ricezione (byte, 0 = fisso)
+};
+
 /*
  * ============================================================================
  * FUNCTION PROTOTYPES
@@ -45,31 +158,64 @@ struct response {
  */
 
 // Server argument parsing
-int ParseServerArguments(int argc, char *argv[], int *port);
+int ParseServerArguments(int argc, char *argv[], struct server_config *config);
 
 // Socket creation
 int CreateUDPSocket(void);
+int OpenServerSocket(int port, int reusePort);
 
 // Request validation
 int ValidateRequestType(char type);
 int ValidateCity(const char *city);
-int IsCitySupported(const char *city);
-int HasInvalidCharacters(const char *city);
+int ClassifyCity(const char *city, int *cityId);
 
 // Weather data generation
 float GetTemperature(void);
 float GetHumidity(void);
 float GetWind(void);
 float GetPressure(void);
+float GetWeatherValue(char type);
+void FillWeatherValues(const char *types, const int *cityIds, float *values, int count);
 
 // Serialization/Deserialization
 int SerializeRequest(const struct request *req, char *buffer, int bufferSize);
+int ParseRequestView(const char *buffer, int bufferSize, struct request_view *view);
 int DeserializeRequest(const char *buffer, int bufferSize, struct request *req);
 int SerializeResponse(const struct response *resp, char *buffer, int bufferSize);
 int DeserializeResponse(const char *buffer, int bufferSize, struct response *resp);
-
-// DNS and network utilities
-int GetHostnameFromAddress(const struct sockaddr_in *addr, char *hostname, int hostnameSize);
+int IsBatchDatagram(const char *buffer, int bufferSize);
+int SerializeBatchRequest(const struct batch_request *req, char *buffer, int bufferSize);
+int DeserializeBatchRequest(const char *buffer, int bufferSize, struct batch_request *req);
+int SerializeBatchResponse(const struct batch_response *resp, char *buffer, int bufferSize);
+int DeserializeBatchResponse(const char *buffer, int bufferSize, struct batch_response *resp);
+int SerializeCompactRequest(const struct compact_request *req, char *buffer, int bufferSize);
+int ParseCompactRequest(const char *buffer, int bufferSize, struct compact_request *req);
+int IsCatalogFetchDatagram(const char *buffer, int bufferSize);
+int SerializeCatalogFetch(uint32_t firstId, char *buffer, int bufferSize);
+int ParseCatalogFetch(const char *buffer, int bufferSize, uint32_t *firstId);
+int SerializeCatalogPage(uint32_t version, uint32_t cityCount, uint32_t firstId, const char *const *names,
+                         char *buffer, int bufferSize);
+int DeserializeCatalogPage(const char *buffer, int bufferSize, struct catalog_page *page);
+int AppendRequestId(uint32_t id, char *buffer, int size, int bufferSize);
+int SplitRequestId(const char *buffer, int *size, uint32_t *id);
+int SplitResponseId(const char *buffer, int *size, uint32_t *id);
+
+// Request handling and reception loops
+int ProcessRequest(const char *buffer, int bytesReceived, const struct sockaddr_in *clientAddr,
+                   struct reply *reply);
+int SerializeReply(const struct reply *reply, char *buffer, int bufferSize);
+int HandleRequest(const char *buffer, int bytesReceived, const struct sockaddr_in *clientAddr,
+                  char *respBuffer, int respBufferSize);
+void RunSingleLoop(int sock);
+void RunBatchLoop(int sock, int batchSize);
+void RunServerLoop(int sock, int batchSize, int useUring);
+int ServerStopping(void);
+
+// Multi-core mode (POSIX threads)
+#if !defined(_WIN32) && !defined(WIN32)
+void *WorkerMain(void *arg);
+int RunWorkers(const struct server_config *config);
+#endif
 
 // City name formatting
 void FormatCityName(char *city);
@@ -0,0 +1,114 @@
+/*
+ * ratelimit.c
+ *
+ * Token buckets in a shared set-associative table.
+ * Refill is computed lazily from the time since an address was last
+ * seen, on the coarse monotonic clock where there is one: millisecond
+ * resolution is plenty for per-second rates. A set is held for a few
+ * loads and stores, so its lock spins instead of sleeping.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include "ratelimit.h"
+
+static double g_ratePerMs = 0.0;
+static float g_burst = 0.0f;
+static int g_enabled = 0;
+static struct rate_set *g_table;
+
+// Same mixing as the DNS cache, so neighbouring addresses spread over the sets
+static uint32_t HashAddress(uint32_t addr) {
+	addr ^= addr >> 16;
+	addr *= 0x7FEB352Du;
+	addr ^= addr >> 15;
+	addr *= 0x846CA68Bu;
+	addr ^= addr >> 16;
+	return addr;
+}
+
+static uint32_t NowMs(void) {
+	struct timespec ts;
+#if defined(CLOCK_MONOTONIC_COARSE)
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#elif defined(_WIN32) || defined(WIN32)
+	timespec_get(&ts, TIME_UTC);
+#else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+	return (uint32_t)((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u);
+}
+
+int RateLimitConfigure(double rate, double burst) {
+	g_ratePerMs = rate / 1000.0;
+	g_burst = (float)(burst >= 1.0 ? burst : 1.0);
+	if (rate <= 0.0) {
+		return 0;
+	}
+
+	// Aligned to cache lines, one set per line
+	char *raw = calloc(1, sizeof(struct rate_set) * RATE_LIMIT_SETS + 64);
+	if (raw == NULL) {
+		fprintf(stderr, "Error allocating the rate limit table\n");
+		return -1;
+	}
+	g_table = (struct rate_set *)(((uintptr_t)raw + 63) & ~(uintptr_t)63);
+	g_enabled = 1;
+	return 0;
+}
+
+static void LockSet(struct rate_set *set) {
+	while (atomic_exchange_explicit(&set->lock, 1, memory_order_acquire) != 0) {
+		while (atomic_load_explicit(&set->lock, memory_order_relaxed) != 0) {
+		}
+	}
+}
+
+static void UnlockSet(struct rate_set *set) {
+	atomic_store_explicit(&set->lock, 0, memory_order_release);
+}
+
+// Take a token for addr from its bucket in set (caller holds the set lock)
+static int TakeToken(struct rate_set *set, uint32_t addr, uint32_t now) {
+	struct rate_entry *victim = &set->entries[0];
+
+	for (int i = 0; i < RATE_LIMIT_WAYS; i++) {
+		struct rate_entry *e = &set->entries[i];
+		if (e->addr == addr) {
+			// Refill for the time since the last datagram, capped at the burst
+			float tokens = e->tokens + (float)((double)(uint32_t)(now - e->stampMs) * g_ratePerMs);
+			e->tokens = (tokens < g_burst) ? tokens : g_burst;
+			e->stampMs = now;
+			if (e->tokens < 1.0f) {
+				return 0;
+			}
+			e->tokens -= 1.0f;
+			return 1;
+		}
+		// Free entries first, then the least recently seen one
+		if (victim->addr != 0 && (e->addr == 0 || (uint32_t)(now - e->stampMs) > (uint32_t)(now - victim->stampMs))) {
+			victim = e;
+		}
+	}
+
+	// New address: full bucket, minus this datagram
+	victim->addr = addr;
+	victim->stampMs = now;
+	victim->tokens = g_burst - 1.0f;
+	return 1;
+}
+
+int RateLimitAllow(uint32_t addr) {
+	if (!g_enabled) {
+		return 1;
+	}
+
+	struct rate_set *set = &g_table[HashAddress(addr) & (RATE_LIMIT_SETS - 1)];
+	uint32_t now = NowMs();
+	LockSet(set);
+	int allowed = TakeToken(set, addr, now);
+	UnlockSet(set);
+	return allowed;
+}
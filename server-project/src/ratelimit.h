@@ -0,0 +1,62 @@
+/*
+ * ratelimit.h
+ *
+ * Per-source-IP token buckets
+ * One fixed table of buckets shared by every request thread: a set of
+ * entries per cache line, chosen by hashing the address, with the least
+ * recently seen entry of the set evicted for a new address. Each set
+ * carries its own spin lock, so threads only contend on datagrams whose
+ * addresses share a set, and the limit holds however -j or -P spread a
+ * client's datagrams over the threads
+ */
+
+#ifndef RATELIMIT_H_
+#define RATELIMIT_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * ============================================================================
+ * RATE LIMIT CONSTANTS
+ * ============================================================================
+ */
+
+#define RATE_LIMIT_SETS 1024     // set della tabella (potenza di 2)
+#define RATE_LIMIT_WAYS 5        // indirizzi per set: 5 x 12 byte e il lock in una cache line
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Bucket of one source address
+struct rate_entry {
+    uint32_t addr;       // indirizzo IPv4 (network byte order), 0 = libero
+    uint32_t stampMs;    // ultimo datagramma visto (ricarica e LRU)
+    float tokens;
+};
+
+// One cache line of the table
+struct rate_set {
+    _Alignas(64) struct rate_entry entries[RATE_LIMIT_WAYS];
+    atomic_uint lock;    // 1 = un thread sta aggiornando il set
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Allow rate datagrams per second per source address, with bursts of up to
+// burst datagrams; rate 0 (the default) disables the limit. Call before
+// starting the request threads. Returns -1 if the table cannot be allocated.
+int RateLimitConfigure(double rate, double burst);
+
+// 1 if a datagram from addr (network byte order) may be processed, 0 to drop it
+int RateLimitAllow(uint32_t addr);
+
+
+#endif /* RATELIMIT_H_ */
@@ -0,0 +1,287 @@
+/*
+ * request_scan.c
+ *
+ * Fused request validator: one pass over the city bytes copies them for
+ * the log, classifies them (alphanumeric, space, apostrophe, hyphen),
+ * folds them to lowercase and feeds the city hash, then a single perfect
+ * hash probe decides the status. Results match the original request
+ * path bit for bit (its reference copy lives in bench/bench_request_scan.c).
+ *
+ * Kernels: scalar (256-entry class table), SSE2 (range compares) and
+ * AVX2 (nibble lookup tables), picked at runtime on x86.
+ */
+
+#include <string.h>
+#include "request_scan.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SCAN_HAVE_X86 1
+#include <immintrin.h>
+#endif
+
+// Character classes: bit 0 = valid city character, bit 1 = uppercase letter
+#define CLASS_VALID 1
+#define CLASS_UPPER 2
+
+static const uint8_t g_charClass[256] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 1, 0, 0,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+	0, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 0, 0, 0, 0, 0,
+	0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+};
+
+// Datagram shorter than type + one byte: DeserializeRequest rejected these
+static unsigned int ScanMalformed(struct request_scan *scan) {
+	scan->type = '\0';
+	scan->respType = '?';
+	scan->cityLen = 0;
+	scan->city[0] = '\0';
+	scan->cityId = CITY_NOT_FOUND;
+	return 2;
+}
+
+// Common tail of every kernel: type check, then one perfect hash probe
+static unsigned int ScanFinish(const struct city_table *table, struct request_scan *scan, char type,
+                               int len, int invalid, uint64_t h, const char *folded) {
+	scan->type = type;
+	scan->respType = type;
+	scan->cityLen = len;
+	scan->city[len] = '\0';
+	scan->cityId = CITY_NOT_FOUND;
+
+	if ((type != 't' && type != 'h' && type != 'w' && type != 'p') || invalid) {
+		return 2;
+	}
+	scan->cityId = CityTableFind(table, folded, len, CityHashFinish(h, len));
+	return (scan->cityId == CITY_NOT_FOUND) ? 1 : 0;
+}
+
+// Number of city bytes the request may carry (truncated at SCAN_CITY_MAX - 1)
+static int CityLimit(int bufferSize) {
+	int limit = bufferSize - 1;
+	return (limit < SCAN_CITY_MAX - 1) ? limit : SCAN_CITY_MAX - 1;
+}
+
+static unsigned int ScanScalar(const struct city_table *table, const char *buffer, int bufferSize,
+                               struct request_scan *scan) {
+	if (bufferSize < 2) {
+		return ScanMalformed(scan);
+	}
+
+	const unsigned char *src = (const unsigned char *)buffer + 1;
+	int limit = CityLimit(bufferSize);
+	char folded[SCAN_CITY_MAX];
+	uint64_t h = table->seed;
+	uint64_t word = 0;
+	int invalid = 0;
+	int len;
+
+	for (len = 0; len < limit && src[len] != 0; len++) {
+		unsigned char c = src[len];
+		uint8_t cls = g_charClass[c];
+		invalid |= !(cls & CLASS_VALID);
+		scan->city[len] = (char)c;
+		folded[len] = (char)(c + ((cls & CLASS_UPPER) << 4));
+		word |= (uint64_t)(unsigned char)folded[len] << (8 * (len & 7));
+		if ((len & 7) == 7) {
+			h = CityHashStep(h, word);
+			word = 0;
+		}
+	}
+	if (len & 7) {
+		h = CityHashStep(h, word);
+	}
+	return ScanFinish(table, scan, buffer[0], len, invalid, h, folded);
+}
+
+#if defined(SCAN_HAVE_X86)
+
+// Little-endian 64-bit word at p (x86 only)
+static inline uint64_t LoadWord(const char *p) {
+	uint64_t w;
+	memcpy(&w, p, sizeof(w));
+	return w;
+}
+
+__attribute__((target("sse2")))
+static inline __m128i LessEqualU8(__m128i v, char max) {
+	return _mm_cmpeq_epi8(_mm_min_epu8(v, _mm_set1_epi8(max)), v);
+}
+
+__attribute__((target("sse2")))
+static unsigned int ScanSSE2(const struct city_table *table, const char *buffer, int bufferSize,
+                             struct request_scan *scan) {
+	if (bufferSize < 2) {
+		return ScanMalformed(scan);
+	}
+
+	const char *src = buffer + 1;
+	int limit = CityLimit(bufferSize);
+	char folded[SCAN_CITY_MAX] __attribute__((aligned(16)));
+	const __m128i iota = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	uint64_t h = table->seed;
+	unsigned int invalid = 0;
+	int len = 0;
+
+	for (int off = 0; off < limit; off += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + off));
+
+		// Chunk ends at the first NUL or at the truncation limit
+		int remaining = limit - off;
+		unsigned int inRange = (remaining >= 16) ? 0xFFFFu : (1u << remaining) - 1;
+		unsigned int stop = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128())) & inRange;
+		int chunkLen = stop ? __builtin_ctz(stop) : ((remaining < 16) ? remaining : 16);
+		unsigned int live = (1u << chunkLen) - 1;
+
+		// Classify: letters (any case), digits, ' ', '\'', '-'
+		__m128i alpha = LessEqualU8(_mm_sub_epi8(_mm_or_si128(v, _mm_set1_epi8(0x20)), _mm_set1_epi8('a')), 25);
+		__m128i digit = LessEqualU8(_mm_sub_epi8(v, _mm_set1_epi8('0')), 9);
+		__m128i punct = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+		                                          _mm_cmpeq_epi8(v, _mm_set1_epi8('\''))),
+		                             _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+		__m128i valid = _mm_or_si128(_mm_or_si128(alpha, digit), punct);
+		invalid |= ~(unsigned int)_mm_movemask_epi8(valid) & live;
+
+		// Fold uppercase and clear bytes past the end so the hash sees zero padding
+		__m128i upper = LessEqualU8(_mm_sub_epi8(v, _mm_set1_epi8('A')), 25);
+		__m128i lower = _mm_add_epi8(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+		lower = _mm_and_si128(lower, _mm_cmpgt_epi8(_mm_set1_epi8((char)chunkLen), iota));
+
+		_mm_storeu_si128((__m128i *)(scan->city + off), v);
+		_mm_store_si128((__m128i *)(folded + off), lower);
+
+		if (chunkLen > 0) {
+			h = CityHashStep(h, LoadWord(folded + off));
+		}
+		if (chunkLen > 8) {
+			h = CityHashStep(h, LoadWord(folded + off + 8));
+		}
+		len += chunkLen;
+		if (chunkLen < 16) {
+			break;
+		}
+	}
+	return ScanFinish(table, scan, buffer[0], len, invalid != 0, h, folded);
+}
+
+__attribute__((target("avx2")))
+static unsigned int ScanAVX2(const struct city_table *table, const char *buffer, int bufferSize,
+                             struct request_scan *scan) {
+	if (bufferSize < 2) {
+		return ScanMalformed(scan);
+	}
+
+	// Nibble tables: a byte is valid iff lowTable[b & 15] & highTable[b >> 4] != 0.
+	// Bits: 1 = ' ' '\'' '-' (high 2), 2 = digits (high 3),
+	//       4 = letters 'A'/'a'..'O'/'o' (high 4/6), 8 = 'P'/'p'..'Z'/'z' (high 5/7)
+	const __m256i lowTable = _mm256_setr_epi8(
+		0x0B, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0F, 0x0E, 0x0E, 0x0C, 0x04, 0x04, 0x05, 0x04, 0x04,
+		0x0B, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0E, 0x0F, 0x0E, 0x0E, 0x0C, 0x04, 0x04, 0x05, 0x04, 0x04);
+	const __m256i highTable = _mm256_setr_epi8(
+		0, 0, 1, 2, 4, 8, 4, 8, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 1, 2, 4, 8, 4, 8, 0, 0, 0, 0, 0, 0, 0, 0);
+	const __m256i iota = _mm256_setr_epi8(
+		0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+		16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+	const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+	const char *src = buffer + 1;
+	int limit = CityLimit(bufferSize);
+	char folded[SCAN_CITY_MAX] __attribute__((aligned(32)));
+	uint64_t h = table->seed;
+	uint64_t invalid = 0;
+	int len = 0;
+
+	for (int off = 0; off < limit; off += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + off));
+
+		int remaining = limit - off;
+		uint64_t inRange = (remaining >= 32) ? 0xFFFFFFFFull : (1ull << remaining) - 1;
+		uint64_t stop = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256())) & inRange;
+		int chunkLen = stop ? __builtin_ctzll(stop) : ((remaining < 32) ? remaining : 32);
+		uint64_t live = (1ull << chunkLen) - 1;
+
+		// Class lookup (bytes >= 0x80 have high nibble 8..15, which maps to 0)
+		__m256i lowClass = _mm256_shuffle_epi8(lowTable, _mm256_and_si256(v, nibble));
+		__m256i highClass = _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+		__m256i bad = _mm256_cmpeq_epi8(_mm256_and_si256(lowClass, highClass), _mm256_setzero_si256());
+		invalid |= (uint32_t)_mm256_movemask_epi8(bad) & live;
+
+		__m256i fromA = _mm256_sub_epi8(v, _mm256_set1_epi8('A'));
+		__m256i upper = _mm256_cmpeq_epi8(_mm256_min_epu8(fromA, _mm256_set1_epi8(25)), fromA);
+		__m256i lower = _mm256_add_epi8(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+		lower = _mm256_and_si256(lower, _mm256_cmpgt_epi8(_mm256_set1_epi8((char)chunkLen), iota));
+
+		_mm256_storeu_si256((__m256i *)(scan->city + off), v);
+		_mm256_store_si256((__m256i *)(folded + off), lower);
+
+		for (int w = 0; w < chunkLen; w += 8) {
+			h = CityHashStep(h, LoadWord(folded + off + w));
+		}
+		len += chunkLen;
+		if (chunkLen < 32) {
+			break;
+		}
+	}
+	return ScanFinish(table, scan, buffer[0], len, invalid != 0, h, folded);
+}
+
+#endif /* SCAN_HAVE_X86 */
+
+int ScanRequestBestImpl(void) {
+#if defined(SCAN_HAVE_X86)
+	if (__builtin_cpu_supports("avx2")) {
+		return SCAN_IMPL_AVX2;
+	}
+	if (__builtin_cpu_supports("sse2")) {
+		return SCAN_IMPL_SSE2;
+	}
+#endif
+	return SCAN_IMPL_SCALAR;
+}
+
+const char *ScanRequestImplName(int impl) {
+	switch (impl) {
+		case SCAN_IMPL_SCALAR:
+			return "scalar";
+		case SCAN_IMPL_SSE2:
+			return "sse2";
+		case SCAN_IMPL_AVX2:
+			return "avx2";
+		default:
+			return "auto";
+	}
+}
+
+unsigned int ScanRequestWith(int impl, const struct city_table *table, const char *buffer,
+                             int bufferSize, struct request_scan *scan) {
+	if (impl == SCAN_IMPL_AUTO) {
+		impl = ScanRequestBestImpl();
+	}
+#if defined(SCAN_HAVE_X86)
+	if (impl == SCAN_IMPL_AVX2 && __builtin_cpu_supports("avx2")) {
+		return ScanAVX2(table, buffer, bufferSize, scan);
+	}
+	if (impl == SCAN_IMPL_SSE2 && __builtin_cpu_supports("sse2")) {
+		return ScanSSE2(table, buffer, bufferSize, scan);
+	}
+#endif
+	return ScanScalar(table, buffer, bufferSize, scan);
+}
+
+unsigned int ScanRequest(const struct city_table *table, const char *buffer, int bufferSize,
+                         struct request_scan *scan) {
+	return ScanRequestWith(SCAN_IMPL_AUTO, table, buffer, bufferSize, scan);
+}
@@ -0,0 +1,70 @@
+/*
+ * request_scan.h
+ *
+ * Single-pass request validator
+ * Copies, classifies, case-folds and hashes the city of a request
+ * datagram in one pass and returns the response status directly
+ */
+
+#ifndef REQUEST_SCAN_H_
+#define REQUEST_SCAN_H_
+
+#include <stdint.h>
+#include "city_hash.h"
+
+/*
+ * ============================================================================
+ * SCANNER CONSTANTS
+ * ============================================================================
+ */
+
+#define SCAN_CITY_MAX 64                          // MAX_CITY_LENGTH
+#define SCAN_MIN_BUFFER (1 + SCAN_CITY_MAX)       // byte leggibili richiesti nel buffer
+
+// Kernel implementations
+#define SCAN_IMPL_AUTO 0      // il migliore supportato dalla CPU
+#define SCAN_IMPL_SCALAR 1
+#define SCAN_IMPL_SSE2 2
+#define SCAN_IMPL_AVX2 3
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Result of scanning one request datagram
+struct request_scan {
+    char type;                  // tipo richiesto ('\0' se il datagramma è troppo corto)
+    char respType;              // tipo da restituire nella risposta ('?' se troppo corto)
+    int cityLen;
+    char city[SCAN_CITY_MAX];   // città come ricevuta (null-terminated), per il log
+    int cityId;                 // ID nella tabella, CITY_NOT_FOUND se non supportata
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Scan a request with the fastest available kernel and return its status:
+// 0 = supported city, 1 = city not found, 2 = invalid request.
+// buffer must have at least SCAN_MIN_BUFFER readable bytes, whatever bufferSize is:
+// vector loads read past the datagram and mask the extra bytes.
+unsigned int ScanRequest(const struct city_table *table, const char *buffer, int bufferSize,
+                         struct request_scan *scan);
+
+// Same as ScanRequest with a specific kernel (for verification and benchmarks);
+// falls back to the scalar kernel if impl is not supported
+unsigned int ScanRequestWith(int impl, const struct city_table *table, const char *buffer,
+                             int bufferSize, struct request_scan *scan);
+
+// Kernel picked by SCAN_IMPL_AUTO on this CPU
+int ScanRequestBestImpl(void);
+
+// Printable kernel name
+const char *ScanRequestImplName(int impl);
+
+
+#endif /* REQUEST_SCAN_H_ */
@@ -0,0 +1,112 @@
+/*
+ * rng.c
+ *
+ * xoshiro256** (Blackman & Vigna) with splitmix64 seeding and the
+ * standard jump function for independent per-thread streams.
+ */
+
+#include <time.h>
+#if defined(_WIN32) || defined(WIN32)
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#include "rng.h"
+
+// 24-bit mantissa: the largest value maps exactly to 1.0f
+#define RNG_UNIT_BITS 24
+#define RNG_UNIT_MAX ((float)((1u << RNG_UNIT_BITS) - 1))
+
+static _Thread_local uint64_t t_state[4] = {
+	0x9E3779B97F4A7C15ull, 0xBF58476D1CE4E5B9ull, 0x94D049BB133111EBull, 0x2545F4914F6CDD1Dull
+};
+
+static uint64_t RotateLeft(uint64_t x, int k) {
+	return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t SplitMix64(uint64_t *x) {
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+// Advance the state by 2^128 steps
+static void Jump(void) {
+	static const uint64_t jump[] = {
+		0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull, 0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull
+	};
+	uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+	for (int i = 0; i < 4; i++) {
+		for (int b = 0; b < 64; b++) {
+			if (jump[i] & (1ull << b)) {
+				s0 ^= t_state[0];
+				s1 ^= t_state[1];
+				s2 ^= t_state[2];
+				s3 ^= t_state[3];
+			}
+			RngNext();
+		}
+	}
+	t_state[0] = s0;
+	t_state[1] = s1;
+	t_state[2] = s2;
+	t_state[3] = s3;
+}
+
+void RngSeed(uint64_t seed, int stream) {
+	uint64_t x = seed;
+	for (int i = 0; i < 4; i++) {
+		t_state[i] = SplitMix64(&x);
+	}
+	for (int i = 0; i < stream; i++) {
+		Jump();
+	}
+}
+
+uint64_t RngNext(void) {
+	uint64_t result = RotateLeft(t_state[1] * 5, 7) * 9;
+	uint64_t t = t_state[1] << 17;
+
+	t_state[2] ^= t_state[0];
+	t_state[3] ^= t_state[1];
+	t_state[1] ^= t_state[2];
+	t_state[0] ^= t_state[3];
+	t_state[2] ^= t;
+	t_state[3] = RotateLeft(t_state[3], 45);
+	return result;
+}
+
+float RngUnit(void) {
+	return (float)(RngNext() >> (64 - RNG_UNIT_BITS)) / RNG_UNIT_MAX;
+}
+
+void RngFillUnit(float *values, int count) {
+	// Work on a local copy so the compiler keeps the state in registers
+	uint64_t s0 = t_state[0], s1 = t_state[1], s2 = t_state[2], s3 = t_state[3];
+
+	for (int i = 0; i < count; i++) {
+		uint64_t result = RotateLeft(s1 * 5, 7) * 9;
+		uint64_t t = s1 << 17;
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = RotateLeft(s3, 45);
+		values[i] = (float)(result >> (64 - RNG_UNIT_BITS)) / RNG_UNIT_MAX;
+	}
+
+	t_state[0] = s0;
+	t_state[1] = s1;
+	t_state[2] = s2;
+	t_state[3] = s3;
+}
+
+uint64_t RngDefaultSeed(void) {
+	uint64_t x = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+	return SplitMix64(&x);
+}
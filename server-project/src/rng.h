@@ -0,0 +1,37 @@
+/*
+ * rng.h
+ *
+ * Per-thread xoshiro256** generator for weather data
+ * Each thread owns its state: no locks, no shared cache lines, and a
+ * given (seed, stream) pair always replays the same sequence
+ */
+
+#ifndef RNG_H_
+#define RNG_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Seed the calling thread's generator. Threads sharing a seed but using
+// different streams get non-overlapping sequences (2^128 values apart).
+void RngSeed(uint64_t seed, int stream);
+
+// Next raw 64-bit value of the calling thread's generator
+uint64_t RngNext(void);
+
+// Uniform value in [0.0, 1.0], both ends included (like rand() / RAND_MAX)
+float RngUnit(void);
+
+// Fill values[0..count-1] with uniform values in [0.0, 1.0]
+void RngFillUnit(float *values, int count);
+
+// Default seed for runs without --seed (time and process ID)
+uint64_t RngDefaultSeed(void);
+
+
+#endif /* RNG_H_ */
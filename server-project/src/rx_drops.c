@@ -0,0 +1,138 @@
+/*
+ * rx_drops.c
+ *
+ * Drop counter parsing and receive buffer growth.
+ * The counter only grows, so a loop that receives a batch reads the
+ * last header; the windows are only looked at when the counter moves,
+ * which costs nothing while the socket keeps up.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "rx_drops.h"
+#include "metrics.h"
+
+static int g_maxBytes = 0;
+static atomic_uint_fast64_t g_grows;
+static atomic_int g_receiveBuffer;
+
+// Drop tracking of the calling thread's socket
+static _Thread_local uint32_t t_lastDrops;
+static _Thread_local uint32_t t_lastWindow;
+static _Thread_local int t_streak;      // finestre consecutive con scarti
+static _Thread_local int t_atLimit;     // il kernel non concede di più
+
+void RxDropsConfigure(int maxBytes) {
+	g_maxBytes = (maxBytes > 0) ? maxBytes : 0;
+}
+
+void RxDropsGetStats(struct rx_drops_stats *stats) {
+	stats->grows = atomic_load_explicit(&g_grows, memory_order_relaxed);
+	stats->receiveBuffer = atomic_load_explicit(&g_receiveBuffer, memory_order_relaxed);
+}
+
+#if defined(SO_RXQ_OVFL)
+static int ReceiveBuffer(int sock) {
+	int size = 0;
+	socklen_t len = sizeof(size);
+	if (getsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, &len) < 0) {
+		return 0;
+	}
+	return size;
+}
+
+// Keep the largest buffer for the metrics
+static void PublishReceiveBuffer(int size) {
+	int seen = atomic_load_explicit(&g_receiveBuffer, memory_order_relaxed);
+	while (size > seen &&
+	       !atomic_compare_exchange_weak_explicit(&g_receiveBuffer, &seen, size, memory_order_relaxed,
+	                                              memory_order_relaxed)) {
+	}
+}
+
+void RxDropsEnable(int sock) {
+	int enable = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0) {
+		perror("Error setting SO_RXQ_OVFL");
+	}
+	PublishReceiveBuffer(ReceiveBuffer(sock));
+}
+
+// Double the receive buffer of sock, up to g_maxBytes. The kernel doubles the value
+// set (bookkeeping overhead) and reports the doubled size, so half the target is set.
+static void GrowReceiveBuffer(int sock) {
+	int current = ReceiveBuffer(sock);
+	int target = (current < g_maxBytes / 2) ? current * 2 : g_maxBytes;
+	if (current <= 0 || target <= current) {
+		t_atLimit = 1;
+		return;
+	}
+
+	int value = target / 2;
+	setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &value, sizeof(value));
+#if defined(SO_RCVBUFFORCE)
+	// Past net.core.rmem_max only with CAP_NET_ADMIN
+	if (ReceiveBuffer(sock) < target) {
+		setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &value, sizeof(value));
+	}
+#endif
+
+	int granted = ReceiveBuffer(sock);
+	if (granted <= current) {
+		t_atLimit = 1;
+		fprintf(stderr, "Receive buffer stays at %d bytes (raise net.core.rmem_max to grow it)\n", current);
+		return;
+	}
+	atomic_fetch_add_explicit(&g_grows, 1, memory_order_relaxed);
+	PublishReceiveBuffer(granted);
+	fprintf(stderr, "Receive buffer grown to %d bytes after drops in %d consecutive seconds\n", granted,
+	        RX_GROW_WINDOWS * RX_GROW_WINDOW_MS / 1000);
+}
+
+void RxDropsRecord(int sock, const struct msghdr *msg) {
+	uint32_t drops = t_lastDrops;
+
+	for (struct cmsghdr *c = CMSG_FIRSTHDR((struct msghdr *)msg); c != NULL;
+	     c = CMSG_NXTHDR((struct msghdr *)msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SO_RXQ_OVFL) {
+			memcpy(&drops, CMSG_DATA(c), sizeof(drops));
+		}
+	}
+	if (drops == t_lastDrops) {
+		return;
+	}
+
+	MetricsRecordKernelDrops((uint32_t)(drops - t_lastDrops));
+	t_lastDrops = drops;
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint32_t window = (uint32_t)(((uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u) / RX_GROW_WINDOW_MS);
+	if (window != t_lastWindow) {
+		t_streak = (window == t_lastWindow + 1) ? t_streak + 1 : 1;
+		t_lastWindow = window;
+	}
+	if (g_maxBytes > 0 && !t_atLimit && t_streak >= RX_GROW_WINDOWS) {
+		t_streak = 0;
+		GrowReceiveBuffer(sock);
+	}
+}
+#else
+void RxDropsEnable(int sock) {
+	(void)sock;
+}
+
+void RxDropsRecord(int sock, const struct msghdr *msg) {
+	(void)sock;
+	(void)msg;
+}
+#endif
@@ -0,0 +1,59 @@
+/*
+ * rx_drops.h
+ *
+ * Kernel receive drops (SO_RXQ_OVFL) and receive buffer auto-tuning
+ * With SO_RXQ_OVFL every datagram queued after a drop carries the
+ * socket's cumulative drop counter as ancillary data; each reception
+ * loop passes its received headers here, and the increase is counted
+ * in the metrics. With -R the receive buffer of a socket that drops in
+ * RX_GROW_WINDOWS consecutive windows is doubled, up to the -R cap.
+ * The state is per thread: every thread receives on its own socket
+ */
+
+#ifndef RX_DROPS_H_
+#define RX_DROPS_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * RX DROPS CONSTANTS
+ * ============================================================================
+ */
+
+#define RX_CONTROL_SIZE 64         // dati ancillari di una ricezione: contatore degli scarti e timestamp del kernel
+#define RX_GROW_WINDOW_MS 1000     // finestra di osservazione degli scarti
+#define RX_GROW_WINDOWS 3          // finestre consecutive con scarti prima di ingrandire il buffer
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+struct rx_drops_stats {
+    uint64_t grows;            // ingrandimenti del buffer di ricezione
+    int receiveBuffer;         // buffer di ricezione più grande (byte, come riportato dal kernel)
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Grow receive buffers up to maxBytes on sustained drops; 0 (the default) keeps them as they are
+void RxDropsConfigure(int maxBytes);
+
+// Ask the kernel for the drop counter on sock (no effect where SO_RXQ_OVFL is missing)
+void RxDropsEnable(int sock);
+
+// Count the drops reported in the control data of a header received on sock.
+// msg is a struct msghdr; with a batch, passing the last header is enough.
+struct msghdr;
+void RxDropsRecord(int sock, const struct msghdr *msg);
+
+void RxDropsGetStats(struct rx_drops_stats *stats);
+
+
+#endif /* RX_DROPS_H_ */
@@ -0,0 +1,59 @@
+/*
+ * rx_timestamp.c
+ *
+ * SCM_TIMESTAMPNS parsing. Stamps are CLOCK_REALTIME, so the delay is
+ * taken against the same clock; a delay that comes out negative (clock
+ * stepped between the two reads) is not recorded.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "rx_timestamp.h"
+#include "metrics.h"
+
+uint64_t RxTimestampNow(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+#if defined(SO_TIMESTAMPNS)
+void RxTimestampEnable(int sock) {
+	int enable = 1;
+	if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0) {
+		perror("Error setting SO_TIMESTAMPNS");
+	}
+}
+
+void RxTimestampRecord(const struct msghdr *msg, uint64_t receivedNs) {
+	for (struct cmsghdr *c = CMSG_FIRSTHDR((struct msghdr *)msg); c != NULL;
+	     c = CMSG_NXTHDR((struct msghdr *)msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+			struct timespec stamp;
+			memcpy(&stamp, CMSG_DATA(c), sizeof(stamp));
+			uint64_t stampNs = (uint64_t)stamp.tv_sec * 1000000000ull + (uint64_t)stamp.tv_nsec;
+			if (receivedNs >= stampNs) {
+				MetricsRecordQueueDelay(receivedNs - stampNs);
+			}
+			return;
+		}
+	}
+}
+#else
+void RxTimestampEnable(int sock) {
+	(void)sock;
+}
+
+void RxTimestampRecord(const struct msghdr *msg, uint64_t receivedNs) {
+	(void)msg;
+	(void)receivedNs;
+}
+#endif
@@ -0,0 +1,35 @@
+/*
+ * rx_timestamp.h
+ *
+ * Socket queueing delay from kernel receive timestamps (SO_TIMESTAMPNS)
+ * The kernel stamps every datagram when it reaches the socket; the delay
+ * until the reception loop takes it out is the time spent queued behind
+ * earlier datagrams, recorded in the metrics apart from the service time
+ * that follows it (weather_queue_delay_seconds and
+ * weather_service_seconds)
+ */
+
+#ifndef RX_TIMESTAMP_H_
+#define RX_TIMESTAMP_H_
+
+#include <stdint.h>
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Ask the kernel to stamp datagrams received on sock (no effect where SO_TIMESTAMPNS is missing)
+void RxTimestampEnable(int sock);
+
+// Wall clock time in ns, the clock of the kernel stamps: read once after each receive call
+uint64_t RxTimestampNow(void);
+
+// Record the queueing delay of a datagram whose header msg (a struct msghdr, with
+// its control data) was received at receivedNs (RxTimestampNow)
+struct msghdr;
+void RxTimestampRecord(const struct msghdr *msg, uint64_t receivedNs);
+
+
+#endif /* RX_TIMESTAMP_H_ */
@@ -0,0 +1,43 @@
+/*
+ * thread_slot.h
+ *
+ * Per-thread counter blocks
+ * A module keeps an array of counter blocks and every thread claims one
+ * the first time it counts, so it is the only writer of that block and an
+ * increment is a plain load, add and store (no locked instruction).
+ * Threads past the end of the array share its last block, where the
+ * increments are atomic read-modify-writes instead, so none is lost
+ */
+
+#ifndef THREAD_SLOT_H_
+#define THREAD_SLOT_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Claim one of count blocks with the claim counter next and return its index.
+// *shared is set for the last block, which the threads beyond count share.
+static inline int ThreadSlotClaim(atomic_int *next, int count, int *shared) {
+	int slot = atomic_fetch_add_explicit(next, 1, memory_order_relaxed);
+	*shared = (slot >= count - 1);
+	return *shared ? count - 1 : slot;
+}
+
+// Add n to a counter of the block claimed with ThreadSlotClaim
+static inline void ThreadSlotAdd(atomic_uint_fast64_t *counter, uint64_t n, int shared) {
+	if (shared) {
+		atomic_fetch_add_explicit(counter, n, memory_order_relaxed);
+	} else {
+		atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+		                      memory_order_relaxed);
+	}
+}
+
+
+#endif /* THREAD_SLOT_H_ */
@@ -0,0 +1,504 @@
+/*
+ * uring_loop.c
+ *
+ * io_uring reception loop on raw system calls (no liburing dependency).
+ * Needs Linux 6.0 (multishot recvmsg, provided buffer rings); on older
+ * kernels or without IO_URING=1 RunUringLoop returns -1 and the server
+ * keeps using the recvmmsg loop.
+ */
+
+#include <stdio.h>
+#include "uring_loop.h"
+
+#if defined(__linux__) && defined(HAVE_IO_URING)
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <linux/io_uring.h>
+#include "protocol.h"
+#include "request_scan.h"
+#include "metrics.h"
+#include "rx_drops.h"
+#include "rx_timestamp.h"
+#include "profile.h"
+
+#define RECV_USER_DATA UINT64_MAX
+#define STOP_USER_DATA (UINT64_MAX - 1)
+#define BUFFER_GROUP 0
+
+// Receive buffer layout: recvmsg header, client address, control data (drop counter),
+// payload, scanner slack
+#define RECV_NAME_OFFSET ((int)sizeof(struct io_uring_recvmsg_out))
+#define RECV_CONTROL_OFFSET (RECV_NAME_OFFSET + (int)sizeof(struct sockaddr_in))
+#define RECV_PAYLOAD_OFFSET (RECV_CONTROL_OFFSET + RX_CONTROL_SIZE)
+#define RECV_BUFFER_LEN (RECV_PAYLOAD_OFFSET + BUFFER_SIZE - 1)
+#define RECV_BUFFER_STRIDE ((RECV_BUFFER_LEN + SCAN_MIN_BUFFER + 63) & ~63)
+
+// Reply waiting for its sendmsg completion
+struct send_slot {
+	struct msghdr msg;
+	struct iovec iov;
+	struct sockaddr_in addr;
+	char data[BUFFER_SIZE];
+};
+
+// Datagram taken from a completion, waiting to be processed with its batch
+struct recv_item {
+	const char *payload;
+	int length;
+	const struct sockaddr_in *addr;
+	int bufferId;
+};
+
+struct uring {
+	int fd;
+	// Submission queue
+	void *sqRing;
+	size_t sqRingSize;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned sqMask;
+	unsigned sqEntries;
+	unsigned *sqArray;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned sqLocalTail;
+	unsigned toSubmit;
+	// Completion queue
+	void *cqRing;
+	size_t cqRingSize;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned cqMask;
+	struct io_uring_cqe *cqes;
+	// Provided receive buffers
+	struct io_uring_buf *bufRing;
+	uint16_t bufTail;
+	char *buffers;
+	struct msghdr recvTemplate;
+	// Replies in flight
+	struct send_slot *slots;
+	int freeSlots[URING_SEND_SLOTS];
+	int freeCount;
+	// Batch work area, as in the recvmmsg loop
+	struct recv_item items[SERVER_MAX_BATCH];
+	struct reply replies[SERVER_MAX_BATCH];
+};
+
+static int SysSetup(unsigned entries, struct io_uring_params *params) {
+	return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int SysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, NULL, 0);
+}
+
+static int SysRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+static void UringClose(struct uring *ring) {
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED) {
+		munmap(ring->sqes, ring->sqesSize);
+	}
+	if (ring->cqRing != NULL && ring->cqRing != MAP_FAILED && ring->cqRing != ring->sqRing) {
+		munmap(ring->cqRing, ring->cqRingSize);
+	}
+	if (ring->sqRing != NULL && ring->sqRing != MAP_FAILED) {
+		munmap(ring->sqRing, ring->sqRingSize);
+	}
+	if (ring->bufRing != NULL) {
+		munmap(ring->bufRing, URING_RECV_BUFFERS * sizeof(struct io_uring_buf));
+	}
+	if (ring->fd >= 0) {
+		close(ring->fd);
+	}
+	free(ring->buffers);
+	free(ring->slots);
+	free(ring);
+}
+
+// Create the ring and map its queues; returns 0 or -1
+static int UringSetup(struct uring *ring) {
+	// Single issuer and cooperative task running cut kernel overhead; retry without them on older kernels
+	static const unsigned flagSets[] = {
+		IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN | IORING_SETUP_SINGLE_ISSUER,
+		0
+	};
+	struct io_uring_params params;
+
+	for (int i = 0; i < 2; i++) {
+		memset(&params, 0, sizeof(params));
+		params.flags = flagSets[i];
+		ring->fd = SysSetup(URING_ENTRIES, &params);
+		if (ring->fd >= 0) {
+			break;
+		}
+	}
+	if (ring->fd < 0) {
+		return -1;
+	}
+
+	ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqRingSize > ring->sqRingSize) {
+			ring->sqRingSize = ring->cqRingSize;
+		}
+		ring->cqRingSize = ring->sqRingSize;
+	}
+
+	ring->sqRing = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	                    IORING_OFF_SQ_RING);
+	if (ring->sqRing == MAP_FAILED) {
+		return -1;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqRing = ring->sqRing;
+	} else {
+		ring->cqRing = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+		                    IORING_OFF_CQ_RING);
+		if (ring->cqRing == MAP_FAILED) {
+			return -1;
+		}
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+	                  IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		return -1;
+	}
+
+	char *sq = ring->sqRing;
+	char *cq = ring->cqRing;
+	ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = *(unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqEntries = params.sq_entries;
+	ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+	ring->sqLocalTail = *ring->sqTail;
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = *(unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 0;
+}
+
+// Register the socket and the receive buffer ring; returns 0 or -1
+static int UringRegister(struct uring *ring, int sock) {
+	int files[1] = { sock };
+	if (SysRegister(ring->fd, IORING_REGISTER_FILES, files, 1) < 0) {
+		return -1;
+	}
+
+	ring->bufRing = mmap(NULL, URING_RECV_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+	                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ring->bufRing == MAP_FAILED) {
+		ring->bufRing = NULL;
+		return -1;
+	}
+	ring->buffers = calloc(URING_RECV_BUFFERS, RECV_BUFFER_STRIDE);
+	if (ring->buffers == NULL) {
+		return -1;
+	}
+
+	struct io_uring_buf_reg reg;
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr = (uint64_t)(uintptr_t)ring->bufRing;
+	reg.ring_entries = URING_RECV_BUFFERS;
+	reg.bgid = BUFFER_GROUP;
+	if (SysRegister(ring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+// Hand a receive buffer back to the kernel (published by PublishBuffers)
+static void RecycleBuffer(struct uring *ring, int bufferId) {
+	struct io_uring_buf *buf = &ring->bufRing[ring->bufTail & (URING_RECV_BUFFERS - 1)];
+	buf->addr = (uint64_t)(uintptr_t)(ring->buffers + (size_t)bufferId * RECV_BUFFER_STRIDE);
+	buf->len = RECV_BUFFER_LEN;
+	buf->bid = (uint16_t)bufferId;
+	ring->bufTail++;
+}
+
+static void PublishBuffers(struct uring *ring) {
+	// The tail shares its location with the resv field of the first entry
+	uint16_t *tail = (uint16_t *)((char *)ring->bufRing + 14);
+	__atomic_store_n(tail, ring->bufTail, __ATOMIC_RELEASE);
+}
+
+// Submit queued entries; with wait set, also block for at least one completion
+static int UringSubmit(struct uring *ring, int wait) {
+	__atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+	for (;;) {
+		int ret = SysEnter(ring->fd, ring->toSubmit, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0);
+		if (ret >= 0) {
+			ring->toSubmit -= (unsigned)ret < ring->toSubmit ? (unsigned)ret : ring->toSubmit;
+			return 0;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EAGAIN || errno == EBUSY) {
+			// Completion queue backlog: let the caller reap first
+			return 0;
+		}
+		return -1;
+	}
+}
+
+static struct io_uring_sqe *GetSqe(struct uring *ring) {
+	unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+	if (ring->sqLocalTail - head == ring->sqEntries) {
+		// Queue full: push what is there to the kernel first
+		if (UringSubmit(ring, 0) != 0) {
+			return NULL;
+		}
+		head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		if (ring->sqLocalTail - head == ring->sqEntries) {
+			return NULL;
+		}
+	}
+	unsigned index = ring->sqLocalTail & ring->sqMask;
+	struct io_uring_sqe *sqe = &ring->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->sqArray[index] = index;
+	ring->sqLocalTail++;
+	ring->toSubmit++;
+	return sqe;
+}
+
+// Post the multishot receive; it keeps producing completions until it is cancelled or runs out of buffers
+static int ArmReceive(struct uring *ring) {
+	struct io_uring_sqe *sqe = GetSqe(ring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_RECVMSG;
+	sqe->fd = 0; // registered file index
+	sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->addr = (uint64_t)(uintptr_t)&ring->recvTemplate;
+	sqe->len = 1;
+	sqe->buf_group = BUFFER_GROUP;
+	sqe->user_data = RECV_USER_DATA;
+	return 0;
+}
+
+// The stop thread shuts the socket down for reading, which wakes no receive:
+// a poll for that hang-up is what ends the wait (ServerStopping)
+static int ArmStopPoll(struct uring *ring) {
+	struct io_uring_sqe *sqe = GetSqe(ring);
+	if (sqe == NULL) {
+		return -1;
+	}
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = 0;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->poll32_events = POLLRDHUP;
+	sqe->user_data = STOP_USER_DATA;
+	return 0;
+}
+
+static void QueueSend(struct uring *ring, const struct recv_item *item, const struct reply *reply, uint64_t start) {
+	if (ring->freeCount == 0) {
+		// Every slot still in flight: drop the reply, as a full socket buffer would
+		MetricsRecordSendErrors(1);
+		return;
+	}
+	int slotIndex = ring->freeSlots[--ring->freeCount];
+	struct send_slot *slot = &ring->slots[slotIndex];
+	const struct sockaddr_in *addr = item->addr;
+
+	int size = SerializeReply(reply, slot->data, BUFFER_SIZE);
+	MetricsRecordReply(reply, item->length, size, MetricsNowNs() - start);
+	struct io_uring_sqe *sqe = (size > 0) ? GetSqe(ring) : NULL;
+	if (sqe == NULL) {
+		ring->freeSlots[ring->freeCount++] = slotIndex;
+		return;
+	}
+
+	slot->addr = *addr;
+	slot->iov.iov_base = slot->data;
+	slot->iov.iov_len = (size_t)size;
+	memset(&slot->msg, 0, sizeof(slot->msg));
+	slot->msg.msg_name = &slot->addr;
+	slot->msg.msg_namelen = sizeof(slot->addr);
+	slot->msg.msg_iov = &slot->iov;
+	slot->msg.msg_iovlen = 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = 0;
+	sqe->flags = IOSQE_FIXED_FILE;
+	sqe->addr = (uint64_t)(uintptr_t)&slot->msg;
+	sqe->len = 1;
+	sqe->user_data = (uint64_t)slotIndex;
+}
+
+// Validate and queue replies for the datagrams collected since start, then recycle their buffers
+static void ProcessItems(struct uring *ring, int count, uint64_t start) {
+	for (int i = 0; i < count; i++) {
+		ProcessRequest(ring->items[i].payload, ring->items[i].length, ring->items[i].addr, &ring->replies[i]);
+	}
+
+	for (int i = 0; i < count; i++) {
+		if (ring->replies[i].data.count > 0) {
+			QueueSend(ring, &ring->items[i], &ring->replies[i], start);
+		}
+		RecycleBuffer(ring, ring->items[i].bufferId);
+	}
+	PublishBuffers(ring);
+}
+
+static int UringInit(struct uring *ring, int sock) {
+	ring->fd = -1;
+	if (UringSetup(ring) != 0 || UringRegister(ring, sock) != 0) {
+		return -1;
+	}
+
+	ring->slots = calloc(URING_SEND_SLOTS, sizeof(struct send_slot));
+	if (ring->slots == NULL) {
+		return -1;
+	}
+	for (int i = 0; i < URING_SEND_SLOTS; i++) {
+		ring->freeSlots[i] = URING_SEND_SLOTS - 1 - i;
+	}
+	ring->freeCount = URING_SEND_SLOTS;
+
+	for (int i = 0; i < URING_RECV_BUFFERS; i++) {
+		RecycleBuffer(ring, i);
+	}
+	PublishBuffers(ring);
+
+	// Only the lengths of the template matter: address, then room for the drop counter
+	ring->recvTemplate.msg_namelen = sizeof(struct sockaddr_in);
+	ring->recvTemplate.msg_controllen = RX_CONTROL_SIZE;
+	return (ArmStopPoll(ring) == 0) ? ArmReceive(ring) : -1;
+}
+
+int RunUringLoop(int sock) {
+	struct uring *ring = calloc(1, sizeof(struct uring));
+	if (ring == NULL) {
+		return -1;
+	}
+	if (UringInit(ring, sock) != 0) {
+		UringClose(ring);
+		return -1;
+	}
+
+	int served = 0;
+	while (1) {
+		// One system call: submit queued replies (and re-arms) and wait for work
+		PROFILE_MARK();
+		int submitted = UringSubmit(ring, 1);
+		PROFILE_LAP(PROFILE_RECEIVE);
+		if (submitted != 0) {
+			perror("io_uring_enter");
+			if (!served) {
+				UringClose(ring);
+				return -1;
+			}
+			continue;
+		}
+
+		uint64_t start = MetricsNowNs();
+		uint64_t receivedNs = RxTimestampNow();   // the whole round's datagrams reached the server here
+		unsigned head = *ring->cqHead;
+		unsigned tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+		int pending = 0;
+		int rearm = 0;
+
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & ring->cqMask];
+
+			if (cqe->user_data == STOP_USER_DATA) {
+				continue; // checked below, after this round's datagrams
+			}
+			if (cqe->user_data != RECV_USER_DATA) {
+				// Reply sent: the slot can be reused
+				if (cqe->res < 0) {
+					MetricsRecordSendErrors(1);
+					fprintf(stderr, "Error sending response: %s\n", strerror(-cqe->res));
+				}
+				ring->freeSlots[ring->freeCount++] = (int)cqe->user_data;
+				continue;
+			}
+
+			if (!(cqe->flags & IORING_CQE_F_MORE)) {
+				rearm = 1;
+			}
+			if (cqe->res < 0) {
+				if (cqe->res == -EINVAL && !served) {
+					// Kernel without multishot recvmsg
+					UringClose(ring);
+					return -1;
+				}
+				if (cqe->res != -ENOBUFS) {
+					MetricsRecordRecvError();
+					fprintf(stderr, "Error receiving data: %s\n", strerror(-cqe->res));
+				}
+				continue;
+			}
+
+			int bufferId = (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			char *buf = ring->buffers + (size_t)bufferId * RECV_BUFFER_STRIDE;
+			struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+			int length = cqe->res - RECV_PAYLOAD_OFFSET;
+			if (out->namelen < sizeof(struct sockaddr_in) || length < 0) {
+				RecycleBuffer(ring, bufferId);
+				PublishBuffers(ring);
+				continue;
+			}
+
+			// Control data as a header of its own, for the CMSG macros
+			struct msghdr control;
+			memset(&control, 0, sizeof(control));
+			control.msg_control = buf + RECV_CONTROL_OFFSET;
+			control.msg_controllen = out->controllen;
+			RxDropsRecord(sock, &control);
+			RxTimestampRecord(&control, receivedNs);
+
+			ring->items[pending].payload = buf + RECV_PAYLOAD_OFFSET;
+			ring->items[pending].length = length;
+			ring->items[pending].addr = (const struct sockaddr_in *)(buf + RECV_NAME_OFFSET);
+			ring->items[pending].bufferId = bufferId;
+			served = 1;
+			if (++pending == SERVER_MAX_BATCH) {
+				ProcessItems(ring, pending, start);
+				pending = 0;
+			}
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+
+		if (pending > 0) {
+			ProcessItems(ring, pending, start);
+		}
+		if (ServerStopping()) {
+			// Hand the last replies to the kernel before the ring goes away
+			UringSubmit(ring, 0);
+			UringClose(ring);
+			return 0;
+		}
+		if (rearm && ArmReceive(ring) != 0) {
+			fprintf(stderr, "Error re-arming io_uring receive\n");
+		}
+	}
+}
+
+#else
+
+int RunUringLoop(int sock) {
+	(void)sock;
+	return -1;
+}
+
+#endif
@@ -0,0 +1,36 @@
+/*
+ * uring_loop.h
+ *
+ * io_uring reception loop (Linux, built with make IO_URING=1)
+ * One multishot recvmsg stays armed on the socket and fills buffers from a
+ * ring registered with the kernel; replies are queued as sendmsg requests
+ * and submitted together with the wait for new datagrams, so the loop makes
+ * one system call per wakeup whatever the number of requests
+ */
+
+#ifndef URING_LOOP_H_
+#define URING_LOOP_H_
+
+/*
+ * ============================================================================
+ * IO_URING CONSTANTS
+ * ============================================================================
+ */
+
+#define URING_ENTRIES 256         // voci della submission queue
+#define URING_RECV_BUFFERS 256    // buffer di ricezione registrati (potenza di 2)
+#define URING_SEND_SLOTS 512      // risposte in attesa di completamento
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Serve requests on sock with io_uring; returns 0 once the server stops
+// (ServerStopping). Returns -1 right away if io_uring (or a feature it needs) is not available,
+// so the caller can fall back to the recvmmsg/recvfrom loops.
+int RunUringLoop(int sock);
+
+
+#endif /* URING_LOOP_H_ */
@@ -0,0 +1,56 @@
+/*
+ * validate.c
+ *
+ * Request validation: type check, city character rules and lookup in the
+ * city catalog
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+#include <stddef.h>
+#include <ctype.h>
+#include "protocol.h"
+#include "catalog.h"
+
+// Validate request type
+int ValidateRequestType(char type) {
+	return (type == 't' || type == 'h' || type == 'w' || type == 'p');
+}
+
+// Classify a city in one pass: 0 = supported, 1 = not found, 2 = invalid characters.
+// If cityId is not NULL it receives the table ID of a supported city.
+int ClassifyCity(const char *city, int *cityId) {
+	char folded[MAX_CITY_LENGTH];
+	int len = 0;
+	
+	for (; city[len] != '\0'; len++) {
+		if (len == MAX_CITY_LENGTH - 1) {
+			return 1;
+		}
+		// Alphanumeric, space, apostrophe or hyphen (the scanner's classes, request_scan.h)
+		if (!isalnum((unsigned char)city[len]) &&
+		    city[len] != ' ' &&
+		    city[len] != '\'' &&
+		    city[len] != '-') {
+			return 2;
+		}
+		folded[len] = CityFoldChar(city[len]);
+	}
+	
+	const struct city_table *table = CatalogEnter();
+	int id = CityTableFind(table, folded, len, CityHashFolded(table->seed, folded, len));
+	CatalogExit();
+	if (cityId != NULL) {
+		*cityId = id;
+	}
+	return (id == CITY_NOT_FOUND) ? 1 : 0;
+}
+
+// Validate city name
+int ValidateCity(const char *city) {
+	return ClassifyCity(city, NULL) == 0;
+}
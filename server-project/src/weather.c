@@ -0,0 +1,430 @@
+/*
+ * weather.c
+ *
+ * Weather data generation.
+ * Requests read the snapshot published by the tick thread (weather.h);
+ * the Get* functions remain independent draws on the per-thread
+ * generator (rng.h). Snapshots are double buffered: the tick thread
+ * always writes the buffer readers are not pointed at, and a sequence
+ * counter per buffer (seqlock) lets a reader that was preempted across a
+ * whole tick notice the overwrite and read again.
+ * Each snapshot also holds its values already encoded as responses, so
+ * replies are copied rather than serialized; error responses depend only
+ * on (status, type) and are encoded once at start.
+ * Windows has no tick thread: the request thread takes the due ticks.
+ */
+
+#if defined(_WIN32) || defined(WIN32)
+#include <winsock2.h>
+#else
+#include <netinet/in.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#if !defined(_WIN32) && !defined(WIN32)
+#include <pthread.h>
+#endif
+#include "protocol.h"
+#include "rng.h"
+#include "weather.h"
+#include "thread_slot.h"
+
+// Range and largest change per tick of one weather type
+struct weather_range {
+	char type;
+	float min;
+	float max;
+	float step;
+};
+
+static const struct weather_range g_ranges[WEATHER_TYPES] = {
+	{ 't', -10.0f, 40.0f, 0.5f },     // °C
+	{ 'h', 20.0f, 100.0f, 2.0f },     // %
+	{ 'w', 0.0f, 100.0f, 5.0f },      // km/h
+	{ 'p', 950.0f, 1050.0f, 1.0f }    // hPa
+};
+
+// One published copy of every value: values[type][cityId], and the same value
+// as a status 0 response at wire[type] + cityId * BATCH_RESPONSE_ENTRY_SIZE
+struct weather_snapshot {
+	atomic_uint seq;                  // dispari = in scrittura
+	float *values[WEATHER_TYPES];
+	char *wire[WEATHER_TYPES];
+};
+
+// Response cache counters of one request thread (own cache line, one writer)
+struct cache_counters {
+	_Alignas(64) atomic_uint_fast64_t hits;
+	atomic_uint_fast64_t misses;
+};
+
+static struct weather_snapshot g_snapshots[2];
+static atomic_int g_current;          // snapshot letto dalle richieste
+static float *g_state[WEATHER_TYPES]; // stato della simulazione (solo thread di tick)
+static float *g_steps;                // estrazioni di un tick
+static int g_cityCount = 0;
+static int g_tickMs = WEATHER_DEFAULT_TICK_MS;
+static uint64_t g_seed = 0;
+static int g_started = 0;
+#if !defined(_WIN32) && !defined(WIN32)
+static int g_running = 0;             // protetto da g_tickLock
+static pthread_mutex_t g_tickLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_tickCond = PTHREAD_COND_INITIALIZER;
+static pthread_t g_tickThread;
+#else
+static struct timespec g_nextTick;    // scadenza del prossimo tick (nessun thread di tick)
+#endif
+
+// Status 1, 2 and 3 (STATUS_STALE_CATALOG) responses for every echoed type byte
+static char g_errorWire[3][256][BATCH_RESPONSE_ENTRY_SIZE];
+static struct cache_counters g_counters[WEATHER_COUNTER_SLOTS];
+static atomic_int g_counterSlots;
+static atomic_uint_fast64_t g_encoded;
+static _Thread_local struct cache_counters *t_counters;
+static _Thread_local int t_shared;        // t_counters è l'ultimo blocco, condiviso
+
+// Get temperature (-10.0 to 40.0 °C)
+float GetTemperature(void) {
+	return RngUnit() * 50.0f - 10.0f;
+}
+
+// Get humidity (20.0 to 100.0%)
+float GetHumidity(void) {
+	return RngUnit() * 80.0f + 20.0f;
+}
+
+// Get wind speed (0.0 to 100.0 km/h)
+float GetWind(void) {
+	return RngUnit() * 100.0f;
+}
+
+// Get pressure (950.0 to 1050.0 hPa)
+float GetPressure(void) {
+	return RngUnit() * 100.0f + 950.0f;
+}
+
+// Value for a validated request type ('t', 'h', 'w' or 'p')
+float GetWeatherValue(char type) {
+	switch (type) {
+		case 't':
+			return GetTemperature();
+		case 'h':
+			return GetHumidity();
+		case 'w':
+			return GetWind();
+		case 'p':
+			return GetPressure();
+		default:
+			return 0.0f;
+	}
+}
+
+// Index of a validated request type in the snapshot arrays
+static int TypeIndex(char type) {
+	switch (type) {
+		case 't':
+			return 0;
+		case 'h':
+			return 1;
+		case 'w':
+			return 2;
+		default:
+			return 3;
+	}
+}
+
+// Advance every city by a random step in [-step, step], reflected at the range ends
+static void AdvanceState(void) {
+	for (int t = 0; t < WEATHER_TYPES; t++) {
+		const struct weather_range *r = &g_ranges[t];
+		float *v = g_state[t];
+
+		RngFillUnit(g_steps, g_cityCount);
+		for (int c = 0; c < g_cityCount; c++) {
+			float x = v[c] + (g_steps[c] * 2.0f - 1.0f) * r->step;
+			if (x < r->min) {
+				x = 2.0f * r->min - x;
+			} else if (x > r->max) {
+				x = 2.0f * r->max - x;
+			}
+			v[c] = x;
+		}
+	}
+}
+
+// Copy the state into the buffer readers are not using, then point them at it
+static void PublishState(void) {
+	int next = 1 - atomic_load_explicit(&g_current, memory_order_relaxed);
+	struct weather_snapshot *snap = &g_snapshots[next];
+	unsigned seq = atomic_load_explicit(&snap->seq, memory_order_relaxed);
+
+	atomic_store_explicit(&snap->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for (int t = 0; t < WEATHER_TYPES; t++) {
+		struct response resp = { 0, g_ranges[t].type, 0.0f };
+		memcpy(snap->values[t], g_state[t], (size_t)g_cityCount * sizeof(float));
+		for (int c = 0; c < g_cityCount; c++) {
+			resp.value = g_state[t][c];
+			SerializeResponse(&resp, snap->wire[t] + (size_t)c * BATCH_RESPONSE_ENTRY_SIZE,
+			                  BATCH_RESPONSE_ENTRY_SIZE);
+		}
+	}
+	atomic_store_explicit(&snap->seq, seq + 2, memory_order_release);
+	atomic_fetch_add_explicit(&g_encoded, (uint_fast64_t)g_cityCount * WEATHER_TYPES, memory_order_relaxed);
+	atomic_store_explicit(&g_current, next, memory_order_release);
+}
+
+// Move a deadline one tick later
+static void AddTick(struct timespec *deadline) {
+	deadline->tv_sec += g_tickMs / 1000;
+	deadline->tv_nsec += (long)(g_tickMs % 1000) * 1000000L;
+	if (deadline->tv_nsec >= 1000000000L) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000L;
+	}
+}
+
+#if !defined(_WIN32) && !defined(WIN32)
+// Tick thread: one simulation step per tick, on absolute deadlines so ticks do not drift
+static void *TickMain(void *arg) {
+	struct timespec deadline;
+	(void)arg;
+
+	// Own stream of the seed, after the workers' ones
+	RngSeed(g_seed, SERVER_MAX_WORKERS);
+	clock_gettime(CLOCK_REALTIME, &deadline);
+
+	pthread_mutex_lock(&g_tickLock);
+	while (g_running) {
+		AddTick(&deadline);
+		while (g_running && pthread_cond_timedwait(&g_tickCond, &g_tickLock, &deadline) == 0) {
+		}
+		if (!g_running) {
+			break;
+		}
+		pthread_mutex_unlock(&g_tickLock);
+		AdvanceState();
+		PublishState();
+		pthread_mutex_lock(&g_tickLock);
+	}
+	pthread_mutex_unlock(&g_tickLock);
+	return NULL;
+}
+#else
+// No tick thread: the request thread (the only one here) takes a due tick before
+// reading the snapshot, on the stream WeatherStart left it; idle time skips ticks
+static void TakeDueTick(void) {
+	struct timespec now;
+	timespec_get(&now, TIME_UTC);
+	if (now.tv_sec < g_nextTick.tv_sec || (now.tv_sec == g_nextTick.tv_sec && now.tv_nsec < g_nextTick.tv_nsec)) {
+		return;
+	}
+	AdvanceState();
+	PublishState();
+	g_nextTick = now;
+	AddTick(&g_nextTick);
+}
+#endif
+
+// Release the simulation state and both snapshots (allocation failure in WeatherStart)
+static void FreeState(void) {
+	free(g_steps);
+	g_steps = NULL;
+	for (int t = 0; t < WEATHER_TYPES; t++) {
+		free(g_state[t]);
+		g_state[t] = NULL;
+		for (int b = 0; b < 2; b++) {
+			free(g_snapshots[b].values[t]);
+			free(g_snapshots[b].wire[t]);
+			g_snapshots[b].values[t] = NULL;
+			g_snapshots[b].wire[t] = NULL;
+		}
+	}
+}
+
+int WeatherStart(int cityCount, uint64_t seed, int tickMs) {
+	g_cityCount = cityCount;
+	g_tickMs = tickMs;
+	g_seed = seed;
+
+	// One block per array, so each type is contiguous over the cities
+	size_t cities = (size_t)(g_cityCount > 0 ? g_cityCount : 1);
+	size_t bytes = cities * sizeof(float);
+	g_steps = malloc(bytes);
+	int failed = (g_steps == NULL);
+	for (int t = 0; t < WEATHER_TYPES; t++) {
+		g_state[t] = malloc(bytes);
+		failed |= (g_state[t] == NULL);
+		for (int b = 0; b < 2; b++) {
+			g_snapshots[b].values[t] = malloc(bytes);
+			g_snapshots[b].wire[t] = malloc(cities * BATCH_RESPONSE_ENTRY_SIZE);
+			failed |= (g_snapshots[b].values[t] == NULL || g_snapshots[b].wire[t] == NULL);
+		}
+	}
+	if (failed) {
+		FreeState();
+		fprintf(stderr, "Error allocating weather state\n");
+		return -1;
+	}
+
+	// Initial values: uniform over each range, from the tick thread's stream
+	RngSeed(seed, SERVER_MAX_WORKERS);
+	for (int t = 0; t < WEATHER_TYPES; t++) {
+		const struct weather_range *r = &g_ranges[t];
+		RngFillUnit(g_state[t], g_cityCount);
+		for (int c = 0; c < g_cityCount; c++) {
+			g_state[t][c] = r->min + g_state[t][c] * (r->max - r->min);
+		}
+	}
+	for (int status = 1; status <= STATUS_STALE_CATALOG; status++) {
+		for (int type = 0; type < 256; type++) {
+			struct response resp = { (unsigned int)status, (char)type, 0.0f };
+			SerializeResponse(&resp, g_errorWire[status - 1][type], BATCH_RESPONSE_ENTRY_SIZE);
+		}
+	}
+	atomic_init(&g_snapshots[0].seq, 0);
+	atomic_init(&g_snapshots[1].seq, 0);
+	atomic_init(&g_current, 1);
+	PublishState();
+	g_started = 1;
+
+#if !defined(_WIN32) && !defined(WIN32)
+	g_running = 1;
+	int err = pthread_create(&g_tickThread, NULL, TickMain, NULL);
+	if (err != 0) {
+		// Values stay frozen at the first snapshot
+		fprintf(stderr, "Error starting weather tick thread: %s\n", strerror(err));
+		g_running = 0;
+		return -1;
+	}
+#else
+	timespec_get(&g_nextTick, TIME_UTC);
+	AddTick(&g_nextTick);
+#endif
+	return 0;
+}
+
+void WeatherStop(void) {
+#if !defined(_WIN32) && !defined(WIN32)
+	pthread_mutex_lock(&g_tickLock);
+	int running = g_running;
+	g_running = 0;
+	pthread_cond_signal(&g_tickCond);
+	pthread_mutex_unlock(&g_tickLock);
+	if (running) {
+		pthread_join(g_tickThread, NULL);
+	}
+#endif
+
+	struct weather_cache_stats stats;
+	WeatherGetCacheStats(&stats);
+	if (stats.hits + stats.misses > 0) {
+		fprintf(stderr, "Response cache: %llu hits, %llu misses, %llu entries encoded\n",
+		        (unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.encoded);
+	}
+}
+
+// Counters of the calling thread, claimed on first use
+static struct cache_counters *ThreadCounters(void) {
+	if (t_counters == NULL) {
+		t_counters = &g_counters[ThreadSlotClaim(&g_counterSlots, WEATHER_COUNTER_SLOTS, &t_shared)];
+	}
+	return t_counters;
+}
+
+// Encode responses one by one (before WeatherStart)
+static void EncodeUncached(const struct response *results, const int *cityIds, int count, char *out) {
+	for (int i = 0; i < count; i++) {
+		struct response resp = results[i];
+		if (resp.status == 0) {
+			FillWeatherValues(&resp.type, &cityIds[i], &resp.value, 1);
+		}
+		SerializeResponse(&resp, out + (size_t)i * BATCH_RESPONSE_ENTRY_SIZE, BATCH_RESPONSE_ENTRY_SIZE);
+	}
+}
+
+void EncodeWeatherResponses(const struct response *results, const int *cityIds, int count, char *out) {
+	struct cache_counters *counters = ThreadCounters();
+	int hits = 0;
+
+	if (!g_started) {
+		EncodeUncached(results, cityIds, count, out);
+		ThreadSlotAdd(&counters->misses, (uint64_t)count, t_shared);
+		return;
+	}
+#if defined(_WIN32) || defined(WIN32)
+	TakeDueTick();
+#endif
+
+	for (;;) {
+		const struct weather_snapshot *snap =
+			&g_snapshots[atomic_load_explicit(&g_current, memory_order_acquire)];
+		unsigned seq = atomic_load_explicit(&snap->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		hits = 0;
+		for (int i = 0; i < count; i++) {
+			const char *src;
+			if (results[i].status == 0) {
+				hits++;
+				src = snap->wire[TypeIndex(results[i].type)] + (size_t)cityIds[i] * BATCH_RESPONSE_ENTRY_SIZE;
+			} else {
+				unsigned int status = (results[i].status <= STATUS_STALE_CATALOG) ? results[i].status : 2;
+				src = g_errorWire[status - 1][(unsigned char)results[i].type];
+			}
+			memcpy(out + (size_t)i * BATCH_RESPONSE_ENTRY_SIZE, src, BATCH_RESPONSE_ENTRY_SIZE);
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&snap->seq, memory_order_relaxed) == seq) {
+			break;
+		}
+	}
+	// Only values come from the snapshot: errors are copied from the error table
+	ThreadSlotAdd(&counters->hits, (uint64_t)hits, t_shared);
+	ThreadSlotAdd(&counters->misses, (uint64_t)(count - hits), t_shared);
+}
+
+void WeatherGetCacheStats(struct weather_cache_stats *stats) {
+	stats->hits = 0;
+	stats->misses = 0;
+	for (int i = 0; i < WEATHER_COUNTER_SLOTS; i++) {
+		stats->hits += atomic_load_explicit(&g_counters[i].hits, memory_order_relaxed);
+		stats->misses += atomic_load_explicit(&g_counters[i].misses, memory_order_relaxed);
+	}
+	stats->encoded = atomic_load_explicit(&g_encoded, memory_order_relaxed);
+}
+
+// Fill values for a batch of validated (type, city) queries from the latest snapshot
+void FillWeatherValues(const char *types, const int *cityIds, float *values, int count) {
+	if (!g_started) {
+		for (int i = 0; i < count; i++) {
+			values[i] = GetWeatherValue(types[i]);
+		}
+		return;
+	}
+#if defined(_WIN32) || defined(WIN32)
+	TakeDueTick();
+#endif
+
+	// The whole batch comes from one snapshot; retry only if it was rewritten meanwhile
+	for (;;) {
+		const struct weather_snapshot *snap =
+			&g_snapshots[atomic_load_explicit(&g_current, memory_order_acquire)];
+		unsigned seq = atomic_load_explicit(&snap->seq, memory_order_acquire);
+		if (seq & 1) {
+			continue;
+		}
+		for (int i = 0; i < count; i++) {
+			values[i] = snap->values[TypeIndex(types[i])][cityIds[i]];
+		}
+		atomic_thread_fence(memory_order_acquire);
+		if (atomic_load_explicit(&snap->seq, memory_order_relaxed) == seq) {
+			return;
+		}
+	}
+}
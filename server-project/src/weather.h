@@ -0,0 +1,65 @@
+/*
+ * weather.h
+ *
+ * Weather snapshot engine
+ * Every supported city has one value per type, stored as one array per
+ * type (struct of arrays). A background thread advances them with a
+ * bounded random walk once per tick and publishes the result, together
+ * with the values already encoded as responses; requests only copy
+ * bytes out of the latest snapshot, without locks
+ */
+
+#ifndef WEATHER_H_
+#define WEATHER_H_
+
+#include <stdint.h>
+#include "protocol.h"
+
+/*
+ * ============================================================================
+ * SNAPSHOT CONSTANTS
+ * ============================================================================
+ */
+
+#define WEATHER_TYPES 4                 // 't', 'h', 'w', 'p'
+#define WEATHER_DEFAULT_TICK_MS 1000    // intervallo tra due aggiornamenti
+#define WEATHER_MAX_TICK_MS 3600000
+#define WEATHER_COUNTER_SLOTS (SERVER_MAX_WORKERS + 2)   // contatori della cache, uno per thread
+
+/*
+ * ============================================================================
+ * DATA STRUCTURES
+ * ============================================================================
+ */
+
+// Response cache counters (summed over the request threads)
+struct weather_cache_stats {
+    uint64_t hits;       // risposte copiate già codificate dallo snapshot
+    uint64_t misses;     // risposte non prese dallo snapshot: errori e codifiche prima di WeatherStart
+    uint64_t encoded;    // risposte codificate dal thread di tick: conviene se hits le supera
+};
+
+/*
+ * ============================================================================
+ * FUNCTION PROTOTYPES
+ * ============================================================================
+ */
+
+// Seed one state per city ID below cityCount (CatalogCapacity, so that reloaded
+// catalogs fit) from (seed, stream after the workers'), publish it and start the
+// tick thread (on Windows requests take the due ticks). Until it is called,
+// FillWeatherValues falls back to independent draws.
+int WeatherStart(int cityCount, uint64_t seed, int tickMs);
+
+// Stop the tick thread; the last snapshot stays readable
+void WeatherStop(void);
+
+// Write the count responses of results (BATCH_RESPONSE_ENTRY_SIZE bytes each) to out,
+// copied from the latest snapshot for status 0 and from the error table otherwise.
+// cityIds[i] is read for the status 0 entries.
+void EncodeWeatherResponses(const struct response *results, const int *cityIds, int count, char *out);
+
+void WeatherGetCacheStats(struct weather_cache_stats *stats);
+
+
+#endif /* WEATHER_H_ */
@@ -0,0 +1,97 @@
+/*
+ * gen_city_table.c
+ *
+ * Build-time generator for the built-in city table.
+ * Reads a city list (one name per line, '#' comments) and prints
+ * city_table.c: the perfect hash from city_hash.c as static arrays.
+ *
+ * Usage: gen_city_table cities.txt > city_table.c
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "city_hash.h"
+
+// Print a C string literal (city names never need escapes besides quotes)
+static void PrintLiteral(const char *s) {
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\') {
+			putchar('\\');
+		}
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+int main(int argc, char *argv[]) {
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s cities.txt\n", argv[0]);
+		return 1;
+	}
+
+	struct city_table table;
+	if (CityTableLoad(argv[1], &table) != 0) {
+		return 1;
+	}
+
+	printf("/*\n"
+	       " * city_table.c\n"
+	       " *\n"
+	       " * GENERATED by tools/gen_city_table.c from data/cities.txt - DO NOT EDIT\n"
+	       " * Perfect hash over the built-in city list (see city_hash.h)\n"
+	       " */\n\n"
+	       "#include \"city_hash.h\"\n\n");
+
+	printf("static const char *const g_cityNames[%d] = {\n", table.count);
+	for (int i = 0; i < table.count; i++) {
+		printf("\t");
+		PrintLiteral(table.names[i]);
+		printf(",\n");
+	}
+	printf("};\n\n");
+
+	printf("static const char *const g_cityKeys[%d] = {\n", table.count);
+	for (int i = 0; i < table.count; i++) {
+		printf("\t");
+		PrintLiteral(table.keys[i]);
+		printf(",\n");
+	}
+	printf("};\n\n");
+
+	printf("static const uint8_t g_cityLengths[%d] = {", table.count);
+	for (int i = 0; i < table.count; i++) {
+		printf("%s%s%u", i ? "," : "", (i % 16) ? " " : "\n\t", table.lengths[i]);
+	}
+	printf("\n};\n\n");
+
+	printf("static const uint32_t g_cityDisplacements[%d] = {", table.bucketCount);
+	for (int i = 0; i < table.bucketCount; i++) {
+		printf("%s%s%uu", i ? "," : "", (i % 8) ? " " : "\n\t", table.displacements[i]);
+	}
+	printf("\n};\n\n");
+
+	printf("static const int32_t g_citySlots[%d] = {", table.slotCount);
+	for (int i = 0; i < table.slotCount; i++) {
+		printf("%s%s%d", i ? "," : "", (i % 16) ? " " : "\n\t", table.slots[i]);
+	}
+	printf("\n};\n\n");
+
+	printf("const struct city_table g_cityTable = {\n"
+	       "\t0x%016llXull,\n"
+	       "\t%d,\n"
+	       "\t%d,\n"
+	       "\t%d,\n"
+	       "\tg_cityDisplacements,\n"
+	       "\tg_citySlots,\n"
+	       "\tg_cityNames,\n"
+	       "\tg_cityKeys,\n"
+	       "\tg_cityLengths,\n"
+	       "\t0x%08Xu\n"
+	       "};\n",
+	       (unsigned long long)table.seed, table.count, table.bucketCount, table.slotCount,
+	       (unsigned)table.version);
+
+	CityTableFree(&table);
+	return 0;
+}